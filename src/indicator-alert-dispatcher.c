@@ -0,0 +1,446 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib/gi18n.h>
+#include <ayatana/common/utils.h>
+#include "indicator-alert-dispatcher.h"
+#include "indicator-printer-reasons.h"
+#include "spawn-printer-settings.h"
+
+// Alerts that arrive within this many milliseconds end up in the same notification
+#define ALERT_BATCH_DELAY 1000
+
+// Seconds before the same reason is alerted again for the same printer
+#define ALERT_RATE_LIMIT 600
+
+#define NOTIFICATIONS_NAME "org.freedesktop.Notifications"
+#define NOTIFICATIONS_PATH "/org/freedesktop/Notifications"
+
+typedef struct
+{
+    gchar *sPrinter;
+    guint nJobs;
+    GPtrArray *lMessages;
+} PendingAlert;
+
+typedef struct
+{
+    // When each reason was last alerted, 0 if never
+    gint64 lLastAlerted[N_INDICATOR_PRINTER_REASONS];
+    gint64 nNewest;
+} RateLimit;
+
+typedef struct
+{
+    IndicatorAlertDispatcher *self;
+    gchar *sText;
+    // The sorted printer names of the batch, separated by \x1f
+    gchar *sPrinters;
+} NotifyData;
+
+struct _IndicatorAlertDispatcherPrivate
+{
+    GPtrArray *lPending;
+    // Printer name -> RateLimit
+    GHashTable *pRateLimits;
+    guint nBatchTimer;
+    GDBusConnection *pConnection;
+    // NotifyData waiting for the session bus, non-NULL while it is being connected
+    GPtrArray *lUnsent;
+    guint nSignalSubscription;
+    // Printers of a batch -> the id of its notification while it is shown, replaced by the next batch for the same printers
+    GHashTable *pNotifications;
+    GCancellable *pCancellable;
+    guint nNotificationsSent;
+    guint nRateLimited;
+};
+
+enum
+{
+    PROP_0,
+    PROP_NOTIFICATIONS_SENT,
+    PROP_ALERTS_RATE_LIMITED,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorAlertDispatcher, indicator_alert_dispatcher, G_TYPE_OBJECT)
+
+static void freePendingAlert (gpointer pData)
+{
+    PendingAlert *pAlert = pData;
+
+    g_free (pAlert->sPrinter);
+    g_ptr_array_unref (pAlert->lMessages);
+    g_free (pAlert);
+}
+
+static PendingAlert *getPendingAlert (IndicatorAlertDispatcher *self, const gchar *sPrinter)
+{
+    for (guint i = 0; i < self->pPrivate->lPending->len; i++)
+    {
+        PendingAlert *pAlert = g_ptr_array_index (self->pPrivate->lPending, i);
+
+        if (g_str_equal (pAlert->sPrinter, sPrinter))
+        {
+            return pAlert;
+        }
+    }
+
+    PendingAlert *pAlert = g_new0 (PendingAlert, 1);
+    pAlert->sPrinter = g_strdup (sPrinter);
+    pAlert->lMessages = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (self->pPrivate->lPending, pAlert);
+
+    return pAlert;
+}
+
+// Without a notification server, fall back to the dialog the indicator always used
+static void showAlertBox (const gchar *sText)
+{
+    ayatana_common_utils_zenity_warning ("printer", _("Printing Problem"), sText);
+    spawn_printer_settings ();
+}
+
+static void freeNotifyData (gpointer pData)
+{
+    NotifyData *pNotifyData = pData;
+
+    g_free (pNotifyData->sText);
+    g_free (pNotifyData->sPrinters);
+    g_free (pNotifyData);
+}
+
+static gboolean isNotification (gpointer pKey, gpointer pValue, gpointer pData)
+{
+    return GPOINTER_TO_UINT (pValue) == GPOINTER_TO_UINT (pData);
+}
+
+static void onNotificationSignal (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    IndicatorAlertDispatcher *self = INDICATOR_ALERT_DISPATCHER (pData);
+    guint32 nId;
+
+    if (g_str_equal (sSignal, "ActionInvoked") && g_variant_is_of_type (pParameters, G_VARIANT_TYPE ("(us)")))
+    {
+        const gchar *sAction;
+        g_variant_get (pParameters, "(u&s)", &nId, &sAction);
+
+        if (g_str_equal (sAction, "settings") && g_hash_table_find (self->pPrivate->pNotifications, isNotification, GUINT_TO_POINTER (nId)) != NULL)
+        {
+            spawn_printer_settings ();
+        }
+    }
+    else if (g_str_equal (sSignal, "NotificationClosed") && g_variant_is_of_type (pParameters, G_VARIANT_TYPE ("(uu)")))
+    {
+        // The next alert for these printers is a new notification
+        g_variant_get (pParameters, "(uu)", &nId, NULL);
+        g_hash_table_foreach_remove (self->pPrivate->pNotifications, isNotification, GUINT_TO_POINTER (nId));
+    }
+}
+
+static void onNotified (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    NotifyData *pNotifyData = pData;
+    GError *pError = NULL;
+    GVariant *pReply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (pObject), pResult, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+    }
+    else if (pError)
+    {
+        g_warning ("Could not send a notification: %s", pError->message);
+        g_error_free (pError);
+        showAlertBox (pNotifyData->sText);
+    }
+    else
+    {
+        guint32 nId;
+        g_variant_get (pReply, "(u)", &nId);
+        g_hash_table_replace (pNotifyData->self->pPrivate->pNotifications, g_strdup (pNotifyData->sPrinters), GUINT_TO_POINTER (nId));
+        pNotifyData->self->pPrivate->nNotificationsSent++;
+        g_variant_unref (pReply);
+    }
+
+    freeNotifyData (pNotifyData);
+}
+
+// Takes pNotifyData, an alert about other printers never replaces a notification the user has not seen yet
+static void sendNotification (IndicatorAlertDispatcher *self, NotifyData *pNotifyData)
+{
+    GVariantBuilder cActions;
+    g_variant_builder_init (&cActions, G_VARIANT_TYPE_STRING_ARRAY);
+    g_variant_builder_add (&cActions, "s", "settings");
+    g_variant_builder_add (&cActions, "s", _("Printer Settings"));
+    GVariantBuilder cHints;
+    g_variant_builder_init (&cHints, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&cHints, "{sv}", "urgency", g_variant_new_byte (1));
+    guint32 nReplacesId = GPOINTER_TO_UINT (g_hash_table_lookup (self->pPrivate->pNotifications, pNotifyData->sPrinters));
+    // Servers with body-markup parse the body, and CUPS allows & and < in queue names
+    gchar *sBody = g_markup_escape_text (pNotifyData->sText, -1);
+
+    g_dbus_connection_call (self->pPrivate->pConnection, NOTIFICATIONS_NAME, NOTIFICATIONS_PATH, NOTIFICATIONS_NAME, "Notify", g_variant_new ("(susssasa{sv}i)", "ayatana-indicator-printers", nReplacesId, "printer", _("Printing Problem"), sBody, &cActions, &cHints, -1), G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, self->pPrivate->pCancellable, onNotified, pNotifyData);
+    g_free (sBody);
+}
+
+static void onBusGot (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    GDBusConnection *pConnection = g_bus_get_finish (pResult, &pError);
+
+    // The dispatcher is gone
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorAlertDispatcher *self = INDICATOR_ALERT_DISPATCHER (pData);
+    GPtrArray *lUnsent = self->pPrivate->lUnsent;
+    self->pPrivate->lUnsent = NULL;
+
+    if (pError)
+    {
+        g_warning ("Could not connect to the session bus: %s", pError->message);
+        g_error_free (pError);
+
+        for (guint i = 0; i < lUnsent->len; i++)
+        {
+            showAlertBox (((NotifyData*) g_ptr_array_index (lUnsent, i))->sText);
+        }
+    }
+    else
+    {
+        self->pPrivate->pConnection = pConnection;
+        self->pPrivate->nSignalSubscription = g_dbus_connection_signal_subscribe (self->pPrivate->pConnection, NOTIFICATIONS_NAME, NOTIFICATIONS_NAME, NULL, NOTIFICATIONS_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onNotificationSignal, self, NULL);
+
+        // sendNotification () takes them
+        g_ptr_array_set_free_func (lUnsent, NULL);
+
+        for (guint i = 0; i < lUnsent->len; i++)
+        {
+            sendNotification (self, g_ptr_array_index (lUnsent, i));
+        }
+    }
+
+    g_ptr_array_unref (lUnsent);
+}
+
+// The session bus is connected asynchronously on first use, so a slow bus does not block the main loop
+static void notify (IndicatorAlertDispatcher *self, const gchar *sText, const gchar *sPrinters)
+{
+    NotifyData *pNotifyData = g_new0 (NotifyData, 1);
+    pNotifyData->self = self;
+    pNotifyData->sText = g_strdup (sText);
+    pNotifyData->sPrinters = g_strdup (sPrinters);
+
+    if (self->pPrivate->pConnection)
+    {
+        sendNotification (self, pNotifyData);
+
+        return;
+    }
+
+    if (self->pPrivate->lUnsent == NULL)
+    {
+        self->pPrivate->lUnsent = g_ptr_array_new_with_free_func (freeNotifyData);
+        g_bus_get (G_BUS_TYPE_SESSION, self->pPrivate->pCancellable, onBusGot, self);
+    }
+
+    g_ptr_array_add (self->pPrivate->lUnsent, pNotifyData);
+}
+
+static gint comparePrinters (gconstpointer pA, gconstpointer pB)
+{
+    return g_strcmp0 (*(const gchar**) pA, *(const gchar**) pB);
+}
+
+static gboolean onBatchTimeout (gpointer pData)
+{
+    IndicatorAlertDispatcher *self = INDICATOR_ALERT_DISPATCHER (pData);
+    GString *sText = g_string_new (NULL);
+    GPtrArray *lPrinters = g_ptr_array_new ();
+
+    for (guint i = 0; i < self->pPrivate->lPending->len; i++)
+    {
+        PendingAlert *pAlert = g_ptr_array_index (self->pPrivate->lPending, i);
+        g_ptr_array_add (lPrinters, pAlert->sPrinter);
+
+        for (guint j = 0; j < pAlert->lMessages->len; j++)
+        {
+            if (sText->len > 0)
+            {
+                g_string_append_c (sText, '\n');
+            }
+
+            g_string_append (sText, g_ptr_array_index (pAlert->lMessages, j));
+        }
+    }
+
+    // The job count only makes sense for a single printer
+    if (self->pPrivate->lPending->len == 1)
+    {
+        PendingAlert *pAlert = g_ptr_array_index (self->pPrivate->lPending, 0);
+        g_string_append (sText, "\n\n");
+        g_string_append_printf (sText, ngettext ("You have %d job queued to print on this printer.", "You have %d jobs queued to print on this printer.", pAlert->nJobs), pAlert->nJobs);
+    }
+
+    g_ptr_array_sort (lPrinters, comparePrinters);
+    g_ptr_array_add (lPrinters, NULL);
+    gchar *sPrinters = g_strjoinv ("\x1f", (gchar**) lPrinters->pdata);
+    notify (self, sText->str, sPrinters);
+    g_free (sPrinters);
+    g_ptr_array_unref (lPrinters);
+    g_string_free (sText, TRUE);
+    g_ptr_array_set_size (self->pPrivate->lPending, 0);
+    self->pPrivate->nBatchTimer = 0;
+
+    // Drop the printers whose rate limits all ran out, so the table does not grow with every printer ever seen
+    gint64 nNow = g_get_monotonic_time ();
+    GHashTableIter cIter;
+    gpointer pLimit;
+    g_hash_table_iter_init (&cIter, self->pPrivate->pRateLimits);
+
+    while (g_hash_table_iter_next (&cIter, NULL, &pLimit))
+    {
+        if (nNow - ((RateLimit*) pLimit)->nNewest >= ALERT_RATE_LIMIT * G_USEC_PER_SEC)
+        {
+            g_hash_table_iter_remove (&cIter);
+        }
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorAlertDispatcher *self = INDICATOR_ALERT_DISPATCHER (pObject);
+
+    switch (nProperty)
+    {
+        case PROP_NOTIFICATIONS_SENT:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nNotificationsSent);
+
+            break;
+        }
+        case PROP_ALERTS_RATE_LIMITED:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nRateLimited);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+}
+
+static void onDispose (GObject *pObject)
+{
+    IndicatorAlertDispatcher *self = INDICATOR_ALERT_DISPATCHER (pObject);
+
+    if (self->pPrivate->pCancellable)
+    {
+        g_cancellable_cancel (self->pPrivate->pCancellable);
+        g_clear_object (&self->pPrivate->pCancellable);
+    }
+
+    if (self->pPrivate->nBatchTimer)
+    {
+        g_source_remove (self->pPrivate->nBatchTimer);
+        self->pPrivate->nBatchTimer = 0;
+    }
+
+    if (self->pPrivate->nSignalSubscription)
+    {
+        g_dbus_connection_signal_unsubscribe (self->pPrivate->pConnection, self->pPrivate->nSignalSubscription);
+        self->pPrivate->nSignalSubscription = 0;
+    }
+
+    g_clear_object (&self->pPrivate->pConnection);
+    g_clear_pointer (&self->pPrivate->lUnsent, g_ptr_array_unref);
+    g_clear_pointer (&self->pPrivate->lPending, g_ptr_array_unref);
+    g_clear_pointer (&self->pPrivate->pRateLimits, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->pNotifications, g_hash_table_destroy);
+
+    G_OBJECT_CLASS (indicator_alert_dispatcher_parent_class)->dispose (pObject);
+}
+
+static void indicator_alert_dispatcher_class_init (IndicatorAlertDispatcherClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+    object_class->get_property = onGetProperty;
+    m_lProperties[PROP_NOTIFICATIONS_SENT] = g_param_spec_uint ("notifications-sent", "Notifications sent", "Number of notifications sent to the notification server", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_ALERTS_RATE_LIMITED] = g_param_spec_uint ("alerts-rate-limited", "Alerts rate limited", "Number of alerts dropped because the same alert was shown recently", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+static void indicator_alert_dispatcher_init (IndicatorAlertDispatcher *self)
+{
+    self->pPrivate = indicator_alert_dispatcher_get_instance_private (self);
+    self->pPrivate->lPending = g_ptr_array_new_with_free_func (freePendingAlert);
+    self->pPrivate->pRateLimits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    self->pPrivate->pNotifications = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->pPrivate->pCancellable = g_cancellable_new ();
+}
+
+IndicatorAlertDispatcher *indicator_alert_dispatcher_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_ALERT_DISPATCHER, NULL);
+
+    return INDICATOR_ALERT_DISPATCHER (pObject);
+}
+
+// Queues an alert, all alerts of the next ALERT_BATCH_DELAY milliseconds are sent as one notification
+void indicator_alert_dispatcher_add (IndicatorAlertDispatcher *self, const gchar *sPrinter, guint nReason, const gchar *sMessage, guint nJobs)
+{
+    g_return_if_fail (nReason < N_INDICATOR_PRINTER_REASONS);
+
+    gint64 nNow = g_get_monotonic_time ();
+    RateLimit *pLimit = g_hash_table_lookup (self->pPrivate->pRateLimits, sPrinter);
+
+    if (pLimit == NULL)
+    {
+        pLimit = g_new0 (RateLimit, 1);
+        g_hash_table_insert (self->pPrivate->pRateLimits, g_strdup (sPrinter), pLimit);
+    }
+    else if (pLimit->lLastAlerted[nReason] != 0 && nNow - pLimit->lLastAlerted[nReason] < ALERT_RATE_LIMIT * G_USEC_PER_SEC)
+    {
+        self->pPrivate->nRateLimited++;
+
+        return;
+    }
+
+    pLimit->lLastAlerted[nReason] = nNow;
+    pLimit->nNewest = nNow;
+
+    PendingAlert *pAlert = getPendingAlert (self, sPrinter);
+    g_ptr_array_add (pAlert->lMessages, g_strdup_printf (sMessage, sPrinter));
+    pAlert->nJobs = nJobs;
+
+    if (self->pPrivate->nBatchTimer == 0)
+    {
+        self->pPrivate->nBatchTimer = g_timeout_add (ALERT_BATCH_DELAY, onBatchTimeout, self);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __INDICATOR_ALERT_DISPATCHER_H__
+#define __INDICATOR_ALERT_DISPATCHER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_ALERT_DISPATCHER(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_ALERT_DISPATCHER, IndicatorAlertDispatcher))
+#define INDICATOR_TYPE_ALERT_DISPATCHER (indicator_alert_dispatcher_get_type ())
+#define INDICATOR_IS_ALERT_DISPATCHER(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_ALERT_DISPATCHER))
+
+typedef struct _IndicatorAlertDispatcher IndicatorAlertDispatcher;
+typedef struct _IndicatorAlertDispatcherClass IndicatorAlertDispatcherClass;
+typedef struct _IndicatorAlertDispatcherPrivate IndicatorAlertDispatcherPrivate;
+
+struct _IndicatorAlertDispatcher
+{
+    GObject parent;
+    IndicatorAlertDispatcherPrivate *pPrivate;
+};
+
+struct _IndicatorAlertDispatcherClass
+{
+    GObjectClass parent_class;
+};
+
+GType indicator_alert_dispatcher_get_type (void);
+IndicatorAlertDispatcher *indicator_alert_dispatcher_new ();
+
+// sMessage contains a %s for the printer name, nReason is an IndicatorPrinterReason
+void indicator_alert_dispatcher_add (IndicatorAlertDispatcher *self, const gchar *sPrinter, guint nReason, const gchar *sMessage, guint nJobs);
+
+G_END_DECLS
+
+#endif
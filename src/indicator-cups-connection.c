@@ -0,0 +1,407 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-cups-connection.h"
+
+#define CONNECT_TIMEOUT 30000
+// A configured server must not hold a worker thread for long if it is down
+#define REMOTE_CONNECT_TIMEOUT 5000
+#define BACKOFF_MIN 500
+#define BACKOFF_MAX 30000
+#define MAX_IDLE 4
+
+// Upper bounds of the latency histogram buckets in microseconds, the last bucket takes the rest
+static const guint64 m_lLatencyBounds[] = {1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000};
+#define N_LATENCY_BUCKETS (G_N_ELEMENTS (m_lLatencyBounds) + 1)
+
+enum
+{
+    PROP_0,
+    PROP_REQUESTS,
+    PROP_RECONNECTS,
+    PROP_AVERAGE_LATENCY,
+    PROP_MAX_LATENCY,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+
+/*
+ * CUPS_HTTP_DEFAULT is a connection per thread, and the worker threads of the GTask pool
+ * come and go, so every query used to connect to cupsd (and negotiate TLS with a remote
+ * one) from scratch. This keeps a few keep-alive connections that are handed to one
+ * thread at a time. The server and the encryption are read from the environment and
+ * client.conf once, on the thread that creates the object.
+ */
+struct _IndicatorCupsConnectionPrivate
+{
+    gchar *sServer;
+    gint nPort;
+    http_encryption_t nEncryption;
+    gint nConnectTimeout;
+    GMutex cMutex;
+    // Idle http_t connections
+    GQueue *lIdle;
+    // Connections are closed after each request while this is FALSE
+    gboolean bPooling;
+    // No connection attempts before this time after a failure
+    gint64 nRetryAt;
+    guint nBackoff;
+    // Connections that were dropped after a failure and not replaced yet
+    guint nDropped;
+    guint64 nRequests;
+    guint nReconnects;
+    gint64 nTotalLatency;
+    gint64 nMaxLatency;
+    // ipp_op_t -> guint64[N_LATENCY_BUCKETS]
+    GHashTable *pLatencies;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorCupsConnection, indicator_cups_connection, G_TYPE_OBJECT)
+
+static http_t *acquire (IndicatorCupsConnection *self, GError **pError)
+{
+    IndicatorCupsConnectionPrivate *pPrivate = self->pPrivate;
+
+    g_mutex_lock (&pPrivate->cMutex);
+    http_t *pHttp = g_queue_pop_head (pPrivate->lIdle);
+    gint64 nWait = (pPrivate->nRetryAt - g_get_monotonic_time ()) / 1000;
+    g_mutex_unlock (&pPrivate->cMutex);
+
+    if (pHttp != NULL)
+    {
+        return pHttp;
+    }
+
+    if (nWait > 0)
+    {
+        g_set_error (pError, G_IO_ERROR, G_IO_ERROR_HOST_UNREACHABLE, "Not connecting to %s for another %" G_GINT64_FORMAT " ms", pPrivate->sServer, nWait);
+
+        return NULL;
+    }
+
+    pHttp = httpConnect2 (pPrivate->sServer, pPrivate->nPort, NULL, AF_UNSPEC, pPrivate->nEncryption, 1, pPrivate->nConnectTimeout, NULL);
+    g_mutex_lock (&pPrivate->cMutex);
+
+    if (pHttp == NULL)
+    {
+        pPrivate->nBackoff = pPrivate->nBackoff ? MIN (pPrivate->nBackoff * 2, BACKOFF_MAX) : BACKOFF_MIN;
+        pPrivate->nRetryAt = g_get_monotonic_time () + pPrivate->nBackoff * 1000;
+        g_set_error (pError, G_IO_ERROR, G_IO_ERROR_HOST_UNREACHABLE, "Error connecting to %s, retrying in %u ms", pPrivate->sServer, pPrivate->nBackoff);
+    }
+    else
+    {
+        pPrivate->nBackoff = 0;
+        pPrivate->nRetryAt = 0;
+
+        if (pPrivate->nDropped > 0)
+        {
+            pPrivate->nDropped--;
+            pPrivate->nReconnects++;
+        }
+    }
+
+    g_mutex_unlock (&pPrivate->cMutex);
+
+    return pHttp;
+}
+
+// A connection that failed on the transport level is closed instead of going back to the pool
+static void release (IndicatorCupsConnection *self, http_t *pHttp, gint64 nStart, ipp_op_t nOperation)
+{
+    IndicatorCupsConnectionPrivate *pPrivate = self->pPrivate;
+    gint64 nLatency = g_get_monotonic_time () - nStart;
+    gboolean bFailed = cupsLastError () >= IPP_INTERNAL_ERROR && httpError (pHttp) != 0;
+    guint nBucket = 0;
+
+    while (nBucket < G_N_ELEMENTS (m_lLatencyBounds) && (guint64) nLatency >= m_lLatencyBounds[nBucket])
+    {
+        nBucket++;
+    }
+
+    g_mutex_lock (&pPrivate->cMutex);
+    pPrivate->nRequests++;
+    pPrivate->nTotalLatency += nLatency;
+    pPrivate->nMaxLatency = MAX (pPrivate->nMaxLatency, nLatency);
+    guint64 *lBuckets = g_hash_table_lookup (pPrivate->pLatencies, GINT_TO_POINTER (nOperation));
+
+    if (lBuckets == NULL)
+    {
+        lBuckets = g_new0 (guint64, N_LATENCY_BUCKETS);
+        g_hash_table_insert (pPrivate->pLatencies, GINT_TO_POINTER (nOperation), lBuckets);
+    }
+
+    lBuckets[nBucket]++;
+
+    if (bFailed)
+    {
+        pPrivate->nDropped++;
+    }
+
+    if (bFailed || !pPrivate->bPooling || g_queue_get_length (pPrivate->lIdle) >= MAX_IDLE)
+    {
+        g_mutex_unlock (&pPrivate->cMutex);
+        httpClose (pHttp);
+
+        return;
+    }
+
+    g_queue_push_head (pPrivate->lIdle, pHttp);
+    g_mutex_unlock (&pPrivate->cMutex);
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorCupsConnection *self = INDICATOR_CUPS_CONNECTION (pObject);
+
+    g_mutex_lock (&self->pPrivate->cMutex);
+
+    switch (nProperty)
+    {
+        case PROP_REQUESTS:
+        {
+            g_value_set_uint64 (pValue, self->pPrivate->nRequests);
+
+            break;
+        }
+        case PROP_RECONNECTS:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nReconnects);
+
+            break;
+        }
+        case PROP_AVERAGE_LATENCY:
+        {
+            g_value_set_int64 (pValue, self->pPrivate->nRequests ? self->pPrivate->nTotalLatency / (gint64) self->pPrivate->nRequests : 0);
+
+            break;
+        }
+        case PROP_MAX_LATENCY:
+        {
+            g_value_set_int64 (pValue, self->pPrivate->nMaxLatency);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+}
+
+static void onFinalize (GObject *pObject)
+{
+    IndicatorCupsConnection *self = INDICATOR_CUPS_CONNECTION (pObject);
+
+    g_queue_free_full (self->pPrivate->lIdle, (GDestroyNotify) httpClose);
+    g_mutex_clear (&self->pPrivate->cMutex);
+    g_hash_table_destroy (self->pPrivate->pLatencies);
+    g_free (self->pPrivate->sServer);
+
+    G_OBJECT_CLASS (indicator_cups_connection_parent_class)->finalize (pObject);
+}
+
+static void indicator_cups_connection_class_init (IndicatorCupsConnectionClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->finalize = onFinalize;
+    object_class->get_property = onGetProperty;
+    m_lProperties[PROP_REQUESTS] = g_param_spec_uint64 ("requests", "Requests", "Number of requests sent to cupsd", 0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_RECONNECTS] = g_param_spec_uint ("reconnects", "Reconnects", "Number of connections opened to replace a failed one", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_AVERAGE_LATENCY] = g_param_spec_int64 ("average-latency", "Average latency", "Average request latency in microseconds", 0, G_MAXINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_MAX_LATENCY] = g_param_spec_int64 ("max-latency", "Maximum latency", "Maximum request latency in microseconds", 0, G_MAXINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+static void indicator_cups_connection_init (IndicatorCupsConnection *self)
+{
+    self->pPrivate = indicator_cups_connection_get_instance_private (self);
+    self->pPrivate->sServer = g_strdup (cupsServer ());
+    self->pPrivate->nPort = ippPort ();
+    self->pPrivate->nEncryption = cupsEncryption ();
+    self->pPrivate->nConnectTimeout = CONNECT_TIMEOUT;
+    self->pPrivate->lIdle = g_queue_new ();
+    self->pPrivate->bPooling = TRUE;
+    self->pPrivate->pLatencies = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    g_mutex_init (&self->pPrivate->cMutex);
+}
+
+IndicatorCupsConnection *indicator_cups_connection_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_CUPS_CONNECTION, NULL);
+
+    return INDICATOR_CUPS_CONNECTION (pObject);
+}
+
+// sServer is "host", "host:port", "[address]:port" or the path of a domain socket, like ServerName in client.conf
+IndicatorCupsConnection *indicator_cups_connection_new_for_server (const gchar *sServer)
+{
+    IndicatorCupsConnection *self = indicator_cups_connection_new ();
+    const gchar *sBracket = strrchr (sServer, ']');
+    const gchar *sColon = strrchr (sBracket != NULL ? sBracket : sServer, ':');
+
+    g_free (self->pPrivate->sServer);
+
+    if (sServer[0] != '/' && sColon != NULL && (sBracket != NULL || strchr (sServer, ':') == sColon))
+    {
+        self->pPrivate->sServer = g_strndup (sServer, sColon - sServer);
+        self->pPrivate->nPort = atoi (sColon + 1);
+    }
+    else
+    {
+        self->pPrivate->sServer = g_strdup (sServer);
+    }
+
+    self->pPrivate->nConnectTimeout = REMOTE_CONNECT_TIMEOUT;
+
+    return self;
+}
+
+const gchar *indicator_cups_connection_get_server (IndicatorCupsConnection *self)
+{
+    return self->pPrivate->sServer;
+}
+
+// Takes ownership of pRequest like cupsDoRequest (), a response with an error status is returned as a GError
+ipp_t *indicator_cups_connection_do_request (IndicatorCupsConnection *self, ipp_t *pRequest, const gchar *sResource, GError **pError)
+{
+    http_t *pHttp = acquire (self, pError);
+
+    if (pHttp == NULL)
+    {
+        ippDelete (pRequest);
+
+        return NULL;
+    }
+
+    gint64 nStart = g_get_monotonic_time ();
+    ipp_op_t nOperation = ippGetOperation (pRequest);
+    ipp_t *pResponse = cupsDoRequest (pHttp, pRequest, sResource);
+
+    if (!pResponse || cupsLastError () > IPP_OK_CONFLICT)
+    {
+        g_set_error (pError, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", cupsLastErrorString ());
+        g_clear_pointer (&pResponse, ippDelete);
+    }
+
+    release (self, pHttp, nStart, nOperation);
+
+    return pResponse;
+}
+
+gint indicator_cups_connection_get_dests (IndicatorCupsConnection *self, cups_dest_t **lDests, GError **pError)
+{
+    http_t *pHttp = acquire (self, pError);
+
+    *lDests = NULL;
+
+    if (pHttp == NULL)
+    {
+        return 0;
+    }
+
+    gint64 nStart = g_get_monotonic_time ();
+    gint nDests = cupsGetDests2 (pHttp, lDests);
+
+    // The lookup of the default printer fails without one, only server errors count
+    if (nDests == 0 && cupsLastError () >= IPP_INTERNAL_ERROR)
+    {
+        g_set_error (pError, G_IO_ERROR, G_IO_ERROR_FAILED, "Error getting printers: %s", cupsLastErrorString ());
+    }
+
+    release (self, pHttp, nStart, CUPS_GET_PRINTERS);
+
+    return nDests;
+}
+
+gint indicator_cups_connection_get_jobs (IndicatorCupsConnection *self, cups_job_t **lJobs, const gchar *sPrinter, gboolean bMine, gint nWhichJobs, GError **pError)
+{
+    http_t *pHttp = acquire (self, pError);
+
+    *lJobs = NULL;
+
+    if (pHttp == NULL)
+    {
+        return -1;
+    }
+
+    gint64 nStart = g_get_monotonic_time ();
+    gint nJobs = cupsGetJobs2 (pHttp, lJobs, sPrinter, bMine, nWhichJobs);
+
+    if (nJobs < 0)
+    {
+        g_set_error (pError, G_IO_ERROR, G_IO_ERROR_FAILED, "Error getting jobs of %s: %s", sPrinter, cupsLastErrorString ());
+    }
+
+    release (self, pHttp, nStart, IPP_GET_JOBS);
+
+    return nJobs;
+}
+
+// The upper bounds of the buckets of indicator_cups_connection_get_latencies () in microseconds, as a floating "at"
+GVariant *indicator_cups_connection_get_latency_bounds ()
+{
+    return g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, m_lLatencyBounds, G_N_ELEMENTS (m_lLatencyBounds), sizeof (guint64));
+}
+
+// The request latency histogram of each IPP operation, as a floating "a{sat}"
+GVariant *indicator_cups_connection_get_latencies (IndicatorCupsConnection *self)
+{
+    GVariantBuilder cBuilder;
+    GHashTableIter cIter;
+    gpointer pOperation;
+    gpointer pBuckets;
+
+    g_variant_builder_init (&cBuilder, G_VARIANT_TYPE ("a{sat}"));
+    g_mutex_lock (&self->pPrivate->cMutex);
+    g_hash_table_iter_init (&cIter, self->pPrivate->pLatencies);
+
+    while (g_hash_table_iter_next (&cIter, &pOperation, &pBuckets))
+    {
+        GVariant *pHistogram = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, pBuckets, N_LATENCY_BUCKETS, sizeof (guint64));
+        g_variant_builder_add (&cBuilder, "{s@at}", ippOpString (GPOINTER_TO_INT (pOperation)), pHistogram);
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+
+    return g_variant_builder_end (&cBuilder);
+}
+
+// Without pooling, the idle connections are closed and every request connects anew, for a service that is mostly asleep
+void indicator_cups_connection_set_pooling (IndicatorCupsConnection *self, gboolean bPooling)
+{
+    GQueue *lIdle = NULL;
+
+    g_mutex_lock (&self->pPrivate->cMutex);
+    self->pPrivate->bPooling = bPooling;
+
+    if (!bPooling)
+    {
+        lIdle = self->pPrivate->lIdle;
+        self->pPrivate->lIdle = g_queue_new ();
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+
+    if (lIdle != NULL)
+    {
+        g_queue_free_full (lIdle, (GDestroyNotify) httpClose);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_CUPS_CONNECTION_H__
+#define __INDICATOR_CUPS_CONNECTION_H__
+
+#include <gio/gio.h>
+#include <cups/cups.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_CUPS_CONNECTION(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_CUPS_CONNECTION, IndicatorCupsConnection))
+#define INDICATOR_TYPE_CUPS_CONNECTION (indicator_cups_connection_get_type ())
+#define INDICATOR_IS_CUPS_CONNECTION(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_CUPS_CONNECTION))
+
+typedef struct _IndicatorCupsConnection IndicatorCupsConnection;
+typedef struct _IndicatorCupsConnectionClass IndicatorCupsConnectionClass;
+typedef struct _IndicatorCupsConnectionPrivate IndicatorCupsConnectionPrivate;
+
+struct _IndicatorCupsConnection
+{
+    GObject parent;
+    IndicatorCupsConnectionPrivate *pPrivate;
+};
+
+struct _IndicatorCupsConnectionClass
+{
+    GObjectClass parent_class;
+};
+
+GType indicator_cups_connection_get_type (void);
+IndicatorCupsConnection *indicator_cups_connection_new ();
+IndicatorCupsConnection *indicator_cups_connection_new_for_server (const gchar *sServer);
+const gchar *indicator_cups_connection_get_server (IndicatorCupsConnection *self);
+
+// All of these can be called from any thread, each call borrows a connection of its own from the pool
+ipp_t *indicator_cups_connection_do_request (IndicatorCupsConnection *self, ipp_t *pRequest, const gchar *sResource, GError **pError);
+gint indicator_cups_connection_get_dests (IndicatorCupsConnection *self, cups_dest_t **lDests, GError **pError);
+gint indicator_cups_connection_get_jobs (IndicatorCupsConnection *self, cups_job_t **lJobs, const gchar *sPrinter, gboolean bMine, gint nWhichJobs, GError **pError);
+GVariant *indicator_cups_connection_get_latencies (IndicatorCupsConnection *self);
+GVariant *indicator_cups_connection_get_latency_bounds ();
+void indicator_cups_connection_set_pooling (IndicatorCupsConnection *self, gboolean bPooling);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "indicator-dest-cache.h"
+
+/*
+ * cupsGetDests () reads the lpoptions files and enumerates the queues on every call,
+ * although the list of destinations rarely changes. This keeps the result of the last
+ * call until a queue is added, deleted or modified, or one of the lpoptions files
+ * changes. Printer state changes are applied to the cached entries, so a query that
+ * only needs fresh jobs can use them as they are.
+ */
+struct _IndicatorDestCachePrivate
+{
+    GMutex cMutex;
+    // IndicatorDestCacheEntry, NULL if invalid
+    GPtrArray *lEntries;
+    // Incremented by every invalidation, a result fetched before one is not stored
+    guint nGeneration;
+    GFileMonitor *pUserMonitor;
+    GFileMonitor *pSystemMonitor;
+    guint nHits;
+    guint nMisses;
+    guint nInvalidations;
+};
+
+enum
+{
+    PROP_0,
+    PROP_HITS,
+    PROP_MISSES,
+    PROP_INVALIDATIONS,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorDestCache, indicator_dest_cache, G_TYPE_OBJECT)
+
+IndicatorDestCacheEntry *indicator_dest_cache_entry_new (const gchar *sName, gint nState, const gchar *sReasons)
+{
+    IndicatorDestCacheEntry *pEntry = g_new0 (IndicatorDestCacheEntry, 1);
+    pEntry->sName = g_strdup (sName);
+    pEntry->nState = nState;
+    pEntry->sReasons = g_strdup (sReasons);
+
+    return pEntry;
+}
+
+void indicator_dest_cache_entry_free (gpointer pData)
+{
+    IndicatorDestCacheEntry *pEntry = pData;
+
+    g_free (pEntry->sName);
+    g_free (pEntry->sReasons);
+    g_free (pEntry);
+}
+
+static void onLpoptionsChanged (GFileMonitor *pMonitor, GFile *pFile, GFile *pOther, GFileMonitorEvent nEvent, gpointer pData)
+{
+    if (nEvent == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT || nEvent == G_FILE_MONITOR_EVENT_CREATED || nEvent == G_FILE_MONITOR_EVENT_DELETED)
+    {
+        indicator_dest_cache_invalidate (INDICATOR_DEST_CACHE (pData));
+    }
+}
+
+static GFileMonitor *monitor (IndicatorDestCache *self, const gchar *sPath)
+{
+    GError *pError = NULL;
+    GFile *pFile = g_file_new_for_path (sPath);
+    GFileMonitor *pMonitor = g_file_monitor_file (pFile, G_FILE_MONITOR_NONE, NULL, &pError);
+    g_object_unref (pFile);
+
+    if (pError)
+    {
+        // Without a monitor, changes to the file are only seen after the next invalidation
+        g_warning ("Cannot monitor %s: %s", sPath, pError->message);
+        g_error_free (pError);
+
+        return NULL;
+    }
+
+    g_signal_connect (pMonitor, "changed", G_CALLBACK (onLpoptionsChanged), self);
+
+    return pMonitor;
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorDestCache *self = INDICATOR_DEST_CACHE (pObject);
+
+    g_mutex_lock (&self->pPrivate->cMutex);
+
+    switch (nProperty)
+    {
+        case PROP_HITS:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nHits);
+
+            break;
+        }
+        case PROP_MISSES:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nMisses);
+
+            break;
+        }
+        case PROP_INVALIDATIONS:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nInvalidations);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+}
+
+static void onDispose (GObject *pObject)
+{
+    IndicatorDestCache *self = INDICATOR_DEST_CACHE (pObject);
+
+    g_clear_object (&self->pPrivate->pUserMonitor);
+    g_clear_object (&self->pPrivate->pSystemMonitor);
+
+    G_OBJECT_CLASS (indicator_dest_cache_parent_class)->dispose (pObject);
+}
+
+static void onFinalize (GObject *pObject)
+{
+    IndicatorDestCache *self = INDICATOR_DEST_CACHE (pObject);
+
+    g_clear_pointer (&self->pPrivate->lEntries, g_ptr_array_unref);
+    g_mutex_clear (&self->pPrivate->cMutex);
+
+    G_OBJECT_CLASS (indicator_dest_cache_parent_class)->finalize (pObject);
+}
+
+static void indicator_dest_cache_class_init (IndicatorDestCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+    object_class->finalize = onFinalize;
+    object_class->get_property = onGetProperty;
+    m_lProperties[PROP_HITS] = g_param_spec_uint ("hits", "Hits", "Number of lookups answered from the cache", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_MISSES] = g_param_spec_uint ("misses", "Misses", "Number of lookups that had to ask cupsd", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_INVALIDATIONS] = g_param_spec_uint ("invalidations", "Invalidations", "Number of times the cache was dropped", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+static void indicator_dest_cache_init (IndicatorDestCache *self)
+{
+    self->pPrivate = indicator_dest_cache_get_instance_private (self);
+    g_mutex_init (&self->pPrivate->cMutex);
+
+    gchar *sPath = g_build_filename (g_get_home_dir (), ".cups", "lpoptions", NULL);
+    self->pPrivate->pUserMonitor = monitor (self, sPath);
+    g_free (sPath);
+    self->pPrivate->pSystemMonitor = monitor (self, "/etc/cups/lpoptions");
+}
+
+IndicatorDestCache *indicator_dest_cache_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_DEST_CACHE, NULL);
+
+    return INDICATOR_DEST_CACHE (pObject);
+}
+
+// Returns a copy of the cached entries, or NULL and the generation to pass to indicator_dest_cache_store ()
+GPtrArray *indicator_dest_cache_lookup (IndicatorDestCache *self, guint *nGeneration)
+{
+    GPtrArray *lCopy = NULL;
+
+    g_mutex_lock (&self->pPrivate->cMutex);
+    *nGeneration = self->pPrivate->nGeneration;
+
+    if (self->pPrivate->lEntries != NULL)
+    {
+        lCopy = g_ptr_array_new_full (self->pPrivate->lEntries->len, indicator_dest_cache_entry_free);
+
+        for (guint i = 0; i < self->pPrivate->lEntries->len; i++)
+        {
+            IndicatorDestCacheEntry *pEntry = g_ptr_array_index (self->pPrivate->lEntries, i);
+            g_ptr_array_add (lCopy, indicator_dest_cache_entry_new (pEntry->sName, pEntry->nState, pEntry->sReasons));
+        }
+
+        self->pPrivate->nHits++;
+    }
+    else
+    {
+        self->pPrivate->nMisses++;
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+
+    return lCopy;
+}
+
+// Takes a reference on lEntries, which belongs to the cache afterwards
+void indicator_dest_cache_store (IndicatorDestCache *self, GPtrArray *lEntries, guint nGeneration)
+{
+    g_mutex_lock (&self->pPrivate->cMutex);
+
+    if (nGeneration == self->pPrivate->nGeneration)
+    {
+        g_clear_pointer (&self->pPrivate->lEntries, g_ptr_array_unref);
+        self->pPrivate->lEntries = g_ptr_array_ref (lEntries);
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+}
+
+void indicator_dest_cache_invalidate (IndicatorDestCache *self)
+{
+    g_mutex_lock (&self->pPrivate->cMutex);
+    self->pPrivate->nGeneration++;
+
+    if (self->pPrivate->lEntries != NULL)
+    {
+        g_clear_pointer (&self->pPrivate->lEntries, g_ptr_array_unref);
+        self->pPrivate->nInvalidations++;
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+}
+
+// Keeps a cached queue up to date with its state signals, an unknown one invalidates the cache
+void indicator_dest_cache_update_printer (IndicatorDestCache *self, const gchar *sName, gint nState, const gchar *sReasons)
+{
+    gboolean bFound = FALSE;
+
+    g_mutex_lock (&self->pPrivate->cMutex);
+
+    if (self->pPrivate->lEntries == NULL)
+    {
+        g_mutex_unlock (&self->pPrivate->cMutex);
+
+        return;
+    }
+
+    for (guint i = 0; i < self->pPrivate->lEntries->len && !bFound; i++)
+    {
+        IndicatorDestCacheEntry *pEntry = g_ptr_array_index (self->pPrivate->lEntries, i);
+
+        if (g_str_equal (pEntry->sName, sName))
+        {
+            pEntry->nState = nState;
+
+            if (g_strcmp0 (pEntry->sReasons, sReasons) != 0)
+            {
+                g_free (pEntry->sReasons);
+                pEntry->sReasons = g_strdup (sReasons);
+            }
+
+            bFound = TRUE;
+        }
+    }
+
+    g_mutex_unlock (&self->pPrivate->cMutex);
+
+    if (!bFound)
+    {
+        indicator_dest_cache_invalidate (self);
+    }
+}
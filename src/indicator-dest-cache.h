@@ -0,0 +1,66 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __INDICATOR_DEST_CACHE_H__
+#define __INDICATOR_DEST_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_DEST_CACHE(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_DEST_CACHE, IndicatorDestCache))
+#define INDICATOR_TYPE_DEST_CACHE (indicator_dest_cache_get_type ())
+#define INDICATOR_IS_DEST_CACHE(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_DEST_CACHE))
+
+typedef struct _IndicatorDestCache IndicatorDestCache;
+typedef struct _IndicatorDestCacheClass IndicatorDestCacheClass;
+typedef struct _IndicatorDestCachePrivate IndicatorDestCachePrivate;
+typedef struct _IndicatorDestCacheEntry IndicatorDestCacheEntry;
+
+struct _IndicatorDestCache
+{
+    GObject parent;
+    IndicatorDestCachePrivate *pPrivate;
+};
+
+struct _IndicatorDestCacheClass
+{
+    GObjectClass parent_class;
+};
+
+struct _IndicatorDestCacheEntry
+{
+    gchar *sName;
+    gint nState;
+    gchar *sReasons;
+};
+
+GType indicator_dest_cache_get_type (void);
+IndicatorDestCache *indicator_dest_cache_new ();
+
+// These two can be called from any thread
+GPtrArray *indicator_dest_cache_lookup (IndicatorDestCache *self, guint *nGeneration);
+void indicator_dest_cache_store (IndicatorDestCache *self, GPtrArray *lEntries, guint nGeneration);
+
+void indicator_dest_cache_invalidate (IndicatorDestCache *self);
+void indicator_dest_cache_update_printer (IndicatorDestCache *self, const gchar *sName, gint nState, const gchar *sReasons);
+IndicatorDestCacheEntry *indicator_dest_cache_entry_new (const gchar *sName, gint nState, const gchar *sReasons);
+void indicator_dest_cache_entry_free (gpointer pEntry);
+
+G_END_DECLS
+
+#endif
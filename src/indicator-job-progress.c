@@ -0,0 +1,297 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-job-progress.h"
+#include "printer-query.h"
+
+// Minimum time between two published updates of the same job, in ms
+#define PROGRESS_INTERVAL 1000
+
+/*
+ * cupsd sends a JobProgress signal for every impression, which would become a menu update
+ * each time. This keeps the latest impressions of every job and publishes them at most
+ * once per PROGRESS_INTERVAL: the first change goes out right away, later ones within
+ * the interval are folded into a single trailing update. The total is looked up once
+ * per job, when it starts printing.
+ */
+struct _IndicatorJobProgressPrivate
+{
+    IndicatorCupsConnection *pConnection;
+    GCancellable *pCancellable;
+    // Job id -> Job
+    GHashTable *pJobs;
+    guint nUpdates;
+    guint nPublished;
+};
+
+typedef struct
+{
+    IndicatorJobProgress *self;
+    guint nId;
+    gchar *sPrinter;
+    gchar *sName;
+    guint nCompleted;
+    guint nTotal;
+    gboolean bTotalRequested;
+    gboolean bPublished;
+    IndicatorJobProgressInfo cPublished;
+    gint64 nLastPublished;
+    guint nTimer;
+} Job;
+
+enum
+{
+    PROP_0,
+    PROP_UPDATES,
+    PROP_PUBLISHED,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+static guint m_nSignal;
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorJobProgress, indicator_job_progress, G_TYPE_OBJECT)
+
+static void freeJob (gpointer pData)
+{
+    Job *pJob = pData;
+
+    if (pJob->nTimer)
+    {
+        g_source_remove (pJob->nTimer);
+    }
+
+    g_free (pJob->sPrinter);
+    g_free (pJob->sName);
+    g_free (pJob->cPublished.sName);
+    g_free (pJob);
+}
+
+static void publishNow (Job *pJob)
+{
+    IndicatorJobProgress *self = pJob->self;
+
+    if (g_strcmp0 (pJob->cPublished.sName, pJob->sName) != 0)
+    {
+        g_free (pJob->cPublished.sName);
+        pJob->cPublished.sName = g_strdup (pJob->sName);
+    }
+
+    pJob->cPublished.nCompleted = pJob->nCompleted;
+    pJob->cPublished.nTotal = pJob->nTotal;
+    pJob->bPublished = TRUE;
+    pJob->nLastPublished = g_get_monotonic_time ();
+    self->pPrivate->nPublished++;
+
+    g_signal_emit (self, m_nSignal, 0, pJob->sPrinter);
+}
+
+static gboolean onPublishTimeout (gpointer pData)
+{
+    Job *pJob = pData;
+
+    pJob->nTimer = 0;
+    publishNow (pJob);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void publish (Job *pJob)
+{
+    if (pJob->bPublished && pJob->cPublished.nCompleted == pJob->nCompleted && pJob->cPublished.nTotal == pJob->nTotal && g_strcmp0 (pJob->cPublished.sName, pJob->sName) == 0)
+    {
+        return;
+    }
+
+    // Already due, the timer publishes the latest values
+    if (pJob->nTimer)
+    {
+        return;
+    }
+
+    gint64 nElapsed = (g_get_monotonic_time () - pJob->nLastPublished) / 1000;
+
+    if (!pJob->bPublished || nElapsed >= PROGRESS_INTERVAL)
+    {
+        publishNow (pJob);
+    }
+    else
+    {
+        pJob->nTimer = g_timeout_add (PROGRESS_INTERVAL - nElapsed, onPublishTimeout, pJob);
+    }
+}
+
+static void onTotalFound (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    guint nJobId = 0;
+    guint nTotal = printer_query_job_impressions_finish (pResult, &nJobId, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    if (pError)
+    {
+        g_warning ("%s", pError->message);
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorJobProgress *self = INDICATOR_JOB_PROGRESS (pData);
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    // Finished in the meantime
+    if (pJob != NULL && nTotal > 0)
+    {
+        pJob->nTotal = nTotal;
+        publish (pJob);
+    }
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorJobProgress *self = INDICATOR_JOB_PROGRESS (pObject);
+
+    switch (nProperty)
+    {
+        case PROP_UPDATES:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nUpdates);
+
+            break;
+        }
+        case PROP_PUBLISHED:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nPublished);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+}
+
+static void onDispose (GObject *pObject)
+{
+    IndicatorJobProgress *self = INDICATOR_JOB_PROGRESS (pObject);
+
+    if (self->pPrivate->pCancellable != NULL)
+    {
+        g_cancellable_cancel (self->pPrivate->pCancellable);
+        g_clear_object (&self->pPrivate->pCancellable);
+    }
+
+    g_clear_pointer (&self->pPrivate->pJobs, g_hash_table_destroy);
+    g_clear_object (&self->pPrivate->pConnection);
+
+    G_OBJECT_CLASS (indicator_job_progress_parent_class)->dispose (pObject);
+}
+
+static void indicator_job_progress_class_init (IndicatorJobProgressClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+    object_class->get_property = onGetProperty;
+    m_nSignal = g_signal_new ("changed", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1, G_TYPE_STRING);
+    m_lProperties[PROP_UPDATES] = g_param_spec_uint ("updates", "Updates", "Number of progress updates received", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_PUBLISHED] = g_param_spec_uint ("published", "Published", "Number of progress updates passed on to the menu", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+static void indicator_job_progress_init (IndicatorJobProgress *self)
+{
+    self->pPrivate = indicator_job_progress_get_instance_private (self);
+    self->pPrivate->pCancellable = g_cancellable_new ();
+    self->pPrivate->pJobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, freeJob);
+}
+
+// Without a connection, the totals are never looked up
+IndicatorJobProgress *indicator_job_progress_new (IndicatorCupsConnection *pConnection)
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_JOB_PROGRESS, NULL);
+    IndicatorJobProgress *self = INDICATOR_JOB_PROGRESS (pObject);
+
+    if (pConnection != NULL)
+    {
+        self->pPrivate->pConnection = g_object_ref (pConnection);
+    }
+
+    return self;
+}
+
+void indicator_job_progress_update (IndicatorJobProgress *self, const gchar *sPrinter, guint nJobId, const gchar *sName, guint nCompleted)
+{
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+    self->pPrivate->nUpdates++;
+
+    if (pJob == NULL)
+    {
+        pJob = g_new0 (Job, 1);
+        pJob->self = self;
+        pJob->nId = nJobId;
+        g_hash_table_insert (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId), pJob);
+    }
+
+    // The job was moved to another queue, the old one is rebuilt with the job count
+    if (g_strcmp0 (pJob->sPrinter, sPrinter) != 0)
+    {
+        g_free (pJob->sPrinter);
+        pJob->sPrinter = g_strdup (sPrinter);
+    }
+
+    if (sName != NULL && *sName != '\0' && g_strcmp0 (pJob->sName, sName) != 0)
+    {
+        g_free (pJob->sName);
+        pJob->sName = g_strdup (sName);
+    }
+
+    pJob->nCompleted = nCompleted;
+
+    if (nCompleted > 0 && !pJob->bTotalRequested && self->pPrivate->pConnection != NULL)
+    {
+        pJob->bTotalRequested = TRUE;
+        printer_query_job_impressions_async (self->pPrivate->pConnection, nJobId, self->pPrivate->pCancellable, onTotalFound, self);
+    }
+
+    publish (pJob);
+}
+
+void indicator_job_progress_remove (IndicatorJobProgress *self, guint nJobId)
+{
+    g_hash_table_remove (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+}
+
+void indicator_job_progress_clear (IndicatorJobProgress *self)
+{
+    g_hash_table_remove_all (self->pPrivate->pJobs);
+}
+
+// Returns the last published progress of a job, or NULL if nothing was published yet
+const IndicatorJobProgressInfo *indicator_job_progress_lookup (IndicatorJobProgress *self, guint nJobId)
+{
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    return pJob != NULL && pJob->bPublished ? &pJob->cPublished : NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_JOB_PROGRESS_H__
+#define __INDICATOR_JOB_PROGRESS_H__
+
+#include <gio/gio.h>
+#include "indicator-cups-connection.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_JOB_PROGRESS(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_JOB_PROGRESS, IndicatorJobProgress))
+#define INDICATOR_TYPE_JOB_PROGRESS (indicator_job_progress_get_type ())
+#define INDICATOR_IS_JOB_PROGRESS(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_JOB_PROGRESS))
+
+typedef struct _IndicatorJobProgress IndicatorJobProgress;
+typedef struct _IndicatorJobProgressClass IndicatorJobProgressClass;
+typedef struct _IndicatorJobProgressPrivate IndicatorJobProgressPrivate;
+typedef struct _IndicatorJobProgressInfo IndicatorJobProgressInfo;
+
+struct _IndicatorJobProgress
+{
+    GObject parent;
+    IndicatorJobProgressPrivate *pPrivate;
+};
+
+struct _IndicatorJobProgressClass
+{
+    GObjectClass parent_class;
+};
+
+// The last published progress of a job
+struct _IndicatorJobProgressInfo
+{
+    gchar *sName;
+    guint nCompleted;
+    // 0 while unknown
+    guint nTotal;
+};
+
+GType indicator_job_progress_get_type (void);
+IndicatorJobProgress *indicator_job_progress_new (IndicatorCupsConnection *pConnection);
+void indicator_job_progress_update (IndicatorJobProgress *self, const gchar *sPrinter, guint nJobId, const gchar *sName, guint nCompleted);
+void indicator_job_progress_remove (IndicatorJobProgress *self, guint nJobId);
+void indicator_job_progress_clear (IndicatorJobProgress *self);
+const IndicatorJobProgressInfo *indicator_job_progress_lookup (IndicatorJobProgress *self, guint nJobId);
+
+G_END_DECLS
+
+#endif
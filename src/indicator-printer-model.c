@@ -0,0 +1,506 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cups/cups.h>
+#include "indicator-printer-model.h"
+#include "printer-query.h"
+
+enum
+{
+    OWNER_UNKNOWN,
+    OWNER_MINE,
+    OWNER_OTHER
+};
+
+typedef struct
+{
+    guint nId;
+    gchar *sPrinter;
+    guint nOwner;
+} Job;
+
+struct _IndicatorPrinterModelPrivate
+{
+    // Printer name -> IndicatorPrinterModelPrinter
+    GHashTable *pPrinters;
+    // Job id -> Job, for the active jobs of all users
+    GHashTable *pJobs;
+    // The printers with jobs of the current user, a set of IndicatorPrinterModelPrinter
+    GHashTable *pActive;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorPrinterModel, indicator_printer_model, G_TYPE_OBJECT)
+
+static void freePrinter (gpointer pData)
+{
+    IndicatorPrinterModelPrinter *pPrinter = pData;
+
+    g_free (pPrinter->sName);
+    g_free (pPrinter->sServer);
+    g_free (pPrinter->sReasons);
+    g_hash_table_destroy (pPrinter->pJobs);
+    g_free (pPrinter);
+}
+
+static void freeJob (gpointer pData)
+{
+    Job *pJob = pData;
+
+    g_free (pJob->sPrinter);
+    g_free (pJob);
+}
+
+static IndicatorPrinterModelPrinter *getPrinter (IndicatorPrinterModel *self, const gchar *sName, gboolean *bCreated)
+{
+    IndicatorPrinterModelPrinter *pPrinter = g_hash_table_lookup (self->pPrivate->pPrinters, sName);
+
+    if (bCreated != NULL)
+    {
+        *bCreated = (pPrinter == NULL);
+    }
+
+    if (pPrinter == NULL)
+    {
+        pPrinter = g_new0 (IndicatorPrinterModelPrinter, 1);
+        pPrinter->sName = g_strdup (sName);
+        pPrinter->pJobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+        g_hash_table_insert (self->pPrivate->pPrinters, pPrinter->sName, pPrinter);
+    }
+
+    return pPrinter;
+}
+
+static void addOwnJob (IndicatorPrinterModel *self, IndicatorPrinterModelPrinter *pPrinter, guint nJobId)
+{
+    g_hash_table_add (pPrinter->pJobs, GUINT_TO_POINTER (nJobId));
+    g_hash_table_add (self->pPrivate->pActive, pPrinter);
+}
+
+static gboolean removeOwnJob (IndicatorPrinterModel *self, IndicatorPrinterModelPrinter *pPrinter, guint nJobId)
+{
+    gboolean bRemoved = g_hash_table_remove (pPrinter->pJobs, GUINT_TO_POINTER (nJobId));
+
+    if (g_hash_table_size (pPrinter->pJobs) == 0)
+    {
+        g_hash_table_remove (self->pPrivate->pActive, pPrinter);
+    }
+
+    return bRemoved;
+}
+
+static void addJob (IndicatorPrinterModel *self, const gchar *sPrinter, guint nJobId, guint nOwner)
+{
+    Job *pJob = g_new0 (Job, 1);
+    pJob->nId = nJobId;
+    pJob->sPrinter = g_strdup (sPrinter);
+    pJob->nOwner = nOwner;
+    g_hash_table_insert (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId), pJob);
+
+    if (nOwner == OWNER_MINE)
+    {
+        addOwnJob (self, getPrinter (self, sPrinter, NULL), nJobId);
+    }
+}
+
+// Drops a job from its printer's count, returns TRUE if the count changed
+static gboolean detachJob (IndicatorPrinterModel *self, Job *pJob)
+{
+    IndicatorPrinterModelPrinter *pPrinter = g_hash_table_lookup (self->pPrivate->pPrinters, pJob->sPrinter);
+
+    return pPrinter != NULL && removeOwnJob (self, pPrinter, pJob->nId);
+}
+
+static void onDispose (GObject *pObject)
+{
+    IndicatorPrinterModel *self = INDICATOR_PRINTER_MODEL (pObject);
+
+    g_clear_pointer (&self->pPrivate->pJobs, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->pActive, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->pPrinters, g_hash_table_destroy);
+
+    G_OBJECT_CLASS (indicator_printer_model_parent_class)->dispose (pObject);
+}
+
+static void indicator_printer_model_class_init (IndicatorPrinterModelClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+}
+
+static void indicator_printer_model_init (IndicatorPrinterModel *self)
+{
+    self->pPrivate = indicator_printer_model_get_instance_private (self);
+    self->pPrivate->pPrinters = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, freePrinter);
+    self->pPrivate->pJobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, freeJob);
+    self->pPrivate->pActive = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+IndicatorPrinterModel *indicator_printer_model_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_PRINTER_MODEL, NULL);
+
+    return INDICATOR_PRINTER_MODEL (pObject);
+}
+
+static gboolean isLocal (gpointer pKey, gpointer pValue, gpointer pData)
+{
+    return ((IndicatorPrinterModelPrinter*) pValue)->sServer == NULL;
+}
+
+static gboolean isOnServer (gpointer pKey, gpointer pValue, gpointer pData)
+{
+    return g_strcmp0 (((IndicatorPrinterModelPrinter*) pValue)->sServer, pData) == 0;
+}
+
+// Replaces the printers of the default server with the result of a full query
+void indicator_printer_model_reset (IndicatorPrinterModel *self, GPtrArray *lPrinters)
+{
+    g_hash_table_remove_all (self->pPrivate->pJobs);
+    // The set holds the printers as its values as well
+    g_hash_table_foreach_remove (self->pPrivate->pActive, isLocal, NULL);
+    g_hash_table_foreach_remove (self->pPrivate->pPrinters, isLocal, NULL);
+
+    for (guint i = 0; i < lPrinters->len; i++)
+    {
+        PrinterQueryItem *pItem = g_ptr_array_index (lPrinters, i);
+        IndicatorPrinterModelPrinter *pPrinter = getPrinter (self, pItem->sName, NULL);
+        pPrinter->nState = pItem->nState;
+        pPrinter->sReasons = g_strdup (pItem->sReasons);
+
+        for (guint j = 0; j < pItem->lJobs->len; j++)
+        {
+            PrinterQueryJob *pJob = &g_array_index (pItem->lJobs, PrinterQueryJob, j);
+            addJob (self, pItem->sName, pJob->nId, pJob->bMine ? OWNER_MINE : OWNER_OTHER);
+        }
+    }
+}
+
+/*
+ * Replaces the printers of another server with the result of a poll. They are named
+ * "queue@server" and only count the user's jobs: nothing sends signals for their jobs,
+ * so the jobs stay out of the job table, where their ids could clash with local ones.
+ */
+void indicator_printer_model_reset_server (IndicatorPrinterModel *self, const gchar *sServer, GPtrArray *lPrinters)
+{
+    g_hash_table_foreach_remove (self->pPrivate->pActive, isOnServer, (gpointer) sServer);
+    g_hash_table_foreach_remove (self->pPrivate->pPrinters, isOnServer, (gpointer) sServer);
+
+    for (guint i = 0; lPrinters != NULL && i < lPrinters->len; i++)
+    {
+        PrinterQueryItem *pItem = g_ptr_array_index (lPrinters, i);
+        gchar *sName = g_strdup_printf ("%s@%s", pItem->sName, sServer);
+        IndicatorPrinterModelPrinter *pPrinter = getPrinter (self, sName, NULL);
+        g_free (sName);
+        g_free (pPrinter->sServer);
+        pPrinter->sServer = g_strdup (sServer);
+        pPrinter->nState = pItem->nState;
+        g_free (pPrinter->sReasons);
+        pPrinter->sReasons = g_strdup (pItem->sReasons);
+        g_hash_table_remove_all (pPrinter->pJobs);
+
+        for (guint j = 0; j < pItem->lJobs->len; j++)
+        {
+            PrinterQueryJob *pJob = &g_array_index (pItem->lJobs, PrinterQueryJob, j);
+
+            if (pJob->bMine)
+            {
+                addOwnJob (self, pPrinter, pJob->nId);
+            }
+        }
+    }
+}
+
+gboolean indicator_printer_model_update_printer (IndicatorPrinterModel *self, const gchar *sName, guint nState, const gchar *sReasons)
+{
+    gboolean bChanged;
+    IndicatorPrinterModelPrinter *pPrinter = getPrinter (self, sName, &bChanged);
+
+    if (pPrinter->nState != nState)
+    {
+        pPrinter->nState = nState;
+        bChanged = TRUE;
+    }
+
+    if (g_strcmp0 (pPrinter->sReasons, sReasons) != 0)
+    {
+        g_free (pPrinter->sReasons);
+        pPrinter->sReasons = g_strdup (sReasons);
+        bChanged = TRUE;
+    }
+
+    return bChanged;
+}
+
+IndicatorPrinterModelResult indicator_printer_model_update_job (IndicatorPrinterModel *self, const gchar *sPrinter, guint nJobId, guint nJobState, gboolean bCreated)
+{
+    gboolean bActive = (nJobState < IPP_JOB_CANCELED);
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    if (pJob == NULL)
+    {
+        // A finished job we never saw cannot change any count
+        if (!bActive)
+        {
+            return INDICATOR_PRINTER_MODEL_UNCHANGED;
+        }
+
+        if (!bCreated)
+        {
+            return INDICATOR_PRINTER_MODEL_GAP;
+        }
+
+        addJob (self, sPrinter, nJobId, OWNER_UNKNOWN);
+
+        return INDICATOR_PRINTER_MODEL_OWNER_UNKNOWN;
+    }
+
+    if (!bActive)
+    {
+        gboolean bChanged = detachJob (self, pJob);
+        g_hash_table_remove (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+        return bChanged ? INDICATOR_PRINTER_MODEL_CHANGED : INDICATOR_PRINTER_MODEL_UNCHANGED;
+    }
+
+    // The job was moved to another queue
+    if (g_strcmp0 (pJob->sPrinter, sPrinter) != 0)
+    {
+        gboolean bChanged = detachJob (self, pJob);
+        g_free (pJob->sPrinter);
+        pJob->sPrinter = g_strdup (sPrinter);
+
+        if (pJob->nOwner == OWNER_MINE)
+        {
+            addOwnJob (self, getPrinter (self, sPrinter, NULL), nJobId);
+            bChanged = TRUE;
+        }
+
+        return bChanged ? INDICATOR_PRINTER_MODEL_CHANGED : INDICATOR_PRINTER_MODEL_UNCHANGED;
+    }
+
+    return INDICATOR_PRINTER_MODEL_UNCHANGED;
+}
+
+gboolean indicator_printer_model_set_job_owner (IndicatorPrinterModel *self, guint nJobId, gboolean bMine)
+{
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    // Already finished or resolved by a resync in the meantime
+    if (pJob == NULL || pJob->nOwner != OWNER_UNKNOWN)
+    {
+        return FALSE;
+    }
+
+    pJob->nOwner = bMine ? OWNER_MINE : OWNER_OTHER;
+
+    if (bMine)
+    {
+        addOwnJob (self, getPrinter (self, pJob->sPrinter, NULL), nJobId);
+    }
+
+    return bMine;
+}
+
+// Returns the printer of an active job of the current user, NULL for any other job
+const gchar *indicator_printer_model_get_own_job (IndicatorPrinterModel *self, guint nJobId)
+{
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    return pJob != NULL && pJob->nOwner == OWNER_MINE ? pJob->sPrinter : NULL;
+}
+
+// Drops a job of another user that will not be followed any further
+void indicator_printer_model_forget_job (IndicatorPrinterModel *self, guint nJobId)
+{
+    Job *pJob = g_hash_table_lookup (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+
+    if (pJob != NULL && pJob->nOwner == OWNER_OTHER)
+    {
+        g_hash_table_remove (self->pPrivate->pJobs, GUINT_TO_POINTER (nJobId));
+    }
+}
+
+// Drops a deleted queue with all the jobs on it, returns TRUE if the model knew it
+gboolean indicator_printer_model_remove_printer (IndicatorPrinterModel *self, const gchar *sName)
+{
+    GHashTableIter cIter;
+    gpointer pJob;
+
+    g_hash_table_iter_init (&cIter, self->pPrivate->pJobs);
+
+    while (g_hash_table_iter_next (&cIter, NULL, &pJob))
+    {
+        if (g_strcmp0 (((Job*) pJob)->sPrinter, sName) == 0)
+        {
+            g_hash_table_iter_remove (&cIter);
+        }
+    }
+
+    IndicatorPrinterModelPrinter *pPrinter = g_hash_table_lookup (self->pPrivate->pPrinters, sName);
+
+    if (pPrinter == NULL)
+    {
+        return FALSE;
+    }
+
+    g_hash_table_remove (self->pPrivate->pActive, pPrinter);
+
+    return g_hash_table_remove (self->pPrivate->pPrinters, sName);
+}
+
+// Most jobs first, ties by name so the choice does not flicker
+static gint compareActivity (gconstpointer pA, gconstpointer pB)
+{
+    const IndicatorPrinterModelPrinter *pPrinterA = pA;
+    const IndicatorPrinterModelPrinter *pPrinterB = pB;
+    guint nJobsA = g_hash_table_size (pPrinterA->pJobs);
+    guint nJobsB = g_hash_table_size (pPrinterB->pJobs);
+
+    if (nJobsA != nJobsB)
+    {
+        return nJobsA > nJobsB ? -1 : 1;
+    }
+
+    return g_strcmp0 (pPrinterA->sName, pPrinterB->sName);
+}
+
+static gint compareNames (gconstpointer pA, gconstpointer pB)
+{
+    const IndicatorPrinterModelPrinter *pPrinterA = *(IndicatorPrinterModelPrinter**) pA;
+    const IndicatorPrinterModelPrinter *pPrinterB = *(IndicatorPrinterModelPrinter**) pB;
+
+    return g_strcmp0 (pPrinterA->sName, pPrinterB->sName);
+}
+
+// Restores the heap below nPos, the least active printer of the heap is at its root
+static void siftDown (GPtrArray *lHeap, guint nPos)
+{
+    while (TRUE)
+    {
+        guint nLeast = nPos;
+        guint nLeft = 2 * nPos + 1;
+        guint nRight = nLeft + 1;
+
+        if (nLeft < lHeap->len && compareActivity (g_ptr_array_index (lHeap, nLeft), g_ptr_array_index (lHeap, nLeast)) > 0)
+        {
+            nLeast = nLeft;
+        }
+
+        if (nRight < lHeap->len && compareActivity (g_ptr_array_index (lHeap, nRight), g_ptr_array_index (lHeap, nLeast)) > 0)
+        {
+            nLeast = nRight;
+        }
+
+        if (nLeast == nPos)
+        {
+            break;
+        }
+
+        gpointer pPrinter = g_ptr_array_index (lHeap, nPos);
+        g_ptr_array_index (lHeap, nPos) = g_ptr_array_index (lHeap, nLeast);
+        g_ptr_array_index (lHeap, nLeast) = pPrinter;
+        nPos = nLeast;
+    }
+}
+
+static void siftUp (GPtrArray *lHeap, guint nPos)
+{
+    while (nPos > 0)
+    {
+        guint nParent = (nPos - 1) / 2;
+
+        if (compareActivity (g_ptr_array_index (lHeap, nPos), g_ptr_array_index (lHeap, nParent)) <= 0)
+        {
+            break;
+        }
+
+        gpointer pPrinter = g_ptr_array_index (lHeap, nPos);
+        g_ptr_array_index (lHeap, nPos) = g_ptr_array_index (lHeap, nParent);
+        g_ptr_array_index (lHeap, nParent) = pPrinter;
+        nPos = nParent;
+    }
+}
+
+/*
+ * Returns at most nMax of the printers with jobs of the current user, all of them if nMax is 0,
+ * sorted by name. Past nMax, the ones with the most jobs are kept by a heap of nMax printers, so
+ * the cost grows with the busy printers and the limit, not with the queues. nBusy is set to the
+ * number of printers with jobs. Free the array with g_ptr_array_unref ().
+ */
+GPtrArray *indicator_printer_model_get_busiest (IndicatorPrinterModel *self, guint nMax, guint *nBusy)
+{
+    guint nActive = g_hash_table_size (self->pPrivate->pActive);
+    guint nSize = nMax > 0 ? MIN (nMax, nActive) : nActive;
+    GPtrArray *lPrinters = g_ptr_array_sized_new (nSize);
+    GHashTableIter cIter;
+    gpointer pPrinter;
+    g_hash_table_iter_init (&cIter, self->pPrivate->pActive);
+
+    while (g_hash_table_iter_next (&cIter, &pPrinter, NULL))
+    {
+        if (lPrinters->len < nSize)
+        {
+            g_ptr_array_add (lPrinters, pPrinter);
+            siftUp (lPrinters, lPrinters->len - 1);
+        }
+        else if (compareActivity (pPrinter, g_ptr_array_index (lPrinters, 0)) < 0)
+        {
+            g_ptr_array_index (lPrinters, 0) = pPrinter;
+            siftDown (lPrinters, 0);
+        }
+    }
+
+    g_ptr_array_sort (lPrinters, compareNames);
+
+    if (nBusy != NULL)
+    {
+        *nBusy = nActive;
+    }
+
+    return lPrinters;
+}
+
+// The number of active jobs of the current user on a printer, or on all printers if sPrinter is NULL, without asking cupsd
+guint indicator_printer_model_get_n_jobs (IndicatorPrinterModel *self, const gchar *sPrinter)
+{
+    if (sPrinter == NULL)
+    {
+        GHashTableIter cIter;
+        gpointer pPrinter;
+        guint nJobs = 0;
+
+        g_hash_table_iter_init (&cIter, self->pPrivate->pActive);
+
+        while (g_hash_table_iter_next (&cIter, &pPrinter, NULL))
+        {
+            nJobs += g_hash_table_size (((IndicatorPrinterModelPrinter*) pPrinter)->pJobs);
+        }
+
+        return nJobs;
+    }
+
+    IndicatorPrinterModelPrinter *pPrinter = g_hash_table_lookup (self->pPrivate->pPrinters, sPrinter);
+
+    return pPrinter != NULL ? g_hash_table_size (pPrinter->pJobs) : 0;
+}
+
+void indicator_printer_model_get_size (IndicatorPrinterModel *self, guint *nPrinters, guint *nJobs)
+{
+    *nPrinters = g_hash_table_size (self->pPrivate->pPrinters);
+    *nJobs = g_hash_table_size (self->pPrivate->pJobs);
+}
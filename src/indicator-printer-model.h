@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_PRINTER_MODEL_H__
+#define __INDICATOR_PRINTER_MODEL_H__
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_PRINTER_MODEL(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_PRINTER_MODEL, IndicatorPrinterModel))
+#define INDICATOR_TYPE_PRINTER_MODEL (indicator_printer_model_get_type ())
+#define INDICATOR_IS_PRINTER_MODEL(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_PRINTER_MODEL))
+
+typedef struct _IndicatorPrinterModel IndicatorPrinterModel;
+typedef struct _IndicatorPrinterModelClass IndicatorPrinterModelClass;
+typedef struct _IndicatorPrinterModelPrivate IndicatorPrinterModelPrivate;
+typedef struct _IndicatorPrinterModelPrinter IndicatorPrinterModelPrinter;
+
+struct _IndicatorPrinterModel
+{
+    GObject parent;
+    IndicatorPrinterModelPrivate *pPrivate;
+};
+
+struct _IndicatorPrinterModelClass
+{
+    GObjectClass parent_class;
+};
+
+struct _IndicatorPrinterModelPrinter
+{
+    gchar *sName;
+    // NULL for the default server
+    gchar *sServer;
+    guint nState;
+    gchar *sReasons;
+    // Active job ids of the current user
+    GHashTable *pJobs;
+};
+
+typedef enum
+{
+    INDICATOR_PRINTER_MODEL_UNCHANGED,
+    INDICATOR_PRINTER_MODEL_CHANGED,
+    // A new job whose owner must be looked up with indicator_printer_model_set_job_owner ()
+    INDICATOR_PRINTER_MODEL_OWNER_UNKNOWN,
+    // A job signal for a job the model never saw, some signals were missed
+    INDICATOR_PRINTER_MODEL_GAP
+} IndicatorPrinterModelResult;
+
+GType indicator_printer_model_get_type (void);
+IndicatorPrinterModel *indicator_printer_model_new ();
+void indicator_printer_model_reset (IndicatorPrinterModel *self, GPtrArray *lPrinters);
+void indicator_printer_model_reset_server (IndicatorPrinterModel *self, const gchar *sServer, GPtrArray *lPrinters);
+gboolean indicator_printer_model_update_printer (IndicatorPrinterModel *self, const gchar *sName, guint nState, const gchar *sReasons);
+gboolean indicator_printer_model_remove_printer (IndicatorPrinterModel *self, const gchar *sName);
+IndicatorPrinterModelResult indicator_printer_model_update_job (IndicatorPrinterModel *self, const gchar *sPrinter, guint nJobId, guint nJobState, gboolean bCreated);
+gboolean indicator_printer_model_set_job_owner (IndicatorPrinterModel *self, guint nJobId, gboolean bMine);
+const gchar *indicator_printer_model_get_own_job (IndicatorPrinterModel *self, guint nJobId);
+void indicator_printer_model_forget_job (IndicatorPrinterModel *self, guint nJobId);
+GPtrArray *indicator_printer_model_get_busiest (IndicatorPrinterModel *self, guint nMax, guint *nBusy);
+guint indicator_printer_model_get_n_jobs (IndicatorPrinterModel *self, const gchar *sPrinter);
+void indicator_printer_model_get_size (IndicatorPrinterModel *self, guint *nPrinters, guint *nJobs);
+
+G_END_DECLS
+
+#endif
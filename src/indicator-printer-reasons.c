@@ -0,0 +1,140 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "indicator-printer-reasons.h"
+
+// Longer keywords are not known and can be skipped without looking them up
+#define MAX_KEYWORD 64
+
+G_STATIC_ASSERT (N_INDICATOR_PRINTER_REASONS <= 64);
+
+// In the order of IndicatorPrinterReason
+static const gchar * const m_lKeywords[N_INDICATOR_PRINTER_REASONS] =
+{
+    "other",
+    "media-needed",
+    "media-jam",
+    "media-low",
+    "media-empty",
+    "moving-to-paused",
+    "paused",
+    "shutdown",
+    "connecting-to-device",
+    "timed-out",
+    "stopping",
+    "stopped-partly",
+    "toner-low",
+    "toner-empty",
+    "spool-area-full",
+    "cover-open",
+    "interlock-open",
+    "door-open",
+    "input-tray-missing",
+    "output-tray-missing",
+    "marker-supply-low",
+    "marker-supply-empty",
+    "marker-waste-almost-full",
+    "marker-waste-full",
+    "fuser-over-temp",
+    "fuser-under-temp",
+    "opc-near-eol",
+    "opc-life-over",
+    "developer-low",
+    "developer-empty",
+    "interpreter-resource-unavailable",
+    "output-area-almost-full",
+    "output-area-full",
+    "offline",
+    "cups-missing-filter",
+    "cups-insecure-filter",
+    "cups-waiting-for-job-completed"
+};
+
+static GHashTable *getAtoms ()
+{
+    static gsize nInitialised = 0;
+    static GHashTable *pAtoms = NULL;
+
+    if (g_once_init_enter (&nInitialised))
+    {
+        pAtoms = g_hash_table_new (g_str_hash, g_str_equal);
+
+        for (guint i = 0; i < N_INDICATOR_PRINTER_REASONS; i++)
+        {
+            g_hash_table_insert (pAtoms, (gpointer) m_lKeywords[i], GUINT_TO_POINTER (i + 1));
+        }
+
+        g_once_init_leave (&nInitialised, 1);
+    }
+
+    return pAtoms;
+}
+
+/*
+ * Turns a printer-state-reasons string, separated by spaces or commas, into a bitset of
+ * IndicatorPrinterReason. The -warning and -error suffixes are dropped, -report reasons
+ * are informational and unknown keywords can not raise an alert, so both are ignored.
+ * Nothing is allocated.
+ */
+guint64 indicator_printer_reasons_parse (const gchar *sReasons)
+{
+    GHashTable *pAtoms = getAtoms ();
+    guint64 nReasons = 0;
+    const gchar *pStart = sReasons;
+
+    while (pStart != NULL && *pStart != '\0')
+    {
+        gsize nLength = strcspn (pStart, " ,");
+
+        if (nLength > 0 && nLength < MAX_KEYWORD)
+        {
+            gchar sKeyword[MAX_KEYWORD];
+            memcpy (sKeyword, pStart, nLength);
+            sKeyword[nLength] = '\0';
+
+            if (g_str_has_suffix (sKeyword, "-warning"))
+            {
+                sKeyword[nLength - strlen ("-warning")] = '\0';
+            }
+            else if (g_str_has_suffix (sKeyword, "-error"))
+            {
+                sKeyword[nLength - strlen ("-error")] = '\0';
+            }
+
+            guint nAtom = g_str_has_suffix (sKeyword, "-report") ? 0 : GPOINTER_TO_UINT (g_hash_table_lookup (pAtoms, sKeyword));
+
+            if (nAtom > 0)
+            {
+                nReasons |= INDICATOR_PRINTER_REASON_BIT (nAtom - 1);
+            }
+        }
+
+        pStart += nLength;
+        pStart += strspn (pStart, " ,");
+    }
+
+    return nReasons;
+}
+
+const gchar *indicator_printer_reasons_get_keyword (IndicatorPrinterReason nReason)
+{
+    g_return_val_if_fail (nReason < N_INDICATOR_PRINTER_REASONS, NULL);
+
+    return m_lKeywords[nReason];
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_PRINTER_REASONS_H__
+#define __INDICATOR_PRINTER_REASONS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// The printer-state-reasons keywords of RFC 8011 and CUPS, without their -warning or -error suffix
+typedef enum
+{
+    INDICATOR_PRINTER_REASON_OTHER,
+    INDICATOR_PRINTER_REASON_MEDIA_NEEDED,
+    INDICATOR_PRINTER_REASON_MEDIA_JAM,
+    INDICATOR_PRINTER_REASON_MEDIA_LOW,
+    INDICATOR_PRINTER_REASON_MEDIA_EMPTY,
+    INDICATOR_PRINTER_REASON_MOVING_TO_PAUSED,
+    INDICATOR_PRINTER_REASON_PAUSED,
+    INDICATOR_PRINTER_REASON_SHUTDOWN,
+    INDICATOR_PRINTER_REASON_CONNECTING_TO_DEVICE,
+    INDICATOR_PRINTER_REASON_TIMED_OUT,
+    INDICATOR_PRINTER_REASON_STOPPING,
+    INDICATOR_PRINTER_REASON_STOPPED_PARTLY,
+    INDICATOR_PRINTER_REASON_TONER_LOW,
+    INDICATOR_PRINTER_REASON_TONER_EMPTY,
+    INDICATOR_PRINTER_REASON_SPOOL_AREA_FULL,
+    INDICATOR_PRINTER_REASON_COVER_OPEN,
+    INDICATOR_PRINTER_REASON_INTERLOCK_OPEN,
+    INDICATOR_PRINTER_REASON_DOOR_OPEN,
+    INDICATOR_PRINTER_REASON_INPUT_TRAY_MISSING,
+    INDICATOR_PRINTER_REASON_OUTPUT_TRAY_MISSING,
+    INDICATOR_PRINTER_REASON_MARKER_SUPPLY_LOW,
+    INDICATOR_PRINTER_REASON_MARKER_SUPPLY_EMPTY,
+    INDICATOR_PRINTER_REASON_MARKER_WASTE_ALMOST_FULL,
+    INDICATOR_PRINTER_REASON_MARKER_WASTE_FULL,
+    INDICATOR_PRINTER_REASON_FUSER_OVER_TEMP,
+    INDICATOR_PRINTER_REASON_FUSER_UNDER_TEMP,
+    INDICATOR_PRINTER_REASON_OPC_NEAR_EOL,
+    INDICATOR_PRINTER_REASON_OPC_LIFE_OVER,
+    INDICATOR_PRINTER_REASON_DEVELOPER_LOW,
+    INDICATOR_PRINTER_REASON_DEVELOPER_EMPTY,
+    INDICATOR_PRINTER_REASON_INTERPRETER_RESOURCE_UNAVAILABLE,
+    INDICATOR_PRINTER_REASON_OUTPUT_AREA_ALMOST_FULL,
+    INDICATOR_PRINTER_REASON_OUTPUT_AREA_FULL,
+    INDICATOR_PRINTER_REASON_OFFLINE,
+    INDICATOR_PRINTER_REASON_CUPS_MISSING_FILTER,
+    INDICATOR_PRINTER_REASON_CUPS_INSECURE_FILTER,
+    INDICATOR_PRINTER_REASON_CUPS_WAITING_FOR_JOB_COMPLETED,
+    N_INDICATOR_PRINTER_REASONS
+} IndicatorPrinterReason;
+
+#define INDICATOR_PRINTER_REASON_BIT(n) (G_GUINT64_CONSTANT (1) << (n))
+
+guint64 indicator_printer_reasons_parse (const gchar *sReasons);
+const gchar *indicator_printer_reasons_get_keyword (IndicatorPrinterReason nReason);
+
+G_END_DECLS
+
+#endif
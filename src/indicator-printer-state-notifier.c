@@ -19,24 +19,52 @@
  */
 
 #include "indicator-printer-state-notifier.h"
-#include <ayatana/common/utils.h>
 #include <glib/gi18n.h>
 #include <cups/cups.h>
 #include <string.h>
-#include <stdarg.h>
 
 #include "cups-notifier.h"
-#include "spawn-printer-settings.h"
+#include "indicator-alert-dispatcher.h"
+#include "indicator-printer-reasons.h"
+
+/* thin clients can see hundreds of transient driverless queues a day, only
+ * the most recently seen printers keep their notified state */
+#define MAX_NOTIFIED_PRINTERS 64
+
+typedef struct
+{
+    gchar *printer;
+    /* state reasons that were already notified about */
+    guint64 reasons;
+    /* position in notified_lru */
+    GList link;
+} NotifiedState;
 
 struct _IndicatorPrinterStateNotifierPrivate
 {
     CupsNotifier *cups_notifier;
+    IndicatorCupsConnection *cups_connection;
+
+    /* kept up to date by the service from the job signals */
+    IndicatorPrinterModel *model;
 
-    /* printer states that were already notified about in this session */
+    /* printer -> NotifiedState, for printers that were notified about in
+     * this session */
     GHashTable *notified_printer_states;
 
+    /* the NotifiedStates, most recently used first */
+    GQueue notified_lru;
+    gsize notified_bytes;
+    guint notified_evictions;
+
+    /* bitset of the reasons below that have an alert */
+    guint64 alert_reasons;
+
+    /* merges and rate-limits the alerts before they are shown */
+    IndicatorAlertDispatcher *alert_dispatcher;
+
     /* state-reason -> user visible string with a %s for printer name */
-    GHashTable *printer_alerts;
+    const gchar *printer_alerts[N_INDICATOR_PRINTER_REASONS];
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(IndicatorPrinterStateNotifier, indicator_printer_state_notifier, G_TYPE_OBJECT)
@@ -44,73 +72,113 @@ G_DEFINE_TYPE_WITH_PRIVATE(IndicatorPrinterStateNotifier, indicator_printer_stat
 enum {
     PROP_0,
     PROP_CUPS_NOTIFIER,
+    PROP_CUPS_CONNECTION,
+    PROP_MODEL,
+    PROP_NOTIFIED_PRINTERS,
+    PROP_NOTIFIED_BYTES,
+    PROP_NOTIFIED_EVICTIONS,
     NUM_PROPERTIES
 };
 
 static GParamSpec *properties[NUM_PROPERTIES];
 
 
+static gsize
+notified_state_size (NotifiedState *state)
+{
+    return sizeof (NotifiedState) + strlen (state->printer) + 1;
+}
+
+
 static void
-g_hash_table_insert_many (GHashTable *hash_table,
-                          gpointer key,
-                          ...)
+notified_state_free (gpointer data)
 {
-    va_list args;
+    NotifiedState *state = data;
 
-    va_start (args, key);
-    while (key) {
-        gpointer value = va_arg (args, gpointer);
-        g_hash_table_insert (hash_table, key, value);
-        key = va_arg (args, gpointer);
-    }
-    va_end (args);
+    g_free (state->printer);
+    g_free (state);
 }
 
 
-/* returns a list of strings that are in a but not in b; does not copy the
- * strings */
-static GList *
-g_strv_diff (gchar **a,
-             gchar **b)
+/* returns the notified state of printer, creating it if necessary, and marks
+ * it as the most recently used one */
+static NotifiedState *
+lookup_notified_state (IndicatorPrinterStateNotifierPrivate *priv,
+                       const gchar *printer)
 {
-    GList *result = NULL;
-    gchar **p;
+    NotifiedState *state;
+
+    state = g_hash_table_lookup (priv->notified_printer_states, printer);
+
+    if (state) {
+        g_queue_unlink (&priv->notified_lru, &state->link);
+        g_queue_push_head_link (&priv->notified_lru, &state->link);
+        return state;
+    }
 
-    if (!a)
-        return NULL;
+    while (priv->notified_lru.length >= MAX_NOTIFIED_PRINTERS) {
+        NotifiedState *oldest = priv->notified_lru.tail->data;
 
-    for (p = a; *p; p++) {
-        if (!g_strv_contains ((const gchar * const *) b, *p))
-            result = g_list_prepend (result, *p);
+        g_queue_unlink (&priv->notified_lru, &oldest->link);
+        priv->notified_bytes -= notified_state_size (oldest);
+        priv->notified_evictions++;
+        g_hash_table_remove (priv->notified_printer_states, oldest->printer);
     }
 
-    return g_list_reverse (result);
+    state = g_new0 (NotifiedState, 1);
+    state->printer = g_strdup (printer);
+    state->link.data = state;
+
+    g_hash_table_insert (priv->notified_printer_states, state->printer, state);
+    g_queue_push_head_link (&priv->notified_lru, &state->link);
+    priv->notified_bytes += notified_state_size (state);
+
+    return state;
 }
 
 
-void
-show_alert_box (const gchar *printer,
-                const gchar *reason,
-                int njobs)
+static void
+forget_notified_state (IndicatorPrinterStateNotifierPrivate *priv,
+                       const gchar *printer)
 {
-    gchar *primary_text;
-    gchar *secondary_text;
+    NotifiedState *state;
+
+    state = g_hash_table_lookup (priv->notified_printer_states, printer);
+    if (!state)
+        return;
 
-    primary_text = g_strdup_printf (reason, printer);
+    g_queue_unlink (&priv->notified_lru, &state->link);
+    priv->notified_bytes -= notified_state_size (state);
+    g_hash_table_remove (priv->notified_printer_states, printer);
+}
 
-    secondary_text = g_strdup_printf (ngettext(
-                   "You have %d job queued to print on this printer.",
-                   "You have %d jobs queued to print on this printer.", njobs),
-                   njobs);
 
-    gchar *sText = g_strdup_printf("<b>%s</b>\n\n%s", primary_text, secondary_text);
-    g_free (primary_text);
-    g_free (secondary_text);
+/* the model is kept up to date from the job signals, so cupsd is only asked
+ * if the notifier runs without one */
+static int
+count_user_jobs (IndicatorPrinterStateNotifierPrivate *priv,
+                 const gchar *printer)
+{
+    int njobs;
+    cups_job_t *jobs;
+    GError *error = NULL;
 
-    ayatana_common_utils_zenity_warning ("printer", _("Printing Problem"), sText);
-    g_free (sText);
+    if (priv->model)
+        return indicator_printer_model_get_n_jobs (priv->model, printer);
+
+    if (priv->cups_connection)
+        njobs = indicator_cups_connection_get_jobs (priv->cups_connection, &jobs, printer,
+                                                    TRUE, CUPS_WHICHJOBS_ACTIVE, &error);
+    else
+        njobs = cupsGetJobs (&jobs, printer, 1, CUPS_WHICHJOBS_ACTIVE);
+
+    if (error) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+    }
 
-    spawn_printer_settings ();
+    cupsFreeJobs (njobs, jobs);
+    return njobs;
 }
 
 
@@ -126,36 +194,50 @@ on_printer_state_changed (CupsNotifier *object,
 {
     IndicatorPrinterStateNotifierPrivate *priv = INDICATOR_PRINTER_STATE_NOTIFIER (user_data)->priv;
     int njobs;
-    cups_job_t *jobs;
-    gchar **state_reasons, **already_notified;
-    GList *new_state_reasons, *it;
+    guint64 state_reasons, new_state_reasons;
+    NotifiedState *already_notified;
+    guint reason;
 
-    njobs = cupsGetJobs (&jobs, printer, 1, CUPS_WHICHJOBS_ACTIVE);
-    cupsFreeJobs (njobs, jobs);
+    njobs = count_user_jobs (priv, printer);
 
     /* don't show any events if the current user does not have jobs queued on
      * that printer or this printer is unknown to CUPS */
     if (njobs <= 0)
         return;
 
-    state_reasons = g_strsplit (printer_state_reasons, " ", 0);
-    already_notified = g_hash_table_lookup (priv->notified_printer_states,
-                                            printer);
+    state_reasons = indicator_printer_reasons_parse (printer_state_reasons);
+    already_notified = lookup_notified_state (priv, printer);
 
-    new_state_reasons = g_strv_diff (state_reasons, already_notified);
+    new_state_reasons = state_reasons & ~already_notified->reasons & priv->alert_reasons;
 
-    for (it = new_state_reasons; it; it = g_list_next (new_state_reasons)) {
-        const gchar *reason_text = g_hash_table_lookup (priv->printer_alerts,
-                                                        it->data);
-        if (reason_text)
-            show_alert_box (printer, reason_text, njobs);
+    for (reason = 0; new_state_reasons; reason++) {
+        if (new_state_reasons & INDICATOR_PRINTER_REASON_BIT (reason)) {
+            indicator_alert_dispatcher_add (priv->alert_dispatcher, printer, reason,
+                                            priv->printer_alerts[reason], njobs);
+            new_state_reasons &= ~INDICATOR_PRINTER_REASON_BIT (reason);
+        }
     }
 
-    g_list_free (new_state_reasons);
+    /* reasons that were cleared are alerted about again when they return */
+    already_notified->reasons = state_reasons;
+}
+
+
+/* a deleted queue never comes back under its name with the same problems, and
+ * a printer that was shut down starts over */
+static void
+on_printer_deleted (CupsNotifier *object,
+                    const gchar *text,
+                    const gchar *printer_uri,
+                    const gchar *printer,
+                    guint printer_state,
+                    const gchar *printer_state_reasons,
+                    gboolean printer_is_accepting_jobs,
+                    gpointer user_data)
+{
+    IndicatorPrinterStateNotifierPrivate *priv = INDICATOR_PRINTER_STATE_NOTIFIER (user_data)->priv;
 
-    g_hash_table_replace (priv->notified_printer_states,
-                          g_strdup (printer),
-                          state_reasons);
+    forget_notified_state (priv, printer);
 }
 
 
@@ -174,6 +256,26 @@ get_property (GObject    *object,
                                 indicator_printer_state_notifier_get_cups_notifier (self));
             break;
 
+        case PROP_CUPS_CONNECTION:
+            g_value_set_object (value, self->priv->cups_connection);
+            break;
+
+        case PROP_MODEL:
+            g_value_set_object (value, self->priv->model);
+            break;
+
+        case PROP_NOTIFIED_PRINTERS:
+            g_value_set_uint (value, self->priv->notified_lru.length);
+            break;
+
+        case PROP_NOTIFIED_BYTES:
+            g_value_set_uint64 (value, self->priv->notified_bytes);
+            break;
+
+        case PROP_NOTIFIED_EVICTIONS:
+            g_value_set_uint (value, self->priv->notified_evictions);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -195,6 +297,16 @@ set_property (GObject      *object,
                                                                 g_value_get_object (value));
             break;
 
+        case PROP_CUPS_CONNECTION:
+            g_clear_object (&self->priv->cups_connection);
+            self->priv->cups_connection = g_value_dup_object (value);
+            break;
+
+        case PROP_MODEL:
+            g_clear_object (&self->priv->model);
+            self->priv->model = g_value_dup_object (value);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -207,14 +319,15 @@ dispose (GObject *object)
     IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (object);
 
     if (self->priv->notified_printer_states) {
+        g_queue_init (&self->priv->notified_lru);
+        self->priv->notified_bytes = 0;
         g_hash_table_unref (self->priv->notified_printer_states);
         self->priv->notified_printer_states = NULL;
     }
-    if (self->priv->printer_alerts) {
-        g_hash_table_unref (self->priv->printer_alerts);
-        self->priv->printer_alerts = NULL;
-    }
+    g_clear_object (&self->priv->alert_dispatcher);
     g_clear_object (&self->priv->cups_notifier);
+    g_clear_object (&self->priv->cups_connection);
+    g_clear_object (&self->priv->model);
 
     G_OBJECT_CLASS (indicator_printer_state_notifier_parent_class)->dispose (object);
 }
@@ -243,6 +356,36 @@ indicator_printer_state_notifier_class_init (IndicatorPrinterStateNotifierClass
                                                           CUPS_TYPE_NOTIFIER,
                                                           G_PARAM_READWRITE);
 
+    properties[PROP_CUPS_CONNECTION] = g_param_spec_object ("cups-connection",
+                                                            "Cups Connection",
+                                                            "The connection pool used for CUPS requests",
+                                                            INDICATOR_TYPE_CUPS_CONNECTION,
+                                                            G_PARAM_READWRITE);
+
+    properties[PROP_MODEL] = g_param_spec_object ("model",
+                                                  "Model",
+                                                  "The printers and jobs known to the service, used instead of asking cupsd",
+                                                  INDICATOR_TYPE_PRINTER_MODEL,
+                                                  G_PARAM_READWRITE);
+
+    properties[PROP_NOTIFIED_PRINTERS] = g_param_spec_uint ("notified-printers",
+                                                            "Notified Printers",
+                                                            "Number of printers whose notified state is remembered",
+                                                            0, G_MAXUINT, 0,
+                                                            G_PARAM_READABLE);
+
+    properties[PROP_NOTIFIED_BYTES] = g_param_spec_uint64 ("notified-bytes",
+                                                           "Notified Bytes",
+                                                           "Memory used by the remembered notified states",
+                                                           0, G_MAXUINT64, 0,
+                                                           G_PARAM_READABLE);
+
+    properties[PROP_NOTIFIED_EVICTIONS] = g_param_spec_uint ("notified-evictions",
+                                                             "Notified Evictions",
+                                                             "Number of notified states dropped to stay within the limit",
+                                                             0, G_MAXUINT, 0,
+                                                             G_PARAM_READABLE);
+
     g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
 }
 
@@ -257,20 +400,25 @@ indicator_printer_state_notifier_init (IndicatorPrinterStateNotifier *self)
 
     priv->notified_printer_states = g_hash_table_new_full (g_str_hash,
                                                            g_str_equal,
-                                                           g_free,
-                                                           (GDestroyNotify)g_strfreev);
-
-    priv->printer_alerts = g_hash_table_new (g_str_hash, g_str_equal);
-    g_hash_table_insert_many ( priv->printer_alerts,
-                               "media-low", _("The printer “%s” is low on paper."),
-                               "media-empty", _("The printer “%s” is out of paper."),
-                               "toner-low", _("The printer “%s” is low on toner."),
-                               "toner-empty", _("The printer “%s” is out of toner."),
-                               "cover-open", _("A cover is open on the printer “%s”."),
-                               "door-open", _("A door is open on the printer “%s”."),
-                               "cups-missing-filter", _("The printer “%s” can’t be used, because required software is missing."),
-                               "offline", _("The printer “%s” is currently off-line."),
-                               NULL);
+                                                           NULL,
+                                                           notified_state_free);
+    g_queue_init (&priv->notified_lru);
+
+    priv->alert_dispatcher = indicator_alert_dispatcher_new ();
+
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_MEDIA_LOW] = _("The printer “%s” is low on paper.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_MEDIA_EMPTY] = _("The printer “%s” is out of paper.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_TONER_LOW] = _("The printer “%s” is low on toner.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_TONER_EMPTY] = _("The printer “%s” is out of toner.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_COVER_OPEN] = _("A cover is open on the printer “%s”.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_DOOR_OPEN] = _("A door is open on the printer “%s”.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_CUPS_MISSING_FILTER] = _("The printer “%s” can’t be used, because required software is missing.");
+    priv->printer_alerts[INDICATOR_PRINTER_REASON_OFFLINE] = _("The printer “%s” is currently off-line.");
+
+    for (guint reason = 0; reason < N_INDICATOR_PRINTER_REASONS; reason++) {
+        if (priv->printer_alerts[reason])
+            priv->alert_reasons |= INDICATOR_PRINTER_REASON_BIT (reason);
+    }
 }
 
 
@@ -289,6 +437,9 @@ indicator_printer_state_notifier_set_cups_notifier (IndicatorPrinterStateNotifie
         g_signal_handlers_disconnect_by_func (self->priv->cups_notifier,
                                               on_printer_state_changed,
                                               self);
+        g_signal_handlers_disconnect_by_func (self->priv->cups_notifier,
+                                              on_printer_deleted,
+                                              self);
         g_clear_object (&self->priv->cups_notifier);
     }
 
@@ -296,5 +447,9 @@ indicator_printer_state_notifier_set_cups_notifier (IndicatorPrinterStateNotifie
         self->priv->cups_notifier = g_object_ref (cups_notifier);
         g_signal_connect (cups_notifier, "printer-state-changed",
                           G_CALLBACK (on_printer_state_changed), self);
+        g_signal_connect (cups_notifier, "printer-deleted",
+                          G_CALLBACK (on_printer_deleted), self);
+        g_signal_connect (cups_notifier, "printer-shutdown",
+                          G_CALLBACK (on_printer_deleted), self);
     }
 }
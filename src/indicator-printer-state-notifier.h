@@ -21,6 +21,8 @@
 
 #include <glib-object.h>
 #include "cups-notifier.h"
+#include "indicator-cups-connection.h"
+#include "indicator-printer-model.h"
 
 G_BEGIN_DECLS
 
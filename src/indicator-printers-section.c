@@ -0,0 +1,329 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cups/cups.h>
+#include <glib/gi18n-lib.h>
+#include "indicator-printers-section.h"
+#include "indicator-printers-variants.h"
+
+/*
+ * A GMenu can only replace an item by removing and re-inserting it, which is exported as
+ * two "Changed" deltas. This model keeps one attribute table per item and reports an
+ * attribute update as a single in-place items-changed (nPos, 1, 1).
+ */
+struct _IndicatorPrintersSectionPrivate
+{
+    // One attribute table (name -> GVariant) per item, sorted by label
+    GPtrArray *lItems;
+    // The "More printers" item after lItems, NULL if all printers are shown
+    GHashTable *pMore;
+    // Most printers shown, 0 for all of them
+    guint nLimit;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorPrintersSection, indicator_printers_section, G_TYPE_MENU_MODEL)
+
+static void setAttribute (GHashTable *pItem, const gchar *sName, GVariant *pValue)
+{
+    g_hash_table_insert (pItem, g_strdup (sName), g_variant_ref_sink (pValue));
+}
+
+// The oldest of the printer's jobs with a published progress, which is the one cupsd prints
+static const IndicatorJobProgressInfo *getProgress (IndicatorPrinterModelPrinter *pPrinter, IndicatorJobProgress *pProgress)
+{
+    const IndicatorJobProgressInfo *pInfo = NULL;
+    guint nOldest = G_MAXUINT;
+    GHashTableIter cIter;
+    gpointer pJobId;
+    g_hash_table_iter_init (&cIter, pPrinter->pJobs);
+
+    while (g_hash_table_iter_next (&cIter, &pJobId, NULL))
+    {
+        guint nJobId = GPOINTER_TO_UINT (pJobId);
+        const IndicatorJobProgressInfo *pJobInfo = nJobId < nOldest ? indicator_job_progress_lookup (pProgress, nJobId) : NULL;
+
+        if (pJobInfo != NULL)
+        {
+            pInfo = pJobInfo;
+            nOldest = nJobId;
+        }
+    }
+
+    return pInfo;
+}
+
+static GHashTable *createItem (IndicatorPrinterModelPrinter *pPrinter, guint nJobs, IndicatorJobProgress *pProgress)
+{
+    GHashTable *pItem = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+    setAttribute (pItem, G_MENU_ATTRIBUTE_LABEL, g_variant_new_string (pPrinter->sName));
+    setAttribute (pItem, "x-ayatana-type", g_variant_new_string ("org.ayatana.indicator.basic"));
+
+    // The job viewer only shows the queues of the default server
+    if (pPrinter->sServer == NULL)
+    {
+        setAttribute (pItem, G_MENU_ATTRIBUTE_ACTION, g_variant_new_string ("indicator.printer"));
+        setAttribute (pItem, G_MENU_ATTRIBUTE_TARGET, g_variant_new_string (pPrinter->sName));
+    }
+
+    GVariant *pIcon = indicator_printers_variants_get_icon ("printer");
+
+    if (pIcon != NULL)
+    {
+        setAttribute (pItem, G_MENU_ATTRIBUTE_ICON, pIcon);
+    }
+
+    switch (pPrinter->nState)
+    {
+        case IPP_PRINTER_STOPPED:
+        {
+            setAttribute (pItem, "x-ayatana-secondary-text", g_variant_new_string (_("Paused")));
+
+            break;
+        }
+        case IPP_PRINTER_PROCESSING:
+        {
+            setAttribute (pItem, "x-ayatana-secondary-count", g_variant_new_int32 (nJobs));
+            // Only the jobs of the default server are tracked, the ids of another one could clash
+            const IndicatorJobProgressInfo *pInfo = pProgress != NULL && pPrinter->sServer == NULL ? getProgress (pPrinter, pProgress) : NULL;
+
+            if (pInfo != NULL)
+            {
+                if (pInfo->sName != NULL)
+                {
+                    setAttribute (pItem, "x-ayatana-job-name", g_variant_new_string (pInfo->sName));
+                }
+
+                setAttribute (pItem, "x-ayatana-impressions-completed", g_variant_new_uint32 (pInfo->nCompleted));
+
+                if (pInfo->nTotal > 0)
+                {
+                    setAttribute (pItem, "x-ayatana-progress", g_variant_new_int32 (MIN (pInfo->nCompleted, pInfo->nTotal) * 100 / pInfo->nTotal));
+                }
+            }
+
+            break;
+        }
+    }
+
+    return pItem;
+}
+
+static GHashTable *createMoreItem (guint nHidden)
+{
+    GHashTable *pItem = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+    setAttribute (pItem, G_MENU_ATTRIBUTE_LABEL, g_variant_new_string (_("More Printers…")));
+    setAttribute (pItem, "x-ayatana-type", g_variant_new_string ("org.ayatana.indicator.basic"));
+    setAttribute (pItem, G_MENU_ATTRIBUTE_ACTION, g_variant_new_string ("indicator.more-printers"));
+    setAttribute (pItem, "x-ayatana-secondary-count", g_variant_new_int32 (nHidden));
+
+    return pItem;
+}
+
+static gboolean itemsEqual (GHashTable *pA, GHashTable *pB)
+{
+    if (g_hash_table_size (pA) != g_hash_table_size (pB))
+    {
+        return FALSE;
+    }
+
+    GHashTableIter cIter;
+    gpointer pKey;
+    gpointer pValue;
+    g_hash_table_iter_init (&cIter, pA);
+
+    while (g_hash_table_iter_next (&cIter, &pKey, &pValue))
+    {
+        GVariant *pOther = g_hash_table_lookup (pB, pKey);
+
+        if (pOther == NULL || !g_variant_equal (pValue, pOther))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static const gchar *getLabel (GHashTable *pItem)
+{
+    GVariant *pLabel = g_hash_table_lookup (pItem, G_MENU_ATTRIBUTE_LABEL);
+
+    return g_variant_get_string (pLabel, NULL);
+}
+
+static gboolean isMutable (GMenuModel *pModel)
+{
+    return TRUE;
+}
+
+static gint getNItems (GMenuModel *pModel)
+{
+    IndicatorPrintersSection *self = INDICATOR_PRINTERS_SECTION (pModel);
+
+    return self->pPrivate->lItems->len + (self->pPrivate->pMore != NULL ? 1 : 0);
+}
+
+static void getItemAttributes (GMenuModel *pModel, gint nPos, GHashTable **pTable)
+{
+    IndicatorPrintersSection *self = INDICATOR_PRINTERS_SECTION (pModel);
+
+    if ((guint) nPos == self->pPrivate->lItems->len)
+    {
+        *pTable = g_hash_table_ref (self->pPrivate->pMore);
+    }
+    else
+    {
+        *pTable = g_hash_table_ref (g_ptr_array_index (self->pPrivate->lItems, nPos));
+    }
+}
+
+static void getItemLinks (GMenuModel *pModel, gint nPos, GHashTable **pTable)
+{
+    *pTable = g_hash_table_new (NULL, NULL);
+}
+
+static void onFinalize (GObject *pObject)
+{
+    IndicatorPrintersSection *self = INDICATOR_PRINTERS_SECTION (pObject);
+
+    g_ptr_array_unref (self->pPrivate->lItems);
+    g_clear_pointer (&self->pPrivate->pMore, g_hash_table_unref);
+
+    G_OBJECT_CLASS (indicator_printers_section_parent_class)->finalize (pObject);
+}
+
+static void indicator_printers_section_class_init (IndicatorPrintersSectionClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->finalize = onFinalize;
+
+    GMenuModelClass *menu_model_class = G_MENU_MODEL_CLASS (klass);
+    menu_model_class->is_mutable = isMutable;
+    menu_model_class->get_n_items = getNItems;
+    menu_model_class->get_item_attributes = getItemAttributes;
+    menu_model_class->get_item_links = getItemLinks;
+}
+
+static void indicator_printers_section_init (IndicatorPrintersSection *self)
+{
+    self->pPrivate = indicator_printers_section_get_instance_private (self);
+    self->pPrivate->lItems = g_ptr_array_new_with_free_func ((GDestroyNotify) g_hash_table_unref);
+}
+
+IndicatorPrintersSection *indicator_printers_section_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_PRINTERS_SECTION, NULL);
+
+    return INDICATOR_PRINTERS_SECTION (pObject);
+}
+
+/*
+ * Shows at most nLimit printers, the ones with the most jobs, followed by a "More printers"
+ * item that activates indicator.more-printers. Takes effect with the next update.
+ */
+void indicator_printers_section_set_limit (IndicatorPrintersSection *self, guint nLimit)
+{
+    self->pPrivate->nLimit = nLimit;
+}
+
+/*
+ * Both the items and the shown printers are sorted by name, so a single merge pass finds
+ * the items to remove, insert or update. Unchanged items keep their position and are not
+ * reported at all. The model hands out only the printers with jobs, past the limit only
+ * the most active ones, so neither the selection nor the merge looks at idle queues. A
+ * busy printer shows the progress of the job it prints, if pProgress has one. Returns
+ * TRUE if any printer is shown.
+ */
+gboolean indicator_printers_section_update (IndicatorPrintersSection *self, IndicatorPrinterModel *pModel, IndicatorJobProgress *pProgress)
+{
+    GPtrArray *lItems = self->pPrivate->lItems;
+    guint nPos = 0;
+    guint nBusy;
+    GPtrArray *lShown = indicator_printer_model_get_busiest (pModel, self->pPrivate->nLimit, &nBusy);
+    guint nHidden = nBusy - lShown->len;
+
+    for (guint i = 0; i < lShown->len; i++)
+    {
+        IndicatorPrinterModelPrinter *pPrinter = g_ptr_array_index (lShown, i);
+        guint nJobs = g_hash_table_size (pPrinter->pJobs);
+        gint nCompare = 1;
+
+        while (nPos < lItems->len)
+        {
+            nCompare = g_strcmp0 (getLabel (g_ptr_array_index (lItems, nPos)), pPrinter->sName);
+
+            if (nCompare >= 0)
+            {
+                break;
+            }
+
+            // A printer that no longer has jobs, or was pushed out by busier ones
+            g_ptr_array_remove_index (lItems, nPos);
+            g_menu_model_items_changed (G_MENU_MODEL (self), nPos, 1, 0);
+        }
+
+        GHashTable *pItem = createItem (pPrinter, nJobs, pProgress);
+
+        if (nPos < lItems->len && nCompare == 0)
+        {
+            if (itemsEqual (g_ptr_array_index (lItems, nPos), pItem))
+            {
+                g_hash_table_unref (pItem);
+            }
+            else
+            {
+                g_hash_table_unref (g_ptr_array_index (lItems, nPos));
+                g_ptr_array_index (lItems, nPos) = pItem;
+                g_menu_model_items_changed (G_MENU_MODEL (self), nPos, 1, 1);
+            }
+        }
+        else
+        {
+            g_ptr_array_insert (lItems, nPos, pItem);
+            g_menu_model_items_changed (G_MENU_MODEL (self), nPos, 0, 1);
+        }
+
+        nPos++;
+    }
+
+    if (nPos < lItems->len)
+    {
+        guint nRemoved = lItems->len - nPos;
+        g_ptr_array_remove_range (lItems, nPos, nRemoved);
+        g_menu_model_items_changed (G_MENU_MODEL (self), nPos, nRemoved, 0);
+    }
+
+    // The "More printers" item always follows the printers
+    GHashTable *pMore = nHidden > 0 ? createMoreItem (nHidden) : NULL;
+
+    if (pMore != NULL && self->pPrivate->pMore != NULL && itemsEqual (pMore, self->pPrivate->pMore))
+    {
+        g_hash_table_unref (pMore);
+    }
+    else if (pMore != NULL || self->pPrivate->pMore != NULL)
+    {
+        guint nRemoved = self->pPrivate->pMore != NULL ? 1 : 0;
+        g_clear_pointer (&self->pPrivate->pMore, g_hash_table_unref);
+        self->pPrivate->pMore = pMore;
+        g_menu_model_items_changed (G_MENU_MODEL (self), lItems->len, nRemoved, pMore != NULL ? 1 : 0);
+    }
+
+    g_ptr_array_unref (lShown);
+
+    return lItems->len > 0;
+}
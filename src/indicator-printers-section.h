@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_PRINTERS_SECTION_H__
+#define __INDICATOR_PRINTERS_SECTION_H__
+
+#include <gio/gio.h>
+#include "indicator-printer-model.h"
+#include "indicator-job-progress.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_PRINTERS_SECTION(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_PRINTERS_SECTION, IndicatorPrintersSection))
+#define INDICATOR_TYPE_PRINTERS_SECTION (indicator_printers_section_get_type ())
+#define INDICATOR_IS_PRINTERS_SECTION(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_PRINTERS_SECTION))
+
+typedef struct _IndicatorPrintersSection IndicatorPrintersSection;
+typedef struct _IndicatorPrintersSectionClass IndicatorPrintersSectionClass;
+typedef struct _IndicatorPrintersSectionPrivate IndicatorPrintersSectionPrivate;
+
+struct _IndicatorPrintersSection
+{
+    GMenuModel parent;
+    IndicatorPrintersSectionPrivate *pPrivate;
+};
+
+struct _IndicatorPrintersSectionClass
+{
+    GMenuModelClass parent_class;
+};
+
+GType indicator_printers_section_get_type (void);
+IndicatorPrintersSection *indicator_printers_section_new ();
+void indicator_printers_section_set_limit (IndicatorPrintersSection *self, guint nLimit);
+gboolean indicator_printers_section_update (IndicatorPrintersSection *self, IndicatorPrinterModel *pModel, IndicatorJobProgress *pProgress);
+
+G_END_DECLS
+
+#endif
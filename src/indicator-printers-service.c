@@ -24,19 +24,69 @@
 #include <gio/gio.h>
 #include "indicator-printers-service.h"
 #include "cups-notifier.h"
+#include "indicator-printers-stats.h"
 #include "indicator-printer-state-notifier.h"
 #include "spawn-printer-settings.h"
+#include "printer-query.h"
+#include "indicator-job-progress.h"
+#include "indicator-remote-server.h"
+#include "indicator-printer-model.h"
+#include "indicator-printers-section.h"
+#include "indicator-printers-variants.h"
 
 #define NOTIFY_LEASE_DURATION (24 * 60 * 60)
+// Renew once three quarters of the lease are over, so a failed renewal has time to be retried
+#define NOTIFY_RENEW_AFTER (NOTIFY_LEASE_DURATION * 3 / 4)
+#define SUBSCRIBE_BACKOFF_MIN 2
+#define SUBSCRIBE_BACKOFF_MAX 300
+// Seconds without the user's jobs and CUPS signals before going idle, if the settings schema is not installed
+#define IDLE_TIMEOUT 600
+// Printers shown before the "More printers" item, if the settings schema is not installed
+#define MAX_PRINTERS 10
+#define REBUILD_DELAY 100
+#define REBUILD_MAX_DELAY 1000
+#define SETTINGS_SCHEMA "org.ayatana.indicator.printers"
+
+// The events handled below, used if the settings schema is not installed
+static const gchar * const lDefaultEvents[] = {"printer-state-changed", "printer-stopped", "printer-added", "printer-deleted", "printer-modified", "printer-shutdown", "job-created", "job-state-changed", "job-progress", "job-completed", "server-started", "server-restarted", NULL};
+
+// While idle, a new job is the only thing worth waking up for
+static const gchar * const lIdleEvents[] = {"job-created", NULL};
+
+// The events that go to the per-job subscriptions if only the user's own jobs are followed
+static const gchar * const lJobEvents[] = {"job-state-changed", "job-progress", "job-completed", NULL};
 
 static guint m_nSignal = 0;
 
+enum
+{
+    PROP_0,
+    PROP_SIGNALS_RECEIVED,
+    PROP_REBUILDS_RUN,
+    PROP_WAKEUPS_PER_HOUR,
+    PROP_NAME_ACQUIRED_MS,
+    PROP_POPULATED_MS,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+
 enum
 {
     SECTION_HEADER = (1<<0),
     SECTION_PRINTERS = (1<<2)
 };
 
+// CREATING goes to ACTIVE, or to WAITING for a retry with backoff. A failed renewal goes back to CREATING.
+enum
+{
+    SUBSCRIPTION_NONE,
+    SUBSCRIPTION_CREATING,
+    SUBSCRIPTION_ACTIVE,
+    SUBSCRIPTION_RENEWING,
+    SUBSCRIPTION_WAITING
+};
+
 enum
 {
     PROFILE_PHONE,
@@ -57,48 +107,153 @@ struct ProfileMenuInfo
     guint nExportId;
 };
 
+// Shared with the bus filter, which can still run after it was removed
+typedef struct
+{
+    gint nRefs;
+    GMutex cMutex;
+    // NULL once the service is disposed
+    IndicatorPrintersService *self;
+} BusFilter;
+
 struct _IndicatorPrintersServicePrivate
 {
     GCancellable *pCancellable;
+    IndicatorPrinterModel *pModel;
     IndicatorPrinterStateNotifier *pStateNotifier;
     CupsNotifier *pCupsNotifier;
+    // Shared with the state notifier
+    IndicatorCupsConnection *pCupsConnection;
+    IndicatorDestCache *pDestCache;
+    IndicatorJobProgress *pJobProgress;
+    // IndicatorRemoteServer, one per configured server besides the default one
+    GPtrArray *lRemoteServers;
+    // Polls the default server while it cannot be subscribed to, NULL otherwise
+    IndicatorRemoteServer *pPoller;
     guint nOwnId;
     guint nActionsId;
     GDBusConnection *pConnection;
     gboolean bMenusBuilt;
     int nSubscriptionId;
+    guint nSubscriptionState;
+    gboolean bSubscribePending;
+    // Renews the subscription, or retries to create it after a failure
+    guint nSubscriptionTimer;
+    // Seconds before the next attempt to subscribe, 0 after a success
+    guint nSubscribeBackoff;
+    GSettings *pSettings;
+    // Ids of the user's jobs that have a job subscription
+    GHashTable *pWatchedJobs;
+    // Job id -> name from JobCreated, while the owner is looked up
+    GHashTable *pCreatedJobs;
     struct ProfileMenuInfo lMenus[N_PROFILES];
+    // Shared by the submenus of all profiles
+    IndicatorPrintersSection *pPrintersSection;
     GSimpleActionGroup *pActionGroup;
     GSimpleAction *pHeaderAction;
     GSimpleAction *pPrinterAction;
-    GMenu *pPrintersSection;
     gboolean bVisible;
+    // Unique name -> MenuWatcher, for the clients that subscribed to a menu group
+    GHashTable *pMenuWatchers;
+    // The printers section missed updates while nobody watched it
+    gboolean bSectionStale;
+    // Printers the section shows, grows by one page with each "More printers"
+    guint nShownPrinters;
+    guint nRebuildsSkipped;
+    gboolean bQueryRunning;
+    gboolean bQueryPending;
+    // Model updates received while the query runs, replayed onto its older snapshot
+    GPtrArray *lQueuedUpdates;
+    guint nRebuildTimer;
+    guint nDirtySections;
+    // Signals merged into the pending rebuild
+    guint nDirtySignals;
+    gint64 nFirstDirty;
+    guint nSignalsReceived;
+    guint nRebuildsRun;
+    guint nWakeups;
+    // Interned signal name -> number received
+    GHashTable *pSignalCounts;
+    guint nRenewals;
+    guint nSubscriptionFailures;
+    IndicatorPrintersStats *pStats;
+    // Set from the bus filter thread as well, only changed with g_atomic_int_set ()
+    gint bIdle;
+    guint nIdleTimer;
+    gint64 nLastSignal;
+    guint nFilterId;
+    BusFilter *pFilter;
+    gint64 nStarted;
+    gint64 nNameAcquired;
+    gint64 nFirstPopulated;
 };
 
 typedef IndicatorPrintersServicePrivate priv_t;
 
+typedef enum
+{
+    MODEL_UPDATE_PRINTER,
+    MODEL_UPDATE_PRINTER_DELETED,
+    MODEL_UPDATE_JOB
+} ModelUpdateType;
+
+typedef struct
+{
+    ModelUpdateType nType;
+    // NULL for a job that was only watched, which comes without its queue
+    gchar *sPrinter;
+    guint nPrinterState;
+    gchar *sReasons;
+    guint nJobId;
+    guint nJobState;
+    gboolean bCreated;
+} ModelUpdate;
+
+typedef struct
+{
+    // Menu groups the client has started and not yet ended
+    guint nGroups;
+    guint nWatchId;
+} MenuWatcher;
+
+typedef struct
+{
+    IndicatorPrintersService *self;
+    gchar *sSender;
+    // Positive for Start, negative for End
+    gint nGroups;
+} MenuSubscription;
+
 G_DEFINE_TYPE_WITH_PRIVATE (IndicatorPrintersService, indicator_printers_service, G_TYPE_OBJECT)
 
 static void rebuildNow (IndicatorPrintersService *self, guint nSections);
+static void resync (IndicatorPrintersService *self);
+static void scheduleRebuild (IndicatorPrintersService *self, guint nSections);
 
-static void unexport (IndicatorPrintersService *self)
+static void subscribe (IndicatorPrintersService *self);
+static void resubscribe (IndicatorPrintersService *self);
+static void leaveIdle (IndicatorPrintersService *self);
+static void watchJob (IndicatorPrintersService *self, guint nJobId);
+static void watchJobs (IndicatorPrintersService *self);
+
+// Does not wait for cupsd, the old subscription only has to stop sending signals eventually
+static void cancelSubscription (IndicatorPrintersService *self)
 {
     if (self->pPrivate->nSubscriptionId > 0)
     {
-        ipp_t *pRequest = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
-        ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
-        ippAddInteger (pRequest, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", self->pPrivate->nSubscriptionId);
-        ipp_t *pResponse = cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/");
-
-        if (!pResponse || cupsLastError () != IPP_OK)
-        {
-            g_warning ("Error subscribing to CUPS notifications: %s\n", cupsLastErrorString ());
-
-            return;
-        }
+        printer_query_cancel_subscription_async (self->pPrivate->pCupsConnection, self->pPrivate->nSubscriptionId, NULL, NULL, NULL);
+        self->pPrivate->nSubscriptionId = 0;
+    }
 
-        ippDelete (pResponse);
+    if (self->pPrivate->nSubscriptionState == SUBSCRIPTION_ACTIVE)
+    {
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_NONE;
     }
+}
+
+static void unexport (IndicatorPrintersService *self)
+{
+    cancelSubscription (self);
 
     // Unexport the menus
     for (int i = 0; i < N_PROFILES; ++i)
@@ -118,391 +273,1627 @@ static void unexport (IndicatorPrintersService *self)
         g_dbus_connection_unexport_action_group (self->pPrivate->pConnection, self->pPrivate->nActionsId);
         self->pPrivate->nActionsId = 0;
     }
+
+    // Unexport the statistics
+    if (self->pPrivate->pStats != NULL && g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (self->pPrivate->pStats)) != NULL)
+    {
+        g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self->pPrivate->pStats));
+    }
 }
 
-static void onPrinterStateChanged (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, IndicatorPrintersService *self)
+static void freeModelUpdate (gpointer pData)
 {
-    rebuildNow(self, SECTION_PRINTERS | SECTION_HEADER);
+    ModelUpdate *pUpdate = pData;
+
+    g_free (pUpdate->sPrinter);
+    g_free (pUpdate->sReasons);
+    g_slice_free (ModelUpdate, pUpdate);
 }
 
-static void onJobChanged (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, guint nJobId, guint nJobState, const gchar *sJobStateReasons, const gchar *sJobName, guint nJobImpressionsCompleted, IndicatorPrintersService *self)
+// The running query answers with the state before this update, which would otherwise be lost when the answer replaces the model
+static void queueModelUpdate (IndicatorPrintersService *self, ModelUpdateType nType, const gchar *sPrinter, guint nPrinterState, const gchar *sReasons, guint nJobId, guint nJobState, gboolean bCreated)
 {
-    rebuildNow(self, SECTION_PRINTERS | SECTION_HEADER);
+    if (!self->pPrivate->bQueryRunning)
+    {
+        return;
+    }
+
+    ModelUpdate *pUpdate = g_slice_new0 (ModelUpdate);
+    pUpdate->nType = nType;
+    pUpdate->sPrinter = g_strdup (sPrinter);
+    pUpdate->nPrinterState = nPrinterState;
+    pUpdate->sReasons = g_strdup (sReasons);
+    pUpdate->nJobId = nJobId;
+    pUpdate->nJobState = nJobState;
+    pUpdate->bCreated = bCreated;
+    g_ptr_array_add (self->pPrivate->lQueuedUpdates, pUpdate);
 }
 
-static void onDispose (GObject *pObject)
+static void onPrinterStateChanged (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, IndicatorPrintersService *self)
 {
-    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pObject);
+    self->pPrivate->nSignalsReceived++;
 
-    unexport (self);
+    indicator_dest_cache_update_printer (self->pPrivate->pDestCache, sPrinterName, nPrinterState, sPrinterStateReasons);
+    queueModelUpdate (self, MODEL_UPDATE_PRINTER, sPrinterName, nPrinterState, sPrinterStateReasons, 0, 0, FALSE);
 
-    if (self->pPrivate->pCancellable != NULL)
+    if (indicator_printer_model_update_printer (self->pPrivate->pModel, sPrinterName, nPrinterState, sPrinterStateReasons))
     {
-        g_cancellable_cancel (self->pPrivate->pCancellable);
-        g_clear_object (&self->pPrivate->pCancellable);
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
     }
+}
 
-    if (self->pPrivate->pCupsNotifier)
+static void onPrinterDeleted (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, IndicatorPrintersService *self)
+{
+    self->pPrivate->nSignalsReceived++;
+    indicator_dest_cache_invalidate (self->pPrivate->pDestCache);
+    queueModelUpdate (self, MODEL_UPDATE_PRINTER_DELETED, sPrinterName, 0, NULL, 0, 0, FALSE);
+
+    if (indicator_printer_model_remove_printer (self->pPrivate->pModel, sPrinterName))
     {
-        g_object_disconnect (self->pPrivate->pCupsNotifier, "any-signal", onJobChanged, self, "any-signal", onPrinterStateChanged, self, NULL);
-        g_clear_object (&self->pPrivate->pCupsNotifier);
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
     }
-
-    g_object_unref (self->pPrivate->pStateNotifier);
-    g_clear_object (&self->pPrivate->pPrinterAction);
-    g_clear_object (&self->pPrivate->pHeaderAction);
-    g_clear_object (&self->pPrivate->pActionGroup);
-    g_clear_object (&self->pPrivate->pConnection);
-
-    G_OBJECT_CLASS (indicator_printers_service_parent_class)->dispose (pObject);
 }
 
-static void indicator_printers_service_class_init (IndicatorPrintersServiceClass *klass)
+static void onPrinterAdded (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, IndicatorPrintersService *self)
 {
-    GObjectClass *object_class = G_OBJECT_CLASS (klass);
-    object_class->dispose = onDispose;
-    m_nSignal = g_signal_new ("name-lost", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET (IndicatorPrintersServiceClass, pNameLost), NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+    self->pPrivate->nSignalsReceived++;
+    indicator_dest_cache_invalidate (self->pPrivate->pDestCache);
+    resync (self);
 }
 
-static int createSubscription ()
+// The state of a modified queue comes with its state signals, only the destination list is stale
+static void onPrinterModified (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, IndicatorPrintersService *self)
 {
-    int nId = 0;
+    self->pPrivate->nSignalsReceived++;
+    indicator_dest_cache_invalidate (self->pPrivate->pDestCache);
+}
 
-    ipp_t *pRequest = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
-    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
-    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-events", NULL, "all");
-    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
-    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", NOTIFY_LEASE_DURATION);
-    ipp_t *pResponse = cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/");
+static void onJobOwnerFound (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    guint nJobId;
+    gboolean bMine = printer_query_job_owner_finish (pResult, &nJobId, &pError);
 
-    if (!pResponse || cupsLastError () != IPP_OK)
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
     {
-        g_warning ("Error subscribing to CUPS notifications: %s\n", cupsLastErrorString ());
+        g_error_free (pError);
 
-        return 0;
+        return;
     }
 
-    ipp_attribute_t *pAttribute = ippFindAttribute (pResponse, "notify-subscription-id", IPP_TAG_INTEGER);
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    gchar *sJobName = g_strdup (g_hash_table_lookup (self->pPrivate->pCreatedJobs, GUINT_TO_POINTER (nJobId)));
+    g_hash_table_remove (self->pPrivate->pCreatedJobs, GUINT_TO_POINTER (nJobId));
 
-    if (pAttribute)
-    {
-        nId = ippGetInteger (pAttribute, 0);
-    }
-    else
+    if (pError)
     {
-        g_warning ("ipp-create-printer-subscription response doesn't contain subscription id.\n");
+        // Let a full query sort the job out
+        g_warning ("%s", pError->message);
+        g_error_free (pError);
+        resync (self);
     }
-
-    ippDelete (pResponse);
-
-    return nId;
-}
-
-static gboolean renewSubscriptionTimeout (gpointer pData)
-{
-    int *nSubscriptionId = pData;
-    gboolean bRenewed = TRUE;
-    ipp_t *pRequest = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
-    ippAddInteger (pRequest, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", *nSubscriptionId);
-    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
-    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
-    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", NOTIFY_LEASE_DURATION);
-    ipp_t *pResponse = cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/");
-
-    if (!pResponse || cupsLastError () != IPP_OK)
+    else if (indicator_printer_model_set_job_owner (self->pPrivate->pModel, nJobId, bMine))
     {
-        g_warning ("Error renewing CUPS subscription %d: %s\n", *nSubscriptionId, cupsLastErrorString ());
-        bRenewed = FALSE;
+        // The progress of the user's jobs is followed from here on
+        indicator_job_progress_update (self->pPrivate->pJobProgress, indicator_printer_model_get_own_job (self->pPrivate->pModel, nJobId), nJobId, sJobName, 0);
+        watchJob (self, nJobId);
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
     }
-    else
+    else if (!bMine)
     {
-        ippDelete (pResponse);
-    }
+        indicator_job_progress_remove (self->pPrivate->pJobProgress, nJobId);
 
-    if (*nSubscriptionId <= 0 || !bRenewed)
-    {
-        *nSubscriptionId = createSubscription ();
+        if (self->pPrivate->pSettings != NULL && g_settings_get_boolean (self->pPrivate->pSettings, "own-jobs-only"))
+        {
+            // No further signals will arrive for this job
+            indicator_printer_model_forget_job (self->pPrivate->pModel, nJobId);
+        }
     }
 
-    return TRUE;
+    g_free (sJobName);
 }
 
-static GVariant *createHeaderState (IndicatorPrintersService *self)
+// Applies a job update to the model, and looks up whatever the update leaves unknown
+static IndicatorPrinterModelResult applyJobUpdate (IndicatorPrintersService *self, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, guint nJobId, guint nJobState, gboolean bCreated, gboolean *bChanged)
 {
-    GVariantBuilder b;
-
-    g_variant_builder_init (&b, G_VARIANT_TYPE ("a{sv}"));
-    g_variant_builder_add (&b, "{sv}", "title", g_variant_new_string (_("Printers")));
-    g_variant_builder_add (&b, "{sv}", "tooltip", g_variant_new_string (_("Show print jobs and queues")));
-    g_variant_builder_add (&b, "{sv}", "visible", g_variant_new_boolean (TRUE));
+    *bChanged = sPrinterName != NULL && indicator_printer_model_update_printer (self->pPrivate->pModel, sPrinterName, nPrinterState, sPrinterStateReasons);
+    IndicatorPrinterModelResult nResult = indicator_printer_model_update_job (self->pPrivate->pModel, sPrinterName, nJobId, nJobState, bCreated);
 
-    if (self->pPrivate->bVisible)
+    switch (nResult)
     {
-        GIcon *pIcon = g_themed_icon_new_with_default_fallbacks ("printer-symbolic");
-        g_variant_builder_add (&b, "{sv}", "accessible-desc", g_variant_new_string (_("Printers")));
+        case INDICATOR_PRINTER_MODEL_CHANGED:
+        {
+            *bChanged = TRUE;
 
-        if (pIcon)
+            break;
+        }
+        case INDICATOR_PRINTER_MODEL_OWNER_UNKNOWN:
         {
-            GVariant *pSerialized = g_icon_serialize (pIcon);
+            printer_query_job_owner_async (self->pPrivate->pCupsConnection, nJobId, self->pPrivate->pCancellable, onJobOwnerFound, self);
 
-            if (pSerialized != NULL)
-            {
-                g_variant_builder_add (&b, "{sv}", "icon", pSerialized);
-                g_variant_unref (pSerialized);
-            }
+            break;
+        }
+        case INDICATOR_PRINTER_MODEL_GAP:
+        {
+            g_debug ("Missed signals for job %u, resynchronising", nJobId);
+            resync (self);
 
-            g_object_unref (pIcon);
+            break;
+        }
+        case INDICATOR_PRINTER_MODEL_UNCHANGED:
+        {
+            break;
         }
     }
 
-    return g_variant_builder_end (&b);
-}
-
-static void onPrinterItemActivated (GSimpleAction *pAction, GVariant *pVariant, gpointer pData)
-{
-    const gchar *sPrinter = g_variant_get_string(pVariant, NULL);
-    spawn_printer_settings_with_args ("--show-jobs %s", sPrinter);
+    return nResult;
 }
 
-static void initActions (IndicatorPrintersService *self)
+static IndicatorPrinterModelResult updateJob (IndicatorPrintersService *self, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, guint nJobId, guint nJobState, gboolean bCreated)
 {
-    self->pPrivate->pActionGroup = g_simple_action_group_new ();
-
-    GSimpleAction *pAction = g_simple_action_new_stateful ("_header", NULL, createHeaderState (self));
-    g_action_map_add_action (G_ACTION_MAP (self->pPrivate->pActionGroup), G_ACTION (pAction));
-    self->pPrivate->pHeaderAction = pAction;
-
-    pAction = g_simple_action_new("printer", G_VARIANT_TYPE_STRING);
-    g_action_map_add_action (G_ACTION_MAP (self->pPrivate->pActionGroup), G_ACTION (pAction));
-    self->pPrivate->pPrinterAction = pAction;
-    g_signal_connect(pAction, "activate", G_CALLBACK(onPrinterItemActivated), self);
+    gboolean bChanged;
 
-    rebuildNow (self, SECTION_HEADER);
-}
+    self->pPrivate->nSignalsReceived++;
+    queueModelUpdate (self, MODEL_UPDATE_JOB, sPrinterName, nPrinterState, sPrinterStateReasons, nJobId, nJobState, bCreated);
 
-static GMenuModel *createPrintersSection (IndicatorPrintersService *self)
-{
-    self->pPrivate->pPrintersSection = g_menu_new ();
-    self->pPrivate->bVisible = FALSE;
-    cups_dest_t *lDests;
-    gint nDests = cupsGetDests (&lDests);
+    IndicatorPrinterModelResult nResult = applyJobUpdate (self, sPrinterName, nPrinterState, sPrinterStateReasons, nJobId, nJobState, bCreated, &bChanged);
 
-    for (gint i = 0; i < nDests; i++)
+    // cupsd drops the job subscription together with the job
+    if (nJobState >= IPP_JOB_CANCELED)
     {
-        const gchar *sOption = cupsGetOption ("printer-state", lDests[i].num_options, lDests[i].options);
-
-        if (sOption != NULL)
-        {
-            cups_job_t *lJobs;
-            gint nJobs = cupsGetJobs (&lJobs, lDests[i].name, 1, CUPS_WHICHJOBS_ACTIVE);
-            cupsFreeJobs (nJobs, lJobs);
-
-            if (nJobs < 0)
-            {
-                g_warning ("printer '%s' does not exist\n", lDests[i].name);
-            }
-            else if (nJobs != 0)
-            {
-                GMenuItem *pItem = g_menu_item_new (lDests[i].name, NULL);
-                g_menu_item_set_attribute (pItem, "x-ayatana-type", "s", "org.ayatana.indicator.basic");
-                g_menu_item_set_action_and_target_value(pItem, "indicator.printer", g_variant_new_string (lDests[i].name));
-                GIcon *pIcon = g_themed_icon_new_with_default_fallbacks ("printer");
-                GVariant *pSerialized = g_icon_serialize(pIcon);
-
-                if (pSerialized != NULL)
-                {
-                    g_menu_item_set_attribute_value(pItem, G_MENU_ATTRIBUTE_ICON, pSerialized);
-                    g_variant_unref(pSerialized);
-                }
-
-                g_object_unref(pIcon);
-
-                gint nState = atoi (sOption);
-
-                switch (nState)
-                {
-                    case IPP_PRINTER_STOPPED:
-                    {
-                        g_menu_item_set_attribute (pItem, "x-ayatana-secondary-text", "s", _("Paused"));
-
-                        break;
-                    }
-                    case IPP_PRINTER_PROCESSING:
-                    {
-                        g_menu_item_set_attribute (pItem, "x-ayatana-secondary-count", "i", nJobs);
-
-                        break;
-                    }
-                }
-
-                g_menu_append_item(self->pPrivate->pPrintersSection, pItem);
-                g_object_unref(pItem);
-                self->pPrivate->bVisible = TRUE;
-            }
-        }
+        g_hash_table_remove (self->pPrivate->pWatchedJobs, GUINT_TO_POINTER (nJobId));
     }
 
-    cupsFreeDests (nDests, lDests);
+    if (bChanged)
+    {
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+    }
 
-    return G_MENU_MODEL (self->pPrivate->pPrintersSection);
+    return nResult;
 }
 
-static void createMenu (IndicatorPrintersService *self, int nProfile)
+/*
+ * The tracker throttles the impressions, its "changed" signal rebuilds the printer. Only the
+ * user's jobs are shown, so the jobs of other users are not tracked: their totals would be
+ * looked up and their impressions would rebuild the menu for nothing. Runs after updateJob (),
+ * with the job's owner and queue up to date in the model.
+ */
+static void updateJobProgress (IndicatorPrintersService *self, guint nJobId, guint nJobState, const gchar *sJobName, guint nJobImpressionsCompleted)
 {
-    g_assert (0 <= nProfile && nProfile < N_PROFILES);
-    g_assert (self->pPrivate->lMenus[nProfile].pMenu == NULL);
+    const gchar *sPrinter = nJobState < IPP_JOB_CANCELED ? indicator_printer_model_get_own_job (self->pPrivate->pModel, nJobId) : NULL;
 
-    GMenuModel *lSections[16];
-    guint nSection = 0;
-
-    // Build the sections
-    switch (nProfile)
+    if (sPrinter != NULL)
     {
-        case PROFILE_PHONE:
-        case PROFILE_DESKTOP:
-        {
-            lSections[nSection++] = createPrintersSection (self);
-
-            break;
-        }
-
-        break;
+        indicator_job_progress_update (self->pPrivate->pJobProgress, sPrinter, nJobId, sJobName, nJobImpressionsCompleted);
     }
-
-    // Add sections to the submenu
-    GMenu *pSubmenu = g_menu_new ();
-
-    for (guint i = 0; i < nSection; ++i)
+    else
     {
-        g_menu_append_section (pSubmenu, NULL, lSections[i]);
-        g_object_unref (lSections[i]);
+        indicator_job_progress_remove (self->pPrivate->pJobProgress, nJobId);
     }
-
-    // Add submenu to the header
-    GMenuItem *pHeader = g_menu_item_new (NULL, "indicator._header");
-    g_menu_item_set_attribute (pHeader, "x-ayatana-type", "s", "org.ayatana.indicator.root");
-    g_menu_item_set_submenu (pHeader, G_MENU_MODEL (pSubmenu));
-    g_object_unref (pSubmenu);
-
-    // Add header to the menu
-    GMenu *pMenu = g_menu_new ();
-    g_menu_append_item (pMenu, pHeader);
-    g_object_unref (pHeader);
-
-    self->pPrivate->lMenus[nProfile].pMenu = pMenu;
-    self->pPrivate->lMenus[nProfile].pSubmenu = pSubmenu;
 }
 
-static void onBusAcquired (GDBusConnection *pConnection, const gchar *sName, gpointer pSelf)
+static void onJobProgressChanged (IndicatorJobProgress *pProgress, const gchar *sPrinter, IndicatorPrintersService *self)
 {
-    g_debug ("bus acquired: %s", sName);
+    scheduleRebuild (self, SECTION_PRINTERS);
+}
 
-    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pSelf);
-    guint nId;
-    GError *pError = NULL;
-    GString *pPath = g_string_new (NULL);
-    self->pPrivate->pConnection = (GDBusConnection*)g_object_ref (G_OBJECT (pConnection));
+static void onJobCreated (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, guint nJobId, guint nJobState, const gchar *sJobStateReasons, const gchar *sJobName, guint nJobImpressionsCompleted, IndicatorPrintersService *self)
+{
+    leaveIdle (self);
 
-    // Export the actions
-    if ((nId = g_dbus_connection_export_action_group (pConnection, INDICATOR_PRINTERS_DBUS_OBJECT_PATH, G_ACTION_GROUP (self->pPrivate->pActionGroup), &pError)))
+    if (updateJob (self, sPrinterName, nPrinterState, sPrinterStateReasons, nJobId, nJobState, TRUE) == INDICATOR_PRINTER_MODEL_OWNER_UNKNOWN)
     {
-        self->pPrivate->nActionsId = nId;
+        // Tracked by onJobOwnerFound () if the job turns out to be the user's
+        g_hash_table_insert (self->pPrivate->pCreatedJobs, GUINT_TO_POINTER (nJobId), g_strdup (sJobName));
     }
     else
     {
-        g_warning ("cannot export action group: %s", pError->message);
-        g_clear_error (&pError);
-    }
-
-    // Export the menus
-    for (gint nProfile = 0; nProfile < N_PROFILES; ++nProfile)
-    {
-        struct ProfileMenuInfo *pInfo = &self->pPrivate->lMenus[nProfile];
-
-        g_string_printf (pPath, "%s/%s", INDICATOR_PRINTERS_DBUS_OBJECT_PATH, lMenuNames[nProfile]);
-
-        if ((nId = g_dbus_connection_export_menu_model (pConnection, pPath->str, G_MENU_MODEL (pInfo->pMenu), &pError)))
-        {
-            pInfo->nExportId = nId;
-        }
-        else
-        {
-            g_warning ("cannot export %s menu: %s", pPath->str, pError->message);
-            g_clear_error (&pError);
-        }
+        updateJobProgress (self, nJobId, nJobState, sJobName, nJobImpressionsCompleted);
     }
+}
 
-    g_string_free (pPath, TRUE);
+static void onJobChanged (CupsNotifier *pNotifier, const gchar *sText, const gchar *sPrinterUri, const gchar *sPrinterName, guint nPrinterState, const gchar *sPrinterStateReasons, gboolean bPrinterIsAcceptingJobs, guint nJobId, guint nJobState, const gchar *sJobStateReasons, const gchar *sJobName, guint nJobImpressionsCompleted, IndicatorPrintersService *self)
+{
+    updateJob (self, sPrinterName, nPrinterState, sPrinterStateReasons, nJobId, nJobState, FALSE);
+    updateJobProgress (self, nJobId, nJobState, sJobName, nJobImpressionsCompleted);
 }
 
-static void onNameLost (GDBusConnection *pConnection, const gchar *sName, gpointer pSelf)
+// cupsd may have lost the subscription, a new one is followed by a resync in onSubscribed ()
+static void onServerRestarted (CupsNotifier *pNotifier, const gchar *sText, IndicatorPrintersService *self)
 {
-    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pSelf);
+    self->pPrivate->nSignalsReceived++;
+    self->pPrivate->nSubscribeBackoff = 0;
+    indicator_dest_cache_invalidate (self->pPrivate->pDestCache);
+    resubscribe (self);
+}
 
-    g_debug ("%s %s name lost %s", G_STRLOC, G_STRFUNC, sName);
+// Every signal of the subscription wakes the service, whether it is handled or not
+static void onNotifierSignal (GDBusProxy *pProxy, const gchar *sSender, const gchar *sSignal, GVariant *pParameters, IndicatorPrintersService *self)
+{
+    self->pPrivate->nWakeups++;
+    self->pPrivate->nLastSignal = g_get_monotonic_time ();
 
-    unexport (self);
+    const gchar *sName = g_intern_string (sSignal);
+    guint nCount = GPOINTER_TO_UINT (g_hash_table_lookup (self->pPrivate->pSignalCounts, sName));
+    g_hash_table_insert (self->pPrivate->pSignalCounts, (gpointer) sName, GUINT_TO_POINTER (nCount + 1));
 }
 
-static void indicator_printers_service_init (IndicatorPrintersService *self)
+static gboolean onGetStats (IndicatorPrintersStats *pStats, GDBusMethodInvocation *pInvocation, IndicatorPrintersService *self)
 {
-    self->pPrivate = indicator_printers_service_get_instance_private (self);
-    self->pPrivate->pCancellable = g_cancellable_new ();
+    GVariantBuilder cBuilder;
+    GVariantBuilder cSignals;
+    GVariantBuilder cServers;
+    GHashTableIter cIter;
+    gpointer pName;
+    gpointer pCount;
+    guint64 nRequests;
+    guint nReconnects;
+    guint nNotifiedPrinters = 0;
+    guint64 nNotifiedBytes = 0;
+    guint nPrinters;
+    guint nJobs;
+    guint nCacheHits;
+    guint nCacheMisses;
+    guint nProgressUpdates;
+    guint nProgressPublished;
+
+    g_variant_builder_init (&cSignals, G_VARIANT_TYPE ("a{su}"));
+    g_hash_table_iter_init (&cIter, self->pPrivate->pSignalCounts);
+
+    while (g_hash_table_iter_next (&cIter, &pName, &pCount))
+    {
+        g_variant_builder_add (&cSignals, "{su}", pName, GPOINTER_TO_UINT (pCount));
+    }
 
-    GError *pError = NULL;
-    self->pPrivate->nSubscriptionId = createSubscription ();
-    g_timeout_add_seconds (NOTIFY_LEASE_DURATION - 60, renewSubscriptionTimeout, &self->pPrivate->nSubscriptionId);
-    self->pPrivate->pCupsNotifier = cups_notifier_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM, 0, NULL, CUPS_DBUS_PATH, NULL, &pError);
+    g_object_get (self->pPrivate->pCupsConnection, "requests", &nRequests, "reconnects", &nReconnects, NULL);
 
-    if (pError)
+    if (self->pPrivate->pStateNotifier)
     {
-        g_error ("Error creating cups notify handler: %s", pError->message);
-        g_error_free (pError);
+        g_object_get (self->pPrivate->pStateNotifier, "notified-printers", &nNotifiedPrinters, "notified-bytes", &nNotifiedBytes, NULL);
     }
 
-    g_object_connect (self->pPrivate->pCupsNotifier, "signal::job-created", onJobChanged, self, "signal::job-state", onJobChanged, self, "signal::job-completed", onJobChanged, self, "signal::printer-state-changed", onPrinterStateChanged, self, NULL);
-    self->pPrivate->pStateNotifier = g_object_new (INDICATOR_TYPE_PRINTER_STATE_NOTIFIER, "cups-notifier", self->pPrivate->pCupsNotifier, NULL);
-    initActions (self);
+    indicator_printer_model_get_size (self->pPrivate->pModel, &nPrinters, &nJobs);
+    g_object_get (self->pPrivate->pDestCache, "hits", &nCacheHits, "misses", &nCacheMisses, NULL);
+    g_object_get (self->pPrivate->pJobProgress, "updates", &nProgressUpdates, "published", &nProgressPublished, NULL);
+    g_variant_builder_init (&cServers, G_VARIANT_TYPE ("a{s(uuu)}"));
 
-    for (gint nProfile = 0; nProfile < N_PROFILES; ++nProfile)
+    for (guint i = 0; i < self->pPrivate->lRemoteServers->len; i++)
     {
-        createMenu (self, nProfile);
+        IndicatorRemoteServer *pServer = g_ptr_array_index (self->pPrivate->lRemoteServers, i);
+        guint nPolls;
+        guint nFailures;
+        guint nFullQueries;
+        g_object_get (pServer, "polls", &nPolls, "failures", &nFailures, "full-queries", &nFullQueries, NULL);
+        g_variant_builder_add (&cServers, "{s(uuu)}", indicator_remote_server_get_name (pServer), nPolls, nFailures, nFullQueries);
     }
 
-    self->pPrivate->bMenusBuilt = TRUE;
-    self->pPrivate->nOwnId = g_bus_own_name (G_BUS_TYPE_SESSION, INDICATOR_PRINTERS_DBUS_NAME, G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT, onBusAcquired, NULL, onNameLost, self, NULL);
+    g_variant_builder_init (&cBuilder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&cBuilder, "{sv}", "idle", g_variant_new_boolean (g_atomic_int_get (&self->pPrivate->bIdle)));
+    g_variant_builder_add (&cBuilder, "{sv}", "signals-received", g_variant_new_uint32 (self->pPrivate->nSignalsReceived));
+    g_variant_builder_add (&cBuilder, "{sv}", "signals-by-type", g_variant_builder_end (&cSignals));
+    g_variant_builder_add (&cBuilder, "{sv}", "wakeups", g_variant_new_uint32 (self->pPrivate->nWakeups));
+    g_variant_builder_add (&cBuilder, "{sv}", "rebuilds-run", g_variant_new_uint32 (self->pPrivate->nRebuildsRun));
+    g_variant_builder_add (&cBuilder, "{sv}", "rebuilds-skipped", g_variant_new_uint32 (self->pPrivate->nRebuildsSkipped));
+    g_variant_builder_add (&cBuilder, "{sv}", "menu-watchers", g_variant_new_uint32 (g_hash_table_size (self->pPrivate->pMenuWatchers)));
+    g_variant_builder_add (&cBuilder, "{sv}", "ipp-requests", g_variant_new_uint64 (nRequests));
+    g_variant_builder_add (&cBuilder, "{sv}", "ipp-reconnects", g_variant_new_uint32 (nReconnects));
+    g_variant_builder_add (&cBuilder, "{sv}", "ipp-latency-bounds", indicator_cups_connection_get_latency_bounds ());
+    g_variant_builder_add (&cBuilder, "{sv}", "ipp-latency", indicator_cups_connection_get_latencies (self->pPrivate->pCupsConnection));
+    g_variant_builder_add (&cBuilder, "{sv}", "subscription-id", g_variant_new_int32 (self->pPrivate->nSubscriptionId));
+    g_variant_builder_add (&cBuilder, "{sv}", "subscription-renewals", g_variant_new_uint32 (self->pPrivate->nRenewals));
+    g_variant_builder_add (&cBuilder, "{sv}", "subscription-failures", g_variant_new_uint32 (self->pPrivate->nSubscriptionFailures));
+    g_variant_builder_add (&cBuilder, "{sv}", "notified-printers", g_variant_new_uint32 (nNotifiedPrinters));
+    g_variant_builder_add (&cBuilder, "{sv}", "notified-bytes", g_variant_new_uint64 (nNotifiedBytes));
+    g_variant_builder_add (&cBuilder, "{sv}", "model-printers", g_variant_new_uint32 (nPrinters));
+    g_variant_builder_add (&cBuilder, "{sv}", "model-jobs", g_variant_new_uint32 (nJobs));
+    g_variant_builder_add (&cBuilder, "{sv}", "dest-cache-hits", g_variant_new_uint32 (nCacheHits));
+    g_variant_builder_add (&cBuilder, "{sv}", "dest-cache-misses", g_variant_new_uint32 (nCacheMisses));
+    g_variant_builder_add (&cBuilder, "{sv}", "progress-updates", g_variant_new_uint32 (nProgressUpdates));
+    g_variant_builder_add (&cBuilder, "{sv}", "progress-published", g_variant_new_uint32 (nProgressPublished));
+    g_variant_builder_add (&cBuilder, "{sv}", "remote-servers", g_variant_builder_end (&cServers));
+    g_variant_builder_add (&cBuilder, "{sv}", "polling", g_variant_new_boolean (self->pPrivate->pPoller != NULL));
+    indicator_printers_stats_complete_get_stats (pStats, pInvocation, g_variant_builder_end (&cBuilder));
+
+    return TRUE;
 }
 
-IndicatorPrintersService *indicator_printers_service_new ()
+static void unrefBusFilter (gpointer pData)
 {
-    GObject *pObject = g_object_new (INDICATOR_TYPE_PRINTERS_SERVICE, NULL);
+    BusFilter *pFilter = pData;
 
-    return INDICATOR_PRINTERS_SERVICE (pObject);
+    if (g_atomic_int_dec_and_test (&pFilter->nRefs))
+    {
+        g_mutex_clear (&pFilter->cMutex);
+        g_free (pFilter);
+    }
 }
 
-static void rebuildSection (GMenu *pMenu, int nPos, GMenuModel *pSection)
+static void onDispose (GObject *pObject)
 {
-    g_menu_remove (pMenu, nPos);
-    g_menu_insert_section (pMenu, nPos, NULL, pSection);
-    g_object_unref (pSection);
-}
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pObject);
 
-static void rebuildNow (IndicatorPrintersService *self, guint nSections)
-{
-    struct ProfileMenuInfo *pinfo = &self->pPrivate->lMenus[PROFILE_DESKTOP];
+    unexport (self);
 
-    if (nSections & SECTION_HEADER)
+    if (self->pPrivate->nFilterId)
     {
-        g_simple_action_set_state (self->pPrivate->pHeaderAction, createHeaderState (self));
+        g_mutex_lock (&self->pPrivate->pFilter->cMutex);
+        self->pPrivate->pFilter->self = NULL;
+        g_mutex_unlock (&self->pPrivate->pFilter->cMutex);
+        g_dbus_connection_remove_filter (self->pPrivate->pConnection, self->pPrivate->nFilterId);
+        self->pPrivate->nFilterId = 0;
+        g_clear_pointer (&self->pPrivate->pFilter, unrefBusFilter);
     }
 
-    if (!self->pPrivate->bMenusBuilt)
+    if (self->pPrivate->nOwnId)
     {
-        return;
+        g_bus_unown_name (self->pPrivate->nOwnId);
+        self->pPrivate->nOwnId = 0;
+    }
+
+    if (self->pPrivate->pCancellable != NULL)
+    {
+        g_cancellable_cancel (self->pPrivate->pCancellable);
+        g_clear_object (&self->pPrivate->pCancellable);
+    }
+
+    if (self->pPrivate->pCupsNotifier)
+    {
+        g_signal_handlers_disconnect_by_data (self->pPrivate->pCupsNotifier, self);
+        g_clear_object (&self->pPrivate->pCupsNotifier);
     }
 
-    if (nSections & SECTION_PRINTERS)
+    if (self->pPrivate->nRebuildTimer)
+    {
+        g_source_remove (self->pPrivate->nRebuildTimer);
+        self->pPrivate->nRebuildTimer = 0;
+    }
+
+    if (self->pPrivate->nSubscriptionTimer)
+    {
+        g_source_remove (self->pPrivate->nSubscriptionTimer);
+        self->pPrivate->nSubscriptionTimer = 0;
+    }
+
+    if (self->pPrivate->nIdleTimer)
+    {
+        g_source_remove (self->pPrivate->nIdleTimer);
+        self->pPrivate->nIdleTimer = 0;
+    }
+
+    if (self->pPrivate->pSettings)
+    {
+        g_signal_handlers_disconnect_by_data (self->pPrivate->pSettings, self);
+        g_clear_object (&self->pPrivate->pSettings);
+    }
+
+    for (gint nProfile = 0; nProfile < N_PROFILES; ++nProfile)
+    {
+        g_clear_object (&self->pPrivate->lMenus[nProfile].pMenu);
+        self->pPrivate->lMenus[nProfile].pSubmenu = NULL;
+    }
+
+    g_clear_object (&self->pPrivate->pPrintersSection);
+    g_clear_pointer (&self->pPrivate->lRemoteServers, g_ptr_array_unref);
+
+    if (self->pPrivate->pPoller)
+    {
+        g_signal_handlers_disconnect_by_data (self->pPrivate->pPoller, self);
+        g_clear_object (&self->pPrivate->pPoller);
+    }
+
+    g_clear_pointer (&self->pPrivate->pWatchedJobs, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->pCreatedJobs, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->lQueuedUpdates, g_ptr_array_unref);
+    g_clear_pointer (&self->pPrivate->pSignalCounts, g_hash_table_destroy);
+    g_clear_pointer (&self->pPrivate->pMenuWatchers, g_hash_table_destroy);
+    g_clear_object (&self->pPrivate->pStats);
+    g_clear_object (&self->pPrivate->pModel);
+    g_clear_object (&self->pPrivate->pCupsConnection);
+    g_clear_object (&self->pPrivate->pDestCache);
+
+    if (self->pPrivate->pJobProgress)
+    {
+        g_signal_handlers_disconnect_by_data (self->pPrivate->pJobProgress, self);
+        g_clear_object (&self->pPrivate->pJobProgress);
+    }
+
+    g_clear_object (&self->pPrivate->pStateNotifier);
+    g_clear_object (&self->pPrivate->pPrinterAction);
+    g_clear_object (&self->pPrivate->pHeaderAction);
+    g_clear_object (&self->pPrivate->pActionGroup);
+    g_clear_object (&self->pPrivate->pConnection);
+
+    G_OBJECT_CLASS (indicator_printers_service_parent_class)->dispose (pObject);
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pObject);
+
+    switch (nProperty)
+    {
+        case PROP_SIGNALS_RECEIVED:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nSignalsReceived);
+
+            break;
+        }
+        case PROP_REBUILDS_RUN:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nRebuildsRun);
+
+            break;
+        }
+        case PROP_WAKEUPS_PER_HOUR:
+        {
+            gint64 nSeconds = MAX ((g_get_monotonic_time () - self->pPrivate->nStarted) / G_USEC_PER_SEC, 1);
+            g_value_set_uint (pValue, MIN ((gint64) self->pPrivate->nWakeups * 3600 / nSeconds, G_MAXUINT));
+
+            break;
+        }
+        case PROP_NAME_ACQUIRED_MS:
+        {
+            g_value_set_int64 (pValue, self->pPrivate->nNameAcquired ? (self->pPrivate->nNameAcquired - self->pPrivate->nStarted) / 1000 : -1);
+
+            break;
+        }
+        case PROP_POPULATED_MS:
+        {
+            g_value_set_int64 (pValue, self->pPrivate->nFirstPopulated ? (self->pPrivate->nFirstPopulated - self->pPrivate->nStarted) / 1000 : -1);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+}
+
+static void indicator_printers_service_class_init (IndicatorPrintersServiceClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+    object_class->get_property = onGetProperty;
+    m_nSignal = g_signal_new ("name-lost", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET (IndicatorPrintersServiceClass, pNameLost), NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+    m_lProperties[PROP_SIGNALS_RECEIVED] = g_param_spec_uint ("signals-received", "Signals received", "Number of CUPS notifier signals handled", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_REBUILDS_RUN] = g_param_spec_uint ("rebuilds-run", "Rebuilds run", "Number of printers section rebuilds actually run", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_WAKEUPS_PER_HOUR] = g_param_spec_uint ("wakeups-per-hour", "Wakeups per hour", "Average number of CUPS notifier signals per hour since startup", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_NAME_ACQUIRED_MS] = g_param_spec_int64 ("name-acquired-ms", "Name acquired", "Milliseconds from startup until the bus name was acquired, -1 before that", -1, G_MAXINT64, -1, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_POPULATED_MS] = g_param_spec_int64 ("populated-ms", "Populated", "Milliseconds from startup until the menu was first populated, -1 before that", -1, G_MAXINT64, -1, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+// Only available if the schema is installed, the defaults apply otherwise
+static GSettings *createSettings ()
+{
+    GSettingsSchemaSource *pSource = g_settings_schema_source_get_default ();
+    GSettingsSchema *pSchema = pSource != NULL ? g_settings_schema_source_lookup (pSource, SETTINGS_SCHEMA, TRUE) : NULL;
+
+    if (pSchema == NULL)
+    {
+        g_debug ("%s is not installed, using the default events", SETTINGS_SCHEMA);
+
+        return NULL;
+    }
+
+    GSettings *pSettings = g_settings_new_full (pSchema, NULL, NULL);
+    g_settings_schema_unref (pSchema);
+
+    return pSettings;
+}
+
+/*
+ * Returns the notify-events of the printer subscription, or with bJobSubscription those of
+ * the per-job subscriptions, which is NULL unless only the user's own jobs are followed.
+ */
+static gchar **getEvents (IndicatorPrintersService *self, gboolean bJobSubscription)
+{
+    if (g_atomic_int_get (&self->pPrivate->bIdle))
+    {
+        return bJobSubscription ? NULL : g_strdupv ((gchar**) lIdleEvents);
+    }
+
+    gchar **lEvents = self->pPrivate->pSettings != NULL ? g_settings_get_strv (self->pPrivate->pSettings, "notify-events") : g_strdupv ((gchar**) lDefaultEvents);
+    gboolean bOwnJobsOnly = self->pPrivate->pSettings != NULL && g_settings_get_boolean (self->pPrivate->pSettings, "own-jobs-only");
+
+    // "all" can not be split up
+    if (!bOwnJobsOnly || g_strv_contains ((const gchar * const *) lEvents, "all"))
+    {
+        if (bJobSubscription)
+        {
+            g_strfreev (lEvents);
+
+            return NULL;
+        }
+
+        return lEvents;
+    }
+
+    GPtrArray *lFiltered = g_ptr_array_new ();
+
+    for (guint i = 0; lEvents[i] != NULL; i++)
+    {
+        if (g_strv_contains (lJobEvents, lEvents[i]) == bJobSubscription)
+        {
+            g_ptr_array_add (lFiltered, g_strdup (lEvents[i]));
+        }
+    }
+
+    g_strfreev (lEvents);
+
+    if (bJobSubscription && lFiltered->len == 0)
+    {
+        g_ptr_array_free (lFiltered, TRUE);
+
+        return NULL;
+    }
+
+    g_ptr_array_add (lFiltered, NULL);
+
+    return (gchar**) g_ptr_array_free (lFiltered, FALSE);
+}
+
+static gboolean onRenewTimeout (gpointer pData);
+static gboolean onSubscribeTimeout (gpointer pData);
+
+static void setSubscriptionTimer (IndicatorPrintersService *self, guint nSeconds, GSourceFunc pFunc)
+{
+    if (self->pPrivate->nSubscriptionTimer)
+    {
+        g_source_remove (self->pPrivate->nSubscriptionTimer);
+    }
+
+    self->pPrivate->nSubscriptionTimer = pFunc != NULL ? g_timeout_add_seconds (nSeconds, pFunc, self) : 0;
+}
+
+// Returns TRUE if the settings or cupsd changed while a request was running, and a new subscription was started
+static gboolean subscribeIfPending (IndicatorPrintersService *self)
+{
+    if (!self->pPrivate->bSubscribePending)
+    {
+        return FALSE;
+    }
+
+    self->pPrivate->bSubscribePending = FALSE;
+    cancelSubscription (self);
+    subscribe (self);
+
+    return TRUE;
+}
+
+static void onPollerUpdated (IndicatorRemoteServer *pServer, GPtrArray *lPrinters, IndicatorPrintersService *self)
+{
+    // A failed poll keeps the last printers, like a failed resync
+    if (lPrinters != NULL)
+    {
+        indicator_printer_model_reset (self->pPrivate->pModel, lPrinters);
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+    }
+}
+
+// Without notifications, the menu only follows cupsd by polling it
+static void startPolling (IndicatorPrintersService *self)
+{
+    if (self->pPrivate->pPoller == NULL)
+    {
+        g_debug ("No CUPS notifications, polling the default server");
+        self->pPrivate->pPoller = indicator_remote_server_new (NULL);
+        g_signal_connect (self->pPrivate->pPoller, "updated", G_CALLBACK (onPollerUpdated), self);
+        indicator_remote_server_start (self->pPrivate->pPoller);
+    }
+}
+
+static void stopPolling (IndicatorPrintersService *self)
+{
+    if (self->pPrivate->pPoller != NULL)
+    {
+        g_debug ("CUPS notifications are back, no more polling");
+        indicator_remote_server_stop (self->pPrivate->pPoller);
+        g_clear_object (&self->pPrivate->pPoller);
+    }
+}
+
+static void onSubscribed (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    gint nId = printer_query_subscribe_finish (pResult, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+
+    if (pError)
+    {
+        self->pPrivate->nSubscribeBackoff = self->pPrivate->nSubscribeBackoff ? MIN (self->pPrivate->nSubscribeBackoff * 2, SUBSCRIBE_BACKOFF_MAX) : SUBSCRIBE_BACKOFF_MIN;
+        g_warning ("%s, retrying in %u s", pError->message, self->pPrivate->nSubscribeBackoff);
+        g_error_free (pError);
+        self->pPrivate->nSubscriptionFailures++;
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_WAITING;
+        setSubscriptionTimer (self, self->pPrivate->nSubscribeBackoff, onSubscribeTimeout);
+        startPolling (self);
+    }
+    else
+    {
+        stopPolling (self);
+        self->pPrivate->nSubscriptionId = nId;
+        self->pPrivate->nSubscribeBackoff = 0;
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_ACTIVE;
+        setSubscriptionTimer (self, NOTIFY_RENEW_AFTER, onRenewTimeout);
+    }
+
+    if (subscribeIfPending (self))
+    {
+        return;
+    }
+
+    // Anything that happened before the subscription existed is only seen by a full query
+    if (nId > 0 && !g_atomic_int_get (&self->pPrivate->bIdle))
+    {
+        resync (self);
+    }
+}
+
+static void subscribe (IndicatorPrintersService *self)
+{
+    gchar **lEvents = getEvents (self, FALSE);
+
+    setSubscriptionTimer (self, 0, NULL);
+
+    if (lEvents[0] == NULL)
+    {
+        g_warning ("No CUPS events to subscribe to");
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_NONE;
+    }
+    else
+    {
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_CREATING;
+        printer_query_subscribe_async (self->pPrivate->pCupsConnection, (const gchar * const *) lEvents, NOTIFY_LEASE_DURATION, self->pPrivate->pCancellable, onSubscribed, self);
+    }
+
+    g_strfreev (lEvents);
+}
+
+// Replaces the subscription, or does so once the running request is done
+static void resubscribe (IndicatorPrintersService *self)
+{
+    guint nState = self->pPrivate->nSubscriptionState;
+
+    if (nState == SUBSCRIPTION_CREATING || nState == SUBSCRIPTION_RENEWING)
+    {
+        self->pPrivate->bSubscribePending = TRUE;
+
+        return;
+    }
+
+    cancelSubscription (self);
+    subscribe (self);
+}
+
+static gboolean onSubscribeTimeout (gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    self->pPrivate->nSubscriptionTimer = 0;
+    subscribe (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void onRenewed (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    gboolean bRenewed = printer_query_renew_finish (pResult, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    self->pPrivate->nSubscriptionState = SUBSCRIPTION_ACTIVE;
+
+    if (subscribeIfPending (self))
+    {
+        g_clear_error (&pError);
+
+        return;
+    }
+
+    if (!bRenewed)
+    {
+        // The lease may be gone already, and with it every signal since
+        g_warning ("%s", pError->message);
+        g_error_free (pError);
+        self->pPrivate->nSubscriptionFailures++;
+        self->pPrivate->nSubscriptionId = 0;
+        subscribe (self);
+
+        return;
+    }
+
+    self->pPrivate->nRenewals++;
+    setSubscriptionTimer (self, NOTIFY_RENEW_AFTER, onRenewTimeout);
+}
+
+static gboolean onRenewTimeout (gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    self->pPrivate->nSubscriptionTimer = 0;
+
+    if (self->pPrivate->nSubscriptionId <= 0)
+    {
+        subscribe (self);
+    }
+    else
+    {
+        self->pPrivate->nSubscriptionState = SUBSCRIPTION_RENEWING;
+        printer_query_renew_async (self->pPrivate->pCupsConnection, self->pPrivate->nSubscriptionId, NOTIFY_LEASE_DURATION, self->pPrivate->pCancellable, onRenewed, self);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void onJobWatched (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    guint nJobId;
+    gint nState = printer_query_watch_job_finish (pResult, &nJobId, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+
+    if (pError)
+    {
+        // Try again with the next resync
+        g_warning ("%s", pError->message);
+        g_error_free (pError);
+        g_hash_table_remove (self->pPrivate->pWatchedJobs, GUINT_TO_POINTER (nJobId));
+    }
+    else if (nState >= IPP_JOB_CANCELED)
+    {
+        // The job finished before the subscription existed
+        g_hash_table_remove (self->pPrivate->pWatchedJobs, GUINT_TO_POINTER (nJobId));
+        queueModelUpdate (self, MODEL_UPDATE_JOB, NULL, 0, NULL, nJobId, nState, FALSE);
+
+        if (indicator_printer_model_update_job (self->pPrivate->pModel, NULL, nJobId, nState, FALSE) == INDICATOR_PRINTER_MODEL_CHANGED)
+        {
+            scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+        }
+    }
+}
+
+// Subscribes to the state changes of one of the user's jobs, if only those are followed
+static void watchJob (IndicatorPrintersService *self, guint nJobId)
+{
+    if (g_hash_table_contains (self->pPrivate->pWatchedJobs, GUINT_TO_POINTER (nJobId)))
+    {
+        return;
+    }
+
+    gchar **lEvents = getEvents (self, TRUE);
+
+    if (lEvents != NULL)
+    {
+        g_hash_table_add (self->pPrivate->pWatchedJobs, GUINT_TO_POINTER (nJobId));
+        printer_query_watch_job_async (self->pPrivate->pCupsConnection, nJobId, (const gchar * const *) lEvents, self->pPrivate->pCancellable, onJobWatched, self);
+        g_strfreev (lEvents);
+    }
+}
+
+// Watches all of the user's jobs in the model and forgets those that are gone
+static void watchJobs (IndicatorPrintersService *self)
+{
+    GHashTable *pMine = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GPtrArray *lPrinters = indicator_printer_model_get_busiest (self->pPrivate->pModel, 0, NULL);
+
+    for (guint i = 0; i < lPrinters->len; i++)
+    {
+        IndicatorPrinterModelPrinter *pPrinter = g_ptr_array_index (lPrinters, i);
+        GHashTableIter cIter;
+        gpointer pJobId;
+        g_hash_table_iter_init (&cIter, pPrinter->pJobs);
+
+        while (g_hash_table_iter_next (&cIter, &pJobId, NULL))
+        {
+            g_hash_table_add (pMine, pJobId);
+        }
+    }
+
+    g_ptr_array_unref (lPrinters);
+
+    GHashTableIter cIter;
+    gpointer pJobId;
+    g_hash_table_iter_init (&cIter, self->pPrivate->pWatchedJobs);
+
+    while (g_hash_table_iter_next (&cIter, &pJobId, NULL))
+    {
+        if (!g_hash_table_contains (pMine, pJobId))
+        {
+            g_hash_table_iter_remove (&cIter);
+        }
+    }
+
+    g_hash_table_iter_init (&cIter, pMine);
+
+    while (g_hash_table_iter_next (&cIter, &pJobId, NULL))
+    {
+        watchJob (self, GPOINTER_TO_UINT (pJobId));
+    }
+
+    g_hash_table_destroy (pMine);
+}
+
+static void onSettingsChanged (GSettings *pSettings, const gchar *sKey, IndicatorPrintersService *self)
+{
+    // Not subscribed yet, onNotifierReady () will pick the new settings up
+    if (self->pPrivate->pCupsNotifier == NULL)
+    {
+        return;
+    }
+
+    g_debug ("%s changed, subscribing again", sKey);
+    resubscribe (self);
+
+    watchJobs (self);
+}
+
+static void onRemoteServerUpdated (IndicatorRemoteServer *pServer, GPtrArray *lPrinters, IndicatorPrintersService *self)
+{
+    indicator_printer_model_reset_server (self->pPrivate->pModel, indicator_remote_server_get_name (pServer), lPrinters);
+    scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+}
+
+static void freeRemoteServer (gpointer pData)
+{
+    IndicatorRemoteServer *pServer = pData;
+
+    // A stopped server does not emit "updated" anymore
+    indicator_remote_server_stop (pServer);
+    g_object_unref (pServer);
+}
+
+// Replaces the polled servers with the ones in the settings
+static void loadRemoteServers (IndicatorPrintersService *self)
+{
+    for (guint i = 0; i < self->pPrivate->lRemoteServers->len; i++)
+    {
+        IndicatorRemoteServer *pServer = g_ptr_array_index (self->pPrivate->lRemoteServers, i);
+        indicator_printer_model_reset_server (self->pPrivate->pModel, indicator_remote_server_get_name (pServer), NULL);
+    }
+
+    if (self->pPrivate->lRemoteServers->len > 0)
+    {
+        g_ptr_array_set_size (self->pPrivate->lRemoteServers, 0);
+        scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+    }
+
+    if (self->pPrivate->pSettings == NULL)
+    {
+        return;
+    }
+
+    gchar **lServers = g_settings_get_strv (self->pPrivate->pSettings, "servers");
+
+    for (guint i = 0; lServers[i] != NULL; i++)
+    {
+        if (*lServers[i] == '\0')
+        {
+            continue;
+        }
+
+        IndicatorRemoteServer *pServer = indicator_remote_server_new (lServers[i]);
+        g_signal_connect (pServer, "updated", G_CALLBACK (onRemoteServerUpdated), self);
+        g_ptr_array_add (self->pPrivate->lRemoteServers, pServer);
+        indicator_remote_server_start (pServer);
+    }
+
+    g_strfreev (lServers);
+}
+
+static void onServersChanged (GSettings *pSettings, const gchar *sKey, IndicatorPrintersService *self)
+{
+    loadRemoteServers (self);
+}
+
+static guint getMaxPrinters (IndicatorPrintersService *self)
+{
+    return self->pPrivate->pSettings != NULL ? g_settings_get_uint (self->pPrivate->pSettings, "max-printers") : MAX_PRINTERS;
+}
+
+// Back to the first page, applied with the next rebuild
+static void resetShownPrinters (IndicatorPrintersService *self)
+{
+    self->pPrivate->nShownPrinters = getMaxPrinters (self);
+    indicator_printers_section_set_limit (self->pPrivate->pPrintersSection, self->pPrivate->nShownPrinters);
+}
+
+static void onMaxPrintersChanged (GSettings *pSettings, const gchar *sKey, IndicatorPrintersService *self)
+{
+    resetShownPrinters (self);
+    scheduleRebuild (self, SECTION_PRINTERS | SECTION_HEADER);
+}
+
+static void onMorePrintersActivated (GSimpleAction *pAction, GVariant *pVariant, gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    guint nPage = getMaxPrinters (self);
+
+    if (nPage > 0)
+    {
+        self->pPrivate->nShownPrinters += nPage;
+        indicator_printers_section_set_limit (self->pPrivate->pPrintersSection, self->pPrivate->nShownPrinters);
+        rebuildNow (self, SECTION_PRINTERS);
+    }
+}
+
+static void onPrinterItemActivated (GSimpleAction *pAction, GVariant *pVariant, gpointer pData)
+{
+    gchar *sPrinter = g_shell_quote (g_variant_get_string (pVariant, NULL));
+    spawn_printer_settings_with_args ("--show-jobs %s", sPrinter);
+    g_free (sPrinter);
+}
+
+static void initActions (IndicatorPrintersService *self)
+{
+    self->pPrivate->pActionGroup = g_simple_action_group_new ();
+
+    GSimpleAction *pAction = g_simple_action_new_stateful ("_header", NULL, indicator_printers_variants_get_header (self->pPrivate->bVisible));
+    g_action_map_add_action (G_ACTION_MAP (self->pPrivate->pActionGroup), G_ACTION (pAction));
+    self->pPrivate->pHeaderAction = pAction;
+
+    pAction = g_simple_action_new("printer", G_VARIANT_TYPE_STRING);
+    g_action_map_add_action (G_ACTION_MAP (self->pPrivate->pActionGroup), G_ACTION (pAction));
+    self->pPrivate->pPrinterAction = pAction;
+    g_signal_connect(pAction, "activate", G_CALLBACK(onPrinterItemActivated), self);
+
+    pAction = g_simple_action_new ("more-printers", NULL);
+    g_action_map_add_action (G_ACTION_MAP (self->pPrivate->pActionGroup), G_ACTION (pAction));
+    g_signal_connect (pAction, "activate", G_CALLBACK (onMorePrintersActivated), self);
+    g_object_unref (pAction);
+
+    rebuildNow (self, SECTION_HEADER);
+}
+
+static void createMenu (IndicatorPrintersService *self, int nProfile)
+{
+    g_assert (0 <= nProfile && nProfile < N_PROFILES);
+    g_assert (self->pPrivate->lMenus[nProfile].pMenu == NULL);
+
+    GMenuModel *lSections[16];
+    guint nSection = 0;
+
+    // Build the sections
+    switch (nProfile)
+    {
+        case PROFILE_PHONE:
+        case PROFILE_DESKTOP:
+        {
+            // Empty until the first resync has filled the model
+            lSections[nSection++] = G_MENU_MODEL (g_object_ref (self->pPrivate->pPrintersSection));
+
+            break;
+        }
+
+        break;
+    }
+
+    // Add sections to the submenu
+    GMenu *pSubmenu = g_menu_new ();
+
+    for (guint i = 0; i < nSection; ++i)
+    {
+        g_menu_append_section (pSubmenu, NULL, lSections[i]);
+        g_object_unref (lSections[i]);
+    }
+
+    // Add submenu to the header
+    GMenuItem *pHeader = g_menu_item_new (NULL, "indicator._header");
+    g_menu_item_set_attribute (pHeader, "x-ayatana-type", "s", "org.ayatana.indicator.root");
+    g_menu_item_set_submenu (pHeader, G_MENU_MODEL (pSubmenu));
+    g_object_unref (pSubmenu);
+
+    // Add header to the menu
+    GMenu *pMenu = g_menu_new ();
+    g_menu_append_item (pMenu, pHeader);
+    g_object_unref (pHeader);
+
+    self->pPrivate->lMenus[nProfile].pMenu = pMenu;
+    self->pPrivate->lMenus[nProfile].pSubmenu = pSubmenu;
+}
+
+static gboolean onMenuOpened (gpointer pData)
+{
+    leaveIdle (INDICATOR_PRINTERS_SERVICE (pData));
+
+    return G_SOURCE_REMOVE;
+}
+
+static void freeMenuWatcher (gpointer pData)
+{
+    MenuWatcher *pWatcher = pData;
+
+    g_bus_unwatch_name (pWatcher->nWatchId);
+    g_slice_free (MenuWatcher, pWatcher);
+}
+
+static void freeMenuSubscription (gpointer pData)
+{
+    MenuSubscription *pSubscription = pData;
+
+    g_object_unref (pSubscription->self);
+    g_free (pSubscription->sSender);
+    g_slice_free (MenuSubscription, pSubscription);
+}
+
+/*
+ * The pages shown by "More printers" are shared by all clients, so the menu only opens on
+ * the first page again once the last watcher ended its groups or left the bus. A client
+ * that closes its menu while another one still reads it does not page the other one back.
+ */
+static void collapseShownPrinters (IndicatorPrintersService *self)
+{
+    if (g_hash_table_size (self->pPrivate->pMenuWatchers) == 0 && self->pPrivate->nShownPrinters != getMaxPrinters (self))
+    {
+        resetShownPrinters (self);
+        self->pPrivate->bSectionStale = TRUE;
+    }
+}
+
+static void updateWatched (IndicatorPrintersService *self)
+{
+    if (g_hash_table_size (self->pPrivate->pMenuWatchers) > 0 && self->pPrivate->bSectionStale)
+    {
+        g_debug ("Menu watched, building the stale printers section");
+        rebuildNow (self, SECTION_PRINTERS);
+    }
+}
+
+// The exporter forgets the groups of a client that left the bus, so do we
+static void onMenuWatcherVanished (GDBusConnection *pConnection, const gchar *sName, gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+
+    g_hash_table_remove (self->pPrivate->pMenuWatchers, sName);
+    collapseShownPrinters (self);
+    updateWatched (self);
+}
+
+static gboolean onMenuSubscription (gpointer pData)
+{
+    MenuSubscription *pSubscription = pData;
+    IndicatorPrintersService *self = pSubscription->self;
+
+    if (self->pPrivate->pMenuWatchers == NULL)
+    {
+        return G_SOURCE_REMOVE;
+    }
+
+    MenuWatcher *pWatcher = g_hash_table_lookup (self->pPrivate->pMenuWatchers, pSubscription->sSender);
+
+    if (pSubscription->nGroups > 0)
+    {
+        if (pWatcher == NULL)
+        {
+            pWatcher = g_slice_new0 (MenuWatcher);
+            pWatcher->nWatchId = g_bus_watch_name_on_connection (self->pPrivate->pConnection, pSubscription->sSender, G_BUS_NAME_WATCHER_FLAGS_NONE, NULL, onMenuWatcherVanished, self, NULL);
+            g_hash_table_insert (self->pPrivate->pMenuWatchers, g_strdup (pSubscription->sSender), pWatcher);
+        }
+
+        pWatcher->nGroups += pSubscription->nGroups;
+        leaveIdle (self);
+        updateWatched (self);
+    }
+    else if (pWatcher != NULL)
+    {
+        pWatcher->nGroups -= MIN (pWatcher->nGroups, (guint) -pSubscription->nGroups);
+
+        if (pWatcher->nGroups == 0)
+        {
+            g_hash_table_remove (self->pPrivate->pMenuWatchers, pSubscription->sSender);
+        }
+
+        collapseShownPrinters (self);
+        updateWatched (self);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Runs on the GDBus worker thread, a client that reads the menu or the actions wakes an idle service.
+ * Group ids are private to the menu exporter, so a Start of any group of our menus counts as watching the
+ * printers section. The update is queued ahead of the exporter's own handler, which then replies with
+ * the fresh section.
+ */
+static GDBusMessage *onBusMessage (GDBusConnection *pConnection, GDBusMessage *pMessage, gboolean bIncoming, gpointer pData)
+{
+    BusFilter *pFilter = pData;
+
+    if (bIncoming && g_dbus_message_get_message_type (pMessage) == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+    {
+        // Held while self is used, so dispose cannot run in between
+        g_mutex_lock (&pFilter->cMutex);
+        IndicatorPrintersService *self = pFilter->self;
+
+        if (self == NULL)
+        {
+            g_mutex_unlock (&pFilter->cMutex);
+
+            return pMessage;
+        }
+
+        const gchar *sInterface = g_dbus_message_get_interface (pMessage);
+        const gchar *sMember = g_dbus_message_get_member (pMessage);
+        const gchar *sPath = g_dbus_message_get_path (pMessage);
+        const gchar *sSender = g_dbus_message_get_sender (pMessage);
+        GVariant *pBody = g_dbus_message_get_body (pMessage);
+
+        if (g_strcmp0 (sInterface, "org.gtk.Menus") == 0 && sSender != NULL && sPath != NULL && g_str_has_prefix (sPath, INDICATOR_PRINTERS_DBUS_OBJECT_PATH "/") && pBody != NULL && g_variant_is_of_type (pBody, G_VARIANT_TYPE ("(au)")))
+        {
+            gboolean bStart = g_strcmp0 (sMember, "Start") == 0;
+
+            if (bStart || g_strcmp0 (sMember, "End") == 0)
+            {
+                GVariant *pGroups = g_variant_get_child_value (pBody, 0);
+                gint nGroups = g_variant_n_children (pGroups);
+                g_variant_unref (pGroups);
+
+                if (nGroups > 0)
+                {
+                    MenuSubscription *pSubscription = g_slice_new (MenuSubscription);
+                    pSubscription->self = g_object_ref (self);
+                    pSubscription->sSender = g_strdup (sSender);
+                    pSubscription->nGroups = bStart ? nGroups : -nGroups;
+                    g_main_context_invoke_full (NULL, G_PRIORITY_HIGH, onMenuSubscription, pSubscription, freeMenuSubscription);
+                }
+            }
+        }
+        else if (g_atomic_int_get (&self->pPrivate->bIdle) && g_strcmp0 (sInterface, "org.gtk.Actions") == 0 && g_strcmp0 (sMember, "Activate") == 0)
+        {
+            g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, onMenuOpened, g_object_ref (self), g_object_unref);
+        }
+
+        g_mutex_unlock (&pFilter->cMutex);
+    }
+
+    return pMessage;
+}
+
+static void onBusAcquired (GDBusConnection *pConnection, const gchar *sName, gpointer pSelf)
+{
+    g_debug ("bus acquired: %s", sName);
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pSelf);
+    guint nId;
+    GError *pError = NULL;
+    GString *pPath = g_string_new (NULL);
+    self->pPrivate->pConnection = (GDBusConnection*)g_object_ref (G_OBJECT (pConnection));
+    self->pPrivate->pFilter = g_new0 (BusFilter, 1);
+    self->pPrivate->pFilter->nRefs = 2;
+    g_mutex_init (&self->pPrivate->pFilter->cMutex);
+    self->pPrivate->pFilter->self = self;
+    self->pPrivate->nFilterId = g_dbus_connection_add_filter (pConnection, onBusMessage, self->pPrivate->pFilter, unrefBusFilter);
+
+    // Export the actions
+    if ((nId = g_dbus_connection_export_action_group (pConnection, INDICATOR_PRINTERS_DBUS_OBJECT_PATH, G_ACTION_GROUP (self->pPrivate->pActionGroup), &pError)))
+    {
+        self->pPrivate->nActionsId = nId;
+    }
+    else
+    {
+        g_warning ("cannot export action group: %s", pError->message);
+        g_clear_error (&pError);
+    }
+
+    // Export the statistics next to the actions
+    if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (self->pPrivate->pStats), pConnection, INDICATOR_PRINTERS_DBUS_OBJECT_PATH, &pError))
+    {
+        g_warning ("cannot export statistics: %s", pError->message);
+        g_clear_error (&pError);
+    }
+
+    // Export the menus
+    for (gint nProfile = 0; nProfile < N_PROFILES; ++nProfile)
+    {
+        struct ProfileMenuInfo *pInfo = &self->pPrivate->lMenus[nProfile];
+
+        g_string_printf (pPath, "%s/%s", INDICATOR_PRINTERS_DBUS_OBJECT_PATH, lMenuNames[nProfile]);
+
+        if ((nId = g_dbus_connection_export_menu_model (pConnection, pPath->str, G_MENU_MODEL (pInfo->pMenu), &pError)))
+        {
+            pInfo->nExportId = nId;
+        }
+        else
+        {
+            g_warning ("cannot export %s menu: %s", pPath->str, pError->message);
+            g_clear_error (&pError);
+        }
+    }
+
+    g_string_free (pPath, TRUE);
+}
+
+static void onNameLost (GDBusConnection *pConnection, const gchar *sName, gpointer pSelf)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pSelf);
+
+    g_debug ("%s %s name lost %s", G_STRLOC, G_STRFUNC, sName);
+
+    unexport (self);
+}
+
+static void onNameAcquired (GDBusConnection *pConnection, const gchar *sName, gpointer pSelf)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pSelf);
+
+    if (self->pPrivate->nNameAcquired == 0)
+    {
+        self->pPrivate->nNameAcquired = g_get_monotonic_time ();
+        g_debug ("Name acquired %" G_GINT64_FORMAT " ms after startup", (self->pPrivate->nNameAcquired - self->pPrivate->nStarted) / 1000);
+    }
+}
+
+// The signals are connected before subscribing, so none of the subscription's signals are lost
+static void onNotifierReady (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    CupsNotifier *pNotifier = cups_notifier_proxy_new_for_bus_finish (pResult, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+
+    // No system bus, as in some containers
+    if (pError)
+    {
+        g_warning ("Error creating cups notify handler: %s", pError->message);
+        g_error_free (pError);
+        startPolling (self);
+
+        return;
+    }
+
+    self->pPrivate->pCupsNotifier = pNotifier;
+    g_object_connect (self->pPrivate->pCupsNotifier, "signal::job-created", onJobCreated, self, "signal::job-state", onJobChanged, self, "signal::job-progress", onJobChanged, self, "signal::job-completed", onJobChanged, self, "signal::printer-state-changed", onPrinterStateChanged, self, "signal::printer-stopped", onPrinterStateChanged, self, "signal::printer-added", onPrinterAdded, self, "signal::printer-deleted", onPrinterDeleted, self, "signal::printer-modified", onPrinterModified, self, "signal::printer-shutdown", onPrinterStateChanged, self, "signal::server-started", onServerRestarted, self, "signal::server-restarted", onServerRestarted, self, "signal::g-signal", onNotifierSignal, self, NULL);
+    self->pPrivate->pStateNotifier = g_object_new (INDICATOR_TYPE_PRINTER_STATE_NOTIFIER, "cups-notifier", self->pPrivate->pCupsNotifier, "cups-connection", self->pPrivate->pCupsConnection, "model", self->pPrivate->pModel, NULL);
+    subscribe (self);
+}
+
+static void indicator_printers_service_init (IndicatorPrintersService *self)
+{
+    self->pPrivate = indicator_printers_service_get_instance_private (self);
+    self->pPrivate->pCancellable = g_cancellable_new ();
+    self->pPrivate->pSignalCounts = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->pPrivate->pMenuWatchers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, freeMenuWatcher);
+    self->pPrivate->pStats = indicator_printers_stats_skeleton_new ();
+    g_signal_connect (self->pPrivate->pStats, "handle-get-stats", G_CALLBACK (onGetStats), self);
+    self->pPrivate->pModel = indicator_printer_model_new ();
+    self->pPrivate->pCupsConnection = indicator_cups_connection_new ();
+    self->pPrivate->pDestCache = indicator_dest_cache_new ();
+    self->pPrivate->pJobProgress = indicator_job_progress_new (self->pPrivate->pCupsConnection);
+    g_signal_connect (self->pPrivate->pJobProgress, "changed", G_CALLBACK (onJobProgressChanged), self);
+
+    self->pPrivate->pWatchedJobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->pPrivate->pCreatedJobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    self->pPrivate->lQueuedUpdates = g_ptr_array_new_with_free_func (freeModelUpdate);
+    self->pPrivate->lRemoteServers = g_ptr_array_new_with_free_func (freeRemoteServer);
+    self->pPrivate->nStarted = g_get_monotonic_time ();
+    self->pPrivate->pSettings = createSettings ();
+
+    if (self->pPrivate->pSettings != NULL)
+    {
+        g_signal_connect (self->pPrivate->pSettings, "changed::notify-events", G_CALLBACK (onSettingsChanged), self);
+        g_signal_connect (self->pPrivate->pSettings, "changed::own-jobs-only", G_CALLBACK (onSettingsChanged), self);
+        g_signal_connect (self->pPrivate->pSettings, "changed::max-printers", G_CALLBACK (onMaxPrintersChanged), self);
+        g_signal_connect (self->pPrivate->pSettings, "changed::servers", G_CALLBACK (onServersChanged), self);
+    }
+
+    /*
+     * Nothing below waits for cupsd or the system bus: the name is owned with the empty
+     * menus right away, the proxy, the subscription and the first query follow later on.
+     */
+    initActions (self);
+    self->pPrivate->pPrintersSection = indicator_printers_section_new ();
+    resetShownPrinters (self);
+
+    for (gint nProfile = 0; nProfile < N_PROFILES; ++nProfile)
+    {
+        createMenu (self, nProfile);
+    }
+
+    self->pPrivate->bMenusBuilt = TRUE;
+    self->pPrivate->nOwnId = g_bus_own_name (G_BUS_TYPE_SESSION, INDICATOR_PRINTERS_DBUS_NAME, G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT, onBusAcquired, onNameAcquired, onNameLost, self, NULL);
+    cups_notifier_proxy_new_for_bus (G_BUS_TYPE_SYSTEM, 0, NULL, CUPS_DBUS_PATH, self->pPrivate->pCancellable, onNotifierReady, self);
+    resync (self);
+    loadRemoteServers (self);
+}
+
+IndicatorPrintersService *indicator_printers_service_new ()
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_PRINTERS_SERVICE, NULL);
+
+    return INDICATOR_PRINTERS_SERVICE (pObject);
+}
+
+// Brings the snapshot of a full query up to date with the signals that arrived while it ran
+static void replayModelUpdates (IndicatorPrintersService *self)
+{
+    gboolean bChanged;
+
+    for (guint i = 0; i < self->pPrivate->lQueuedUpdates->len; i++)
+    {
+        ModelUpdate *pUpdate = g_ptr_array_index (self->pPrivate->lQueuedUpdates, i);
+
+        switch (pUpdate->nType)
+        {
+            case MODEL_UPDATE_PRINTER:
+            {
+                indicator_printer_model_update_printer (self->pPrivate->pModel, pUpdate->sPrinter, pUpdate->nPrinterState, pUpdate->sReasons);
+
+                break;
+            }
+            case MODEL_UPDATE_PRINTER_DELETED:
+            {
+                indicator_printer_model_remove_printer (self->pPrivate->pModel, pUpdate->sPrinter);
+
+                break;
+            }
+            case MODEL_UPDATE_JOB:
+            {
+                applyJobUpdate (self, pUpdate->sPrinter, pUpdate->nPrinterState, pUpdate->sReasons, pUpdate->nJobId, pUpdate->nJobState, pUpdate->bCreated, &bChanged);
+
+                break;
+            }
+        }
+    }
+
+    g_ptr_array_set_size (self->pPrivate->lQueuedUpdates, 0);
+}
+
+static void onPrintersQueried (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    GPtrArray *lPrinters = printer_query_run_finish (pResult, &pError);
+
+    // The service may already be gone if the query was cancelled
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+
+    if (pError)
+    {
+        // The model already has the queued updates
+        g_warning ("Error querying printers: %s", pError->message);
+        g_error_free (pError);
+        g_ptr_array_set_size (self->pPrivate->lQueuedUpdates, 0);
+        self->pPrivate->bQueryRunning = FALSE;
+    }
+    else
+    {
+        indicator_printer_model_reset (self->pPrivate->pModel, lPrinters);
+        g_ptr_array_unref (lPrinters);
+        replayModelUpdates (self);
+        // A gap found by the replay only marks a pending query
+        self->pPrivate->bQueryRunning = FALSE;
+        watchJobs (self);
+        rebuildNow (self, SECTION_PRINTERS | SECTION_HEADER);
+
+        if (self->pPrivate->nFirstPopulated == 0)
+        {
+            self->pPrivate->nFirstPopulated = g_get_monotonic_time ();
+            g_debug ("Menu populated %" G_GINT64_FORMAT " ms after startup", (self->pPrivate->nFirstPopulated - self->pPrivate->nStarted) / 1000);
+        }
+    }
+
+    // A resync was requested while the query was running
+    if (self->pPrivate->bQueryPending)
+    {
+        self->pPrivate->bQueryPending = FALSE;
+        resync (self);
+    }
+}
+
+// Replaces the model with a full query, only needed at startup, after a cupsd restart or when signals were missed
+static void resync (IndicatorPrintersService *self)
+{
+    // Never more than one query in flight, the running one is followed up by a single new one
+    if (self->pPrivate->bQueryRunning)
+    {
+        self->pPrivate->bQueryPending = TRUE;
+
+        return;
+    }
+
+    self->pPrivate->bQueryRunning = TRUE;
+    printer_query_run_async (self->pPrivate->pCupsConnection, self->pPrivate->pDestCache, self->pPrivate->pCancellable, onPrintersQueried, self);
+}
+
+static guint getIdleTimeout (IndicatorPrintersService *self)
+{
+    return self->pPrivate->pSettings != NULL ? g_settings_get_uint (self->pPrivate->pSettings, "idle-timeout") : IDLE_TIMEOUT;
+}
+
+/*
+ * Drops everything but the bus name and a job-created subscription: the model, the cached
+ * destinations and the pooled connections. The menu is already empty without jobs.
+ */
+static void enterIdle (IndicatorPrintersService *self)
+{
+    g_debug ("No jobs for %u s, going idle", getIdleTimeout (self));
+    g_atomic_int_set (&self->pPrivate->bIdle, TRUE);
+
+    GPtrArray *lPrinters = g_ptr_array_new ();
+    indicator_printer_model_reset (self->pPrivate->pModel, lPrinters);
+    g_ptr_array_unref (lPrinters);
+    g_hash_table_remove_all (self->pPrivate->pWatchedJobs);
+    g_hash_table_remove_all (self->pPrivate->pCreatedJobs);
+    indicator_job_progress_clear (self->pPrivate->pJobProgress);
+    indicator_dest_cache_invalidate (self->pPrivate->pDestCache);
+    indicator_cups_connection_set_pooling (self->pPrivate->pCupsConnection, FALSE);
+    resubscribe (self);
+}
+
+// Subscribes to all events again, the resync follows in onSubscribed ()
+static void leaveIdle (IndicatorPrintersService *self)
+{
+    if (!g_atomic_int_get (&self->pPrivate->bIdle))
+    {
+        return;
+    }
+
+    g_debug ("Waking up");
+    g_atomic_int_set (&self->pPrivate->bIdle, FALSE);
+    indicator_cups_connection_set_pooling (self->pPrivate->pCupsConnection, TRUE);
+    resubscribe (self);
+}
+
+static gboolean onIdleTimeout (gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    guint nTimeout = getIdleTimeout (self);
+    self->pPrivate->nIdleTimer = 0;
+
+    // The next rebuild without jobs tries again
+    if (nTimeout == 0 || self->pPrivate->bQueryRunning || indicator_printer_model_get_n_jobs (self->pPrivate->pModel, NULL) > 0)
+    {
+        return G_SOURCE_REMOVE;
+    }
+
+    gint64 nQuiet = (g_get_monotonic_time () - self->pPrivate->nLastSignal) / G_USEC_PER_SEC;
+
+    // Signals of other users' jobs keep the service awake as well
+    if (nQuiet < nTimeout)
+    {
+        self->pPrivate->nIdleTimer = g_timeout_add_seconds (nTimeout - nQuiet, onIdleTimeout, self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    enterIdle (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void scheduleIdle (IndicatorPrintersService *self)
+{
+    guint nTimeout = getIdleTimeout (self);
+
+    if (nTimeout > 0 && self->pPrivate->nIdleTimer == 0 && !g_atomic_int_get (&self->pPrivate->bIdle))
+    {
+        self->pPrivate->nIdleTimer = g_timeout_add_seconds (nTimeout, onIdleTimeout, self);
+    }
+}
+
+static void rebuildNow (IndicatorPrintersService *self, guint nSections)
+{
+    if (self->pPrivate->bMenusBuilt && (nSections & SECTION_PRINTERS))
+    {
+        if (g_hash_table_size (self->pPrivate->pMenuWatchers) > 0)
+        {
+            // One update for all profiles, each submenu references the same section
+            self->pPrivate->bVisible = indicator_printers_section_update (self->pPrivate->pPrintersSection, self->pPrivate->pModel, self->pPrivate->pJobProgress);
+            self->pPrivate->bSectionStale = FALSE;
+            self->pPrivate->nRebuildsRun++;
+        }
+        else
+        {
+            // Nobody reads the items, the header only needs to know whether there are jobs
+            self->pPrivate->bVisible = indicator_printer_model_get_n_jobs (self->pPrivate->pModel, NULL) > 0;
+            self->pPrivate->bSectionStale = TRUE;
+            self->pPrivate->nRebuildsSkipped++;
+        }
+
+        if (indicator_printer_model_get_n_jobs (self->pPrivate->pModel, NULL) == 0)
+        {
+            scheduleIdle (self);
+        }
+    }
+
+    // After the printers section, which decides the visibility
+    if (nSections & SECTION_HEADER)
+    {
+        GVariant *pHeader = indicator_printers_variants_get_header (self->pPrivate->bVisible);
+        GVariant *pState = g_action_get_state (G_ACTION (self->pPrivate->pHeaderAction));
+
+        // The cached states are shared, so an unchanged header is the same pointer
+        if (pState != pHeader)
+        {
+            g_simple_action_set_state (self->pPrivate->pHeaderAction, pHeader);
+        }
+
+        g_variant_unref (pState);
+    }
+}
+
+static gboolean onRebuildTimeout (gpointer pData)
+{
+    IndicatorPrintersService *self = INDICATOR_PRINTERS_SERVICE (pData);
+    guint nSections = self->pPrivate->nDirtySections;
+
+    g_debug ("Rebuilding for %u signal(s) in the burst, %u signal(s) received, %u wakeup(s), %u rebuild(s) run", self->pPrivate->nDirtySignals, self->pPrivate->nSignalsReceived, self->pPrivate->nWakeups, self->pPrivate->nRebuildsRun);
+
+    self->pPrivate->nRebuildTimer = 0;
+    self->pPrivate->nDirtySections = 0;
+    self->pPrivate->nDirtySignals = 0;
+    rebuildNow (self, nSections);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Merges the dirty sections of a signal burst. The rebuild runs once the
+ * signals stop for REBUILD_DELAY ms, but never later than REBUILD_MAX_DELAY ms after the
+ * first signal of the burst.
+ */
+static void scheduleRebuild (IndicatorPrintersService *self, guint nSections)
+{
+    gint64 nNow = g_get_monotonic_time ();
+
+    if (self->pPrivate->nDirtySections == 0)
+    {
+        self->pPrivate->nFirstDirty = nNow;
+    }
+
+    self->pPrivate->nDirtySections |= nSections;
+    self->pPrivate->nDirtySignals++;
+
+    if (self->pPrivate->nRebuildTimer)
+    {
+        g_source_remove (self->pPrivate->nRebuildTimer);
+        self->pPrivate->nRebuildTimer = 0;
+    }
+
+    gint64 nElapsed = (nNow - self->pPrivate->nFirstDirty) / 1000;
+
+    if (nElapsed >= REBUILD_MAX_DELAY)
+    {
+        self->pPrivate->nRebuildTimer = g_idle_add (onRebuildTimeout, self);
+    }
+    else
     {
-        rebuildSection (pinfo->pSubmenu, 0, createPrintersSection (self));
+        self->pPrivate->nRebuildTimer = g_timeout_add (MIN (REBUILD_DELAY, REBUILD_MAX_DELAY - nElapsed), onRebuildTimeout, self);
     }
 }
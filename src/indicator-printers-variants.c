@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <locale.h>
+#include <gio/gio.h>
+#include <glib/gi18n-lib.h>
+#include "indicator-printers-variants.h"
+
+/*
+ * Menu items and the header only ever use a handful of distinct icons and header states.
+ * They are built once and kept for the lifetime of the process, so updating an item or
+ * the header does not create a GIcon and serialize it again, and an unchanged header is
+ * the very same pointer. Only used from the main thread.
+ */
+static GHashTable *m_pIcons = NULL;
+static GHashTable *m_pHeaders = NULL;
+
+GVariant *indicator_printers_variants_get_icon (const gchar *sIcon)
+{
+    if (m_pIcons == NULL)
+    {
+        m_pIcons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+    }
+
+    GVariant *pSerialized = NULL;
+
+    // A NULL value is cached as well, for icons that can not be serialized
+    if (!g_hash_table_lookup_extended (m_pIcons, sIcon, NULL, (gpointer*) &pSerialized))
+    {
+        GIcon *pIcon = g_themed_icon_new_with_default_fallbacks (sIcon);
+        pSerialized = g_icon_serialize (pIcon);
+        g_object_unref (pIcon);
+        g_hash_table_insert (m_pIcons, g_strdup (sIcon), pSerialized);
+    }
+
+    return pSerialized;
+}
+
+static GVariant *createHeader (gboolean bVisible)
+{
+    GVariantBuilder b;
+
+    g_variant_builder_init (&b, G_VARIANT_TYPE ("a{sv}"));
+    g_variant_builder_add (&b, "{sv}", "title", g_variant_new_string (_("Printers")));
+    g_variant_builder_add (&b, "{sv}", "tooltip", g_variant_new_string (_("Show print jobs and queues")));
+    g_variant_builder_add (&b, "{sv}", "visible", g_variant_new_boolean (TRUE));
+
+    if (bVisible)
+    {
+        g_variant_builder_add (&b, "{sv}", "accessible-desc", g_variant_new_string (_("Printers")));
+        GVariant *pIcon = indicator_printers_variants_get_icon ("printer-symbolic");
+
+        if (pIcon != NULL)
+        {
+            g_variant_builder_add (&b, "{sv}", "icon", pIcon);
+        }
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&b));
+}
+
+GVariant *indicator_printers_variants_get_header (gboolean bVisible)
+{
+    if (m_pHeaders == NULL)
+    {
+        m_pHeaders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+    }
+
+    // The strings are translated, so the states are kept per locale
+    const gchar *sLocale = setlocale (LC_MESSAGES, NULL);
+    gchar *sKey = g_strdup_printf ("%s:%d", sLocale != NULL ? sLocale : "C", bVisible != FALSE);
+    GVariant *pHeader = g_hash_table_lookup (m_pHeaders, sKey);
+
+    if (pHeader == NULL)
+    {
+        pHeader = createHeader (bVisible);
+        g_hash_table_insert (m_pHeaders, sKey, pHeader);
+    }
+    else
+    {
+        g_free (sKey);
+    }
+
+    return pHeader;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_PRINTERS_VARIANTS_H__
+#define __INDICATOR_PRINTERS_VARIANTS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Both return a cached, non-floating variant owned by the cache, or NULL if the icon can not be serialized
+GVariant *indicator_printers_variants_get_icon (const gchar *sIcon);
+GVariant *indicator_printers_variants_get_header (gboolean bVisible);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-remote-server.h"
+#include "indicator-cups-connection.h"
+#include "printer-query.h"
+
+// Seconds between two polls while the user has jobs on the server
+#define POLL_INTERVAL_ACTIVE 5
+// The most an idle or failing server waits, and the longest a full query is skipped
+#define POLL_INTERVAL_MAX 300
+// Failed polls in a row before the server's printers are dropped
+#define MAX_FAILURES 3
+
+/*
+ * The dbus:// notifier of cupsd only reaches the system bus of its own machine, so a
+ * configured server other than the default one is polled instead, and so is the default
+ * one while it cannot be subscribed to. Each poll is a single Get-Printers for the state
+ * and the job count of the queues, compared with the previous one. Only a change, or
+ * POLL_INTERVAL_MAX seconds without a full query, is followed by the full Get-Printers
+ * and Get-Jobs, so an idle poll costs one small round trip. The interval is
+ * POLL_INTERVAL_ACTIVE after a change and while the user has jobs there, and doubles
+ * with every unchanged poll otherwise, up to POLL_INTERVAL_MAX, where the periodic full
+ * query of an unchanged server leaves it.
+ *
+ * Each server runs its own loop on a connection of its own, a server that is down only
+ * backs its own polls off and never holds up the others or the default server.
+ */
+struct _IndicatorRemoteServerPrivate
+{
+    gchar *sName;
+    IndicatorCupsConnection *pConnection;
+    GCancellable *pCancellable;
+    guint nTimer;
+    gboolean bRunning;
+    // Seconds before the next poll while nothing fails
+    guint nInterval;
+    // Seconds before the next poll after a failure, 0 after a success
+    guint nBackoff;
+    // Failed polls since the last success
+    guint nFailuresInRow;
+    // Of the check that led to the last full query
+    guint nHash;
+    gboolean bHashValid;
+    // The last full query followed a change, not just POLL_INTERVAL_MAX without one
+    gboolean bChanged;
+    gint64 nLastFull;
+    // The user had jobs on the server at the last full query
+    gboolean bActive;
+    guint nPolls;
+    guint nFailures;
+    guint nFullQueries;
+};
+
+enum
+{
+    PROP_0,
+    PROP_POLLS,
+    PROP_FAILURES,
+    PROP_FULL_QUERIES,
+    N_PROPERTIES
+};
+
+static GParamSpec *m_lProperties[N_PROPERTIES];
+static guint m_nSignal;
+
+G_DEFINE_TYPE_WITH_PRIVATE (IndicatorRemoteServer, indicator_remote_server, G_TYPE_OBJECT)
+
+static void pollServer (IndicatorRemoteServer *self);
+
+static gboolean onPollTimeout (gpointer pData)
+{
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pData);
+
+    self->pPrivate->nTimer = 0;
+    pollServer (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule (IndicatorRemoteServer *self, guint nDelay)
+{
+    if (self->pPrivate->bRunning)
+    {
+        self->pPrivate->nTimer = g_timeout_add_seconds (nDelay, onPollTimeout, self);
+    }
+}
+
+static void fail (IndicatorRemoteServer *self, GError *pError)
+{
+    // Only the first failure in a row is worth a warning
+    if (self->pPrivate->nBackoff == 0)
+    {
+        g_warning ("Error polling %s: %s", indicator_cups_connection_get_server (self->pPrivate->pConnection), pError->message);
+    }
+
+    self->pPrivate->nFailures++;
+    self->pPrivate->nFailuresInRow++;
+    self->pPrivate->nBackoff = self->pPrivate->nBackoff ? MIN (self->pPrivate->nBackoff * 2, POLL_INTERVAL_MAX) : POLL_INTERVAL_ACTIVE;
+    self->pPrivate->bHashValid = FALSE;
+
+    // A single timeout keeps the last printers, a server that stays down loses them until the next success
+    if (self->pPrivate->nFailuresInRow == MAX_FAILURES)
+    {
+        g_signal_emit (self, m_nSignal, 0, NULL);
+    }
+
+    schedule (self, self->pPrivate->nBackoff);
+}
+
+static void onQueried (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    GPtrArray *lPrinters = printer_query_run_finish (pResult, &pError);
+
+    // Stopped or disposed, self may be gone
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pData);
+
+    if (pError)
+    {
+        fail (self, pError);
+        g_error_free (pError);
+
+        return;
+    }
+
+    self->pPrivate->nBackoff = 0;
+    self->pPrivate->nFailuresInRow = 0;
+    self->pPrivate->bHashValid = TRUE;
+    self->pPrivate->nLastFull = g_get_monotonic_time ();
+    self->pPrivate->bActive = FALSE;
+
+    for (guint i = 0; i < lPrinters->len && !self->pPrivate->bActive; i++)
+    {
+        PrinterQueryItem *pItem = g_ptr_array_index (lPrinters, i);
+
+        for (guint j = 0; j < pItem->lJobs->len && !self->pPrivate->bActive; j++)
+        {
+            self->pPrivate->bActive = g_array_index (pItem->lJobs, PrinterQueryJob, j).bMine;
+        }
+    }
+
+    // Something changed, more may follow soon. A refresh of an idle server keeps its interval.
+    if (self->pPrivate->bChanged || self->pPrivate->bActive)
+    {
+        self->pPrivate->nInterval = POLL_INTERVAL_ACTIVE;
+    }
+
+    g_signal_emit (self, m_nSignal, 0, lPrinters);
+    g_ptr_array_unref (lPrinters);
+    schedule (self, self->pPrivate->nInterval);
+}
+
+static void onChecked (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GError *pError = NULL;
+    guint nHash = printer_query_check_finish (pResult, &pError);
+
+    if (g_error_matches (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (pError);
+
+        return;
+    }
+
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pData);
+
+    if (pError)
+    {
+        fail (self, pError);
+        g_error_free (pError);
+
+        return;
+    }
+
+    self->pPrivate->nBackoff = 0;
+    self->pPrivate->nFailuresInRow = 0;
+    gint64 nSinceFull = (g_get_monotonic_time () - self->pPrivate->nLastFull) / G_USEC_PER_SEC;
+
+    if (self->pPrivate->bHashValid && nHash == self->pPrivate->nHash && nSinceFull < POLL_INTERVAL_MAX)
+    {
+        if (!self->pPrivate->bActive)
+        {
+            self->pPrivate->nInterval = MIN (self->pPrivate->nInterval * 2, POLL_INTERVAL_MAX);
+        }
+
+        schedule (self, self->pPrivate->nInterval);
+
+        return;
+    }
+
+    self->pPrivate->bChanged = !self->pPrivate->bHashValid || nHash != self->pPrivate->nHash;
+    self->pPrivate->nHash = nHash;
+    self->pPrivate->nFullQueries++;
+    printer_query_run_async (self->pPrivate->pConnection, NULL, self->pPrivate->pCancellable, onQueried, self);
+}
+
+static void pollServer (IndicatorRemoteServer *self)
+{
+    self->pPrivate->nPolls++;
+    printer_query_check_async (self->pPrivate->pConnection, self->pPrivate->pCancellable, onChecked, self);
+}
+
+static void onGetProperty (GObject *pObject, guint nProperty, GValue *pValue, GParamSpec *pSpec)
+{
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pObject);
+
+    switch (nProperty)
+    {
+        case PROP_POLLS:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nPolls);
+
+            break;
+        }
+        case PROP_FAILURES:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nFailures);
+
+            break;
+        }
+        case PROP_FULL_QUERIES:
+        {
+            g_value_set_uint (pValue, self->pPrivate->nFullQueries);
+
+            break;
+        }
+        default:
+        {
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, nProperty, pSpec);
+        }
+    }
+}
+
+static void onDispose (GObject *pObject)
+{
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pObject);
+
+    if (self->pPrivate->pCancellable != NULL)
+    {
+        indicator_remote_server_stop (self);
+        g_clear_object (&self->pPrivate->pCancellable);
+    }
+
+    g_clear_object (&self->pPrivate->pConnection);
+
+    G_OBJECT_CLASS (indicator_remote_server_parent_class)->dispose (pObject);
+}
+
+static void onFinalize (GObject *pObject)
+{
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pObject);
+
+    g_free (self->pPrivate->sName);
+
+    G_OBJECT_CLASS (indicator_remote_server_parent_class)->finalize (pObject);
+}
+
+static void indicator_remote_server_class_init (IndicatorRemoteServerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = onDispose;
+    object_class->finalize = onFinalize;
+    object_class->get_property = onGetProperty;
+    m_nSignal = g_signal_new ("updated", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
+    m_lProperties[PROP_POLLS] = g_param_spec_uint ("polls", "Polls", "Number of polls sent to the server", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_FAILURES] = g_param_spec_uint ("failures", "Failures", "Number of polls that failed", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    m_lProperties[PROP_FULL_QUERIES] = g_param_spec_uint ("full-queries", "Full queries", "Number of polls that were followed by a full query", 0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_properties (object_class, N_PROPERTIES, m_lProperties);
+}
+
+static void indicator_remote_server_init (IndicatorRemoteServer *self)
+{
+    self->pPrivate = indicator_remote_server_get_instance_private (self);
+    self->pPrivate->pCancellable = g_cancellable_new ();
+    self->pPrivate->nInterval = POLL_INTERVAL_ACTIVE;
+}
+
+// sServer is NULL for the default server
+IndicatorRemoteServer *indicator_remote_server_new (const gchar *sServer)
+{
+    GObject *pObject = g_object_new (INDICATOR_TYPE_REMOTE_SERVER, NULL);
+    IndicatorRemoteServer *self = INDICATOR_REMOTE_SERVER (pObject);
+    self->pPrivate->sName = g_strdup (sServer);
+    self->pPrivate->pConnection = sServer != NULL ? indicator_cups_connection_new_for_server (sServer) : indicator_cups_connection_new ();
+
+    return self;
+}
+
+// The server as configured, which also names its printers in the model, NULL for the default server
+const gchar *indicator_remote_server_get_name (IndicatorRemoteServer *self)
+{
+    return self->pPrivate->sName;
+}
+
+// Polls right away and then on its own, every change emits "updated", and so does a server that stays unreachable, with NULL
+void indicator_remote_server_start (IndicatorRemoteServer *self)
+{
+    if (!self->pPrivate->bRunning)
+    {
+        self->pPrivate->bRunning = TRUE;
+        self->pPrivate->nInterval = POLL_INTERVAL_ACTIVE;
+        self->pPrivate->bHashValid = FALSE;
+        pollServer (self);
+    }
+}
+
+void indicator_remote_server_stop (IndicatorRemoteServer *self)
+{
+    if (!self->pPrivate->bRunning)
+    {
+        return;
+    }
+
+    self->pPrivate->bRunning = FALSE;
+
+    if (self->pPrivate->nTimer)
+    {
+        g_source_remove (self->pPrivate->nTimer);
+        self->pPrivate->nTimer = 0;
+    }
+
+    // A poll that is still running must not report back
+    g_cancellable_cancel (self->pPrivate->pCancellable);
+    g_object_unref (self->pPrivate->pCancellable);
+    self->pPrivate->pCancellable = g_cancellable_new ();
+}
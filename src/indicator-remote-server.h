@@ -0,0 +1,53 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDICATOR_REMOTE_SERVER_H__
+#define __INDICATOR_REMOTE_SERVER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_REMOTE_SERVER(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), INDICATOR_TYPE_REMOTE_SERVER, IndicatorRemoteServer))
+#define INDICATOR_TYPE_REMOTE_SERVER (indicator_remote_server_get_type ())
+#define INDICATOR_IS_REMOTE_SERVER(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), INDICATOR_TYPE_REMOTE_SERVER))
+
+typedef struct _IndicatorRemoteServer IndicatorRemoteServer;
+typedef struct _IndicatorRemoteServerClass IndicatorRemoteServerClass;
+typedef struct _IndicatorRemoteServerPrivate IndicatorRemoteServerPrivate;
+
+struct _IndicatorRemoteServer
+{
+    GObject parent;
+    IndicatorRemoteServerPrivate *pPrivate;
+};
+
+struct _IndicatorRemoteServerClass
+{
+    GObjectClass parent_class;
+};
+
+GType indicator_remote_server_get_type (void);
+IndicatorRemoteServer *indicator_remote_server_new (const gchar *sServer);
+const gchar *indicator_remote_server_get_name (IndicatorRemoteServer *self);
+void indicator_remote_server_start (IndicatorRemoteServer *self);
+void indicator_remote_server_stop (IndicatorRemoteServer *self);
+
+G_END_DECLS
+
+#endif
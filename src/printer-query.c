@@ -0,0 +1,684 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cups/cups.h>
+#include <string.h>
+#include "printer-query.h"
+
+static void freeItem (gpointer pData)
+{
+    PrinterQueryItem *pItem = pData;
+
+    g_free (pItem->sName);
+    g_free (pItem->sReasons);
+    g_array_unref (pItem->lJobs);
+    g_free (pItem);
+}
+
+// Sorts the jobs of a single Get-Jobs response into the printers they were queued on
+static gboolean addJobs (IndicatorCupsConnection *pConnection, GHashTable *pPrinters, GError **pError)
+{
+    static const char * const lAttributes[] = {"job-id", "job-printer-uri", "job-state", "job-originating-user-name"};
+    const gchar *sUser = cupsUser ();
+    ipp_t *pRequest = ippNewRequest (IPP_GET_JOBS);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/");
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, sUser);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "which-jobs", NULL, "not-completed");
+    ippAddStrings (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", G_N_ELEMENTS (lAttributes), NULL, lAttributes);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pConnection, pRequest, "/", pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (pError, "Error getting jobs: ");
+
+        return FALSE;
+    }
+
+    for (ipp_attribute_t *pAttribute = ippFirstAttribute (pResponse); pAttribute != NULL; pAttribute = ippNextAttribute (pResponse))
+    {
+        while (pAttribute != NULL && ippGetGroupTag (pAttribute) != IPP_TAG_JOB)
+        {
+            pAttribute = ippNextAttribute (pResponse);
+        }
+
+        PrinterQueryJob cJob = {0, 0, FALSE};
+        const gchar *sPrinterUri = NULL;
+
+        for (; pAttribute != NULL && ippGetGroupTag (pAttribute) == IPP_TAG_JOB; pAttribute = ippNextAttribute (pResponse))
+        {
+            const gchar *sName = ippGetName (pAttribute);
+
+            if (g_strcmp0 (sName, "job-id") == 0)
+            {
+                cJob.nId = ippGetInteger (pAttribute, 0);
+            }
+            else if (g_strcmp0 (sName, "job-state") == 0)
+            {
+                cJob.nState = ippGetInteger (pAttribute, 0);
+            }
+            else if (g_strcmp0 (sName, "job-printer-uri") == 0)
+            {
+                sPrinterUri = ippGetString (pAttribute, 0, NULL);
+            }
+            else if (g_strcmp0 (sName, "job-originating-user-name") == 0)
+            {
+                cJob.bMine = g_strcmp0 (ippGetString (pAttribute, 0, NULL), sUser) == 0;
+            }
+        }
+
+        // ipp://host/printers/NAME or ipp://host/classes/NAME
+        const gchar *sPrinter = sPrinterUri != NULL ? strrchr (sPrinterUri, '/') : NULL;
+        PrinterQueryItem *pItem = sPrinter != NULL ? g_hash_table_lookup (pPrinters, sPrinter + 1) : NULL;
+
+        if (pItem != NULL && cJob.nId != 0)
+        {
+            g_array_append_val (pItem->lJobs, cJob);
+        }
+
+        if (pAttribute == NULL)
+        {
+            break;
+        }
+    }
+
+    ippDelete (pResponse);
+
+    return TRUE;
+}
+
+// Returns the destinations as IndicatorDestCacheEntry, one per queue
+static GPtrArray *getDests (IndicatorCupsConnection *pConnection, GError **pError)
+{
+    cups_dest_t *lDests;
+    gint nDests = indicator_cups_connection_get_dests (pConnection, &lDests, pError);
+
+    if (*pError != NULL)
+    {
+        return NULL;
+    }
+
+    GPtrArray *lEntries = g_ptr_array_new_with_free_func (indicator_dest_cache_entry_free);
+    GHashTable *pNames = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (gint i = 0; i < nDests; i++)
+    {
+        const gchar *sOption = cupsGetOption ("printer-state", lDests[i].num_options, lDests[i].options);
+
+        // Skip user instances of a queue that is already listed
+        if (sOption == NULL || g_hash_table_contains (pNames, lDests[i].name))
+        {
+            continue;
+        }
+
+        IndicatorDestCacheEntry *pEntry = indicator_dest_cache_entry_new (lDests[i].name, atoi (sOption), cupsGetOption ("printer-state-reasons", lDests[i].num_options, lDests[i].options));
+        g_ptr_array_add (lEntries, pEntry);
+        g_hash_table_add (pNames, pEntry->sName);
+    }
+
+    g_hash_table_destroy (pNames);
+    cupsFreeDests (nDests, lDests);
+
+    return lEntries;
+}
+
+/*
+ * Runs on a worker thread with a connection of its own from the pool.
+ * The active jobs of all printers and all users come from a single Get-Jobs request instead of one per destination.
+ * The destinations come from the cache if it is still valid.
+ */
+static void onRunInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    IndicatorCupsConnection *pConnection = pSource;
+    IndicatorDestCache *pCache = pData;
+    GError *pError = NULL;
+    guint nGeneration = 0;
+    GPtrArray *lEntries = pCache != NULL ? indicator_dest_cache_lookup (pCache, &nGeneration) : NULL;
+    gboolean bCached = (lEntries != NULL);
+
+    if (!bCached)
+    {
+        lEntries = getDests (pConnection, &pError);
+
+        if (pError != NULL)
+        {
+            g_task_return_error (pTask, pError);
+
+            return;
+        }
+    }
+
+    GPtrArray *lPrinters = g_ptr_array_new_with_free_func (freeItem);
+    GHashTable *pPrinters = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (guint i = 0; i < lEntries->len; i++)
+    {
+        IndicatorDestCacheEntry *pEntry = g_ptr_array_index (lEntries, i);
+        PrinterQueryItem *pItem = g_new0 (PrinterQueryItem, 1);
+        pItem->sName = g_strdup (pEntry->sName);
+        pItem->nState = pEntry->nState;
+        pItem->sReasons = g_strdup (pEntry->sReasons);
+        pItem->lJobs = g_array_new (FALSE, FALSE, sizeof (PrinterQueryJob));
+        g_ptr_array_add (lPrinters, pItem);
+        g_hash_table_insert (pPrinters, pItem->sName, pItem);
+    }
+
+    // After this, the entries belong to the cache and are only touched under its lock
+    if (pCache != NULL && !bCached)
+    {
+        indicator_dest_cache_store (pCache, lEntries, nGeneration);
+    }
+
+    g_ptr_array_unref (lEntries);
+
+    if (!g_cancellable_set_error_if_cancelled (pCancellable, &pError) && lPrinters->len > 0)
+    {
+        addJobs (pConnection, pPrinters, &pError);
+    }
+
+    g_hash_table_destroy (pPrinters);
+
+    if (pError != NULL)
+    {
+        g_ptr_array_unref (lPrinters);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    g_task_return_pointer (pTask, lPrinters, (GDestroyNotify) g_ptr_array_unref);
+}
+
+// pCache may be NULL to always ask cupsd for the destinations
+void printer_query_run_async (IndicatorCupsConnection *pConnection, IndicatorDestCache *pCache, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_run_async);
+
+    if (pCache != NULL)
+    {
+        g_task_set_task_data (pTask, g_object_ref (pCache), g_object_unref);
+    }
+
+    g_task_set_return_on_cancel (pTask, TRUE);
+    g_task_run_in_thread (pTask, onRunInThread);
+    g_object_unref (pTask);
+}
+
+GPtrArray *printer_query_run_finish (GAsyncResult *pResult, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), NULL);
+
+    return g_task_propagate_pointer (G_TASK (pResult), pError);
+}
+
+static void onJobOwnerInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    GError *pError = NULL;
+    guint nJobId = GPOINTER_TO_UINT (pData);
+    gchar *sUri = g_strdup_printf ("ipp://localhost/jobs/%u", nJobId);
+    ipp_t *pRequest = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, sUri);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", NULL, "job-originating-user-name");
+    g_free (sUri);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error getting attributes of job %u: ", nJobId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    ipp_attribute_t *pAttribute = ippFindAttribute (pResponse, "job-originating-user-name", IPP_TAG_NAME);
+    gboolean bMine = pAttribute != NULL && g_strcmp0 (ippGetString (pAttribute, 0, NULL), cupsUser ()) == 0;
+    ippDelete (pResponse);
+    g_task_return_boolean (pTask, bMine);
+}
+
+void printer_query_job_owner_async (IndicatorCupsConnection *pConnection, guint nJobId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_job_owner_async);
+    g_task_set_task_data (pTask, GUINT_TO_POINTER (nJobId), NULL);
+    g_task_set_return_on_cancel (pTask, TRUE);
+    g_task_run_in_thread (pTask, onJobOwnerInThread);
+    g_object_unref (pTask);
+}
+
+gboolean printer_query_job_owner_finish (GAsyncResult *pResult, guint *pJobId, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), FALSE);
+
+    if (pJobId != NULL)
+    {
+        *pJobId = GPOINTER_TO_UINT (g_task_get_task_data (G_TASK (pResult)));
+    }
+
+    return g_task_propagate_boolean (G_TASK (pResult), pError);
+}
+
+/*
+ * A single Get-Printers for the attributes that change with the state of a queue and with the
+ * number of its jobs. The hash of their values tells a poll whether a full query is needed.
+ */
+static void onCheckInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    static const gchar * const lAttributes[] = {"printer-name", "printer-state", "printer-state-change-time", "queued-job-count"};
+    GError *pError = NULL;
+    ipp_t *pRequest = ippNewRequest (CUPS_GET_PRINTERS);
+    ippAddStrings (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", G_N_ELEMENTS (lAttributes), NULL, lAttributes);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error checking printers: ");
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    guint32 nHash = 5381;
+
+    for (ipp_attribute_t *pAttribute = ippFirstAttribute (pResponse); pAttribute != NULL; pAttribute = ippNextAttribute (pResponse))
+    {
+        const gchar *sName = ippGetName (pAttribute);
+
+        if (sName == NULL)
+        {
+            // Separates two printers
+            nHash = nHash * 33;
+        }
+        else if (ippGetValueTag (pAttribute) == IPP_TAG_NAME)
+        {
+            nHash = nHash * 33 + g_str_hash (ippGetString (pAttribute, 0, NULL));
+        }
+        else if (ippGetValueTag (pAttribute) == IPP_TAG_INTEGER || ippGetValueTag (pAttribute) == IPP_TAG_ENUM)
+        {
+            nHash = nHash * 33 + (guint32) ippGetInteger (pAttribute, 0);
+        }
+    }
+
+    ippDelete (pResponse);
+    g_task_return_int (pTask, nHash & G_MAXINT32);
+}
+
+void printer_query_check_async (IndicatorCupsConnection *pConnection, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_check_async);
+    g_task_set_return_on_cancel (pTask, TRUE);
+    g_task_run_in_thread (pTask, onCheckInThread);
+    g_object_unref (pTask);
+}
+
+guint printer_query_check_finish (GAsyncResult *pResult, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), 0);
+
+    gssize nHash = g_task_propagate_int (G_TASK (pResult), pError);
+
+    return MAX (nHash, 0);
+}
+
+/*
+ * Only the size of the job, the job signals carry the rest. job-media-sheets is no fallback:
+ * it counts sheets, so the impressions of a duplex job would pass it halfway through.
+ */
+static void onJobImpressionsInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    GError *pError = NULL;
+    guint nJobId = GPOINTER_TO_UINT (pData);
+    gchar *sUri = g_strdup_printf ("ipp://localhost/jobs/%u", nJobId);
+    ipp_t *pRequest = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, sUri);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", NULL, "job-impressions");
+    g_free (sUri);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error getting the size of job %u: ", nJobId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    // Without it, no percentage is shown
+    ipp_attribute_t *pAttribute = ippFindAttribute (pResponse, "job-impressions", IPP_TAG_INTEGER);
+    gint nImpressions = pAttribute != NULL ? ippGetInteger (pAttribute, 0) : 0;
+
+    ippDelete (pResponse);
+    g_task_return_int (pTask, MAX (nImpressions, 0));
+}
+
+void printer_query_job_impressions_async (IndicatorCupsConnection *pConnection, guint nJobId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_job_impressions_async);
+    g_task_set_task_data (pTask, GUINT_TO_POINTER (nJobId), NULL);
+    g_task_set_return_on_cancel (pTask, TRUE);
+    g_task_run_in_thread (pTask, onJobImpressionsInThread);
+    g_object_unref (pTask);
+}
+
+guint printer_query_job_impressions_finish (GAsyncResult *pResult, guint *pJobId, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), 0);
+
+    if (pJobId != NULL)
+    {
+        *pJobId = GPOINTER_TO_UINT (g_task_get_task_data (G_TASK (pResult)));
+    }
+
+    gssize nImpressions = g_task_propagate_int (G_TASK (pResult), pError);
+
+    return MAX (nImpressions, 0);
+}
+
+typedef struct
+{
+    guint nJobId;
+    gint nSubscriptionId;
+    gint nLeaseDuration;
+    gchar **lEvents;
+} WatchData;
+
+static void freeWatchData (gpointer pData)
+{
+    WatchData *pWatchData = pData;
+
+    g_strfreev (pWatchData->lEvents);
+    g_free (pWatchData);
+}
+
+/*
+ * The subscription tasks do not check their cancellable on the way back: a subscription
+ * cupsd created for a caller that has given up would keep sending signals until its lease
+ * runs out, or its job ends. It is cancelled here instead, and the caller gets
+ * G_IO_ERROR_CANCELLED as with any other cancelled task.
+ */
+static gboolean dropIfCancelled (GTask *pTask, GError **pError)
+{
+    if (!g_cancellable_is_cancelled (g_task_get_cancellable (pTask)))
+    {
+        return FALSE;
+    }
+
+    WatchData *pWatchData = g_task_get_task_data (pTask);
+
+    if (pWatchData->nSubscriptionId > 0)
+    {
+        printer_query_cancel_subscription_async (g_task_get_source_object (pTask), pWatchData->nSubscriptionId, NULL, NULL, NULL);
+    }
+
+    g_set_error_literal (pError, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Operation was cancelled");
+
+    return TRUE;
+}
+
+static void onSubscribeInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    if (g_task_return_error_if_cancelled (pTask))
+    {
+        return;
+    }
+
+    GError *pError = NULL;
+    WatchData *pWatchData = pData;
+    ipp_t *pRequest = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
+    ippAddStrings (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-events", g_strv_length (pWatchData->lEvents), NULL, (const char * const *) pWatchData->lEvents);
+    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
+    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", pWatchData->nLeaseDuration);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error subscribing to CUPS notifications: ");
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    ipp_attribute_t *pAttribute = ippFindAttribute (pResponse, "notify-subscription-id", IPP_TAG_INTEGER);
+    gint nId = pAttribute != NULL ? ippGetInteger (pAttribute, 0) : 0;
+    ippDelete (pResponse);
+
+    if (nId <= 0)
+    {
+        g_task_return_new_error (pTask, G_IO_ERROR, G_IO_ERROR_FAILED, "ipp-create-printer-subscription response doesn't contain subscription id");
+
+        return;
+    }
+
+    pWatchData->nSubscriptionId = nId;
+    g_task_return_int (pTask, nId);
+}
+
+void printer_query_subscribe_async (IndicatorCupsConnection *pConnection, const gchar * const *lEvents, gint nLeaseDuration, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    WatchData *pWatchData = g_new0 (WatchData, 1);
+    pWatchData->nLeaseDuration = nLeaseDuration;
+    pWatchData->lEvents = g_strdupv ((gchar**) lEvents);
+
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_subscribe_async);
+    g_task_set_task_data (pTask, pWatchData, freeWatchData);
+    g_task_set_check_cancellable (pTask, FALSE);
+    g_task_run_in_thread (pTask, onSubscribeInThread);
+    g_object_unref (pTask);
+}
+
+gint printer_query_subscribe_finish (GAsyncResult *pResult, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), 0);
+
+    if (dropIfCancelled (G_TASK (pResult), pError))
+    {
+        return 0;
+    }
+
+    GError *pTaskError = NULL;
+    gint nId = g_task_propagate_int (G_TASK (pResult), &pTaskError);
+
+    if (pTaskError != NULL)
+    {
+        g_propagate_error (pError, pTaskError);
+
+        return 0;
+    }
+
+    return nId;
+}
+
+static void onRenewInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    GError *pError = NULL;
+    WatchData *pWatchData = pData;
+    ipp_t *pRequest = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+    ippAddInteger (pRequest, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", pWatchData->nSubscriptionId);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
+    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
+    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", pWatchData->nLeaseDuration);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error renewing CUPS subscription %d: ", pWatchData->nSubscriptionId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    ippDelete (pResponse);
+    g_task_return_boolean (pTask, TRUE);
+}
+
+void printer_query_renew_async (IndicatorCupsConnection *pConnection, gint nSubscriptionId, gint nLeaseDuration, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    WatchData *pWatchData = g_new0 (WatchData, 1);
+    pWatchData->nSubscriptionId = nSubscriptionId;
+    pWatchData->nLeaseDuration = nLeaseDuration;
+
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_renew_async);
+    g_task_set_task_data (pTask, pWatchData, freeWatchData);
+    g_task_run_in_thread (pTask, onRenewInThread);
+    g_object_unref (pTask);
+}
+
+gboolean printer_query_renew_finish (GAsyncResult *pResult, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (pResult), pError);
+}
+
+static void onCancelSubscriptionInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    GError *pError = NULL;
+    WatchData *pWatchData = pData;
+    ipp_t *pRequest = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "/");
+    ippAddInteger (pRequest, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", pWatchData->nSubscriptionId);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error cancelling CUPS subscription %d: ", pWatchData->nSubscriptionId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    ippDelete (pResponse);
+    g_task_return_boolean (pTask, TRUE);
+}
+
+/*
+ * pCallback may be NULL. The task keeps pConnection alive, so the subscription can be
+ * cancelled on the way out without waiting for cupsd. If the process exits first, the
+ * lease runs out on its own.
+ */
+void printer_query_cancel_subscription_async (IndicatorCupsConnection *pConnection, gint nSubscriptionId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    WatchData *pWatchData = g_new0 (WatchData, 1);
+    pWatchData->nSubscriptionId = nSubscriptionId;
+
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_cancel_subscription_async);
+    g_task_set_task_data (pTask, pWatchData, freeWatchData);
+    g_task_run_in_thread (pTask, onCancelSubscriptionInThread);
+    g_object_unref (pTask);
+}
+
+gboolean printer_query_cancel_subscription_finish (GAsyncResult *pResult, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (pResult), pError);
+}
+
+/*
+ * The job state is read after the subscription was created, so a job that finished in
+ * between is not missed. Job subscriptions have no lease, cupsd drops them with the job.
+ */
+static void onWatchJobInThread (GTask *pTask, gpointer pSource, gpointer pData, GCancellable *pCancellable)
+{
+    if (g_task_return_error_if_cancelled (pTask))
+    {
+        return;
+    }
+
+    GError *pError = NULL;
+    WatchData *pWatchData = pData;
+    ipp_t *pRequest = ippNewRequest (IPP_CREATE_JOB_SUBSCRIPTION);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/");
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddStrings (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-events", g_strv_length (pWatchData->lEvents), NULL, (const char * const *) pWatchData->lEvents);
+    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
+    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-job-id", pWatchData->nJobId);
+    ipp_t *pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error subscribing to job %u: ", pWatchData->nJobId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    ipp_attribute_t *pAttribute = ippFindAttribute (pResponse, "notify-subscription-id", IPP_TAG_INTEGER);
+    pWatchData->nSubscriptionId = pAttribute != NULL ? ippGetInteger (pAttribute, 0) : 0;
+    ippDelete (pResponse);
+    gchar *sUri = g_strdup_printf ("ipp://localhost/jobs/%u", pWatchData->nJobId);
+    pRequest = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, sUri);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", NULL, "job-state");
+    g_free (sUri);
+    pResponse = indicator_cups_connection_do_request (pSource, pRequest, "/", &pError);
+
+    if (pResponse == NULL)
+    {
+        g_prefix_error (&pError, "Error getting the state of job %u: ", pWatchData->nJobId);
+        g_task_return_error (pTask, pError);
+
+        return;
+    }
+
+    pAttribute = ippFindAttribute (pResponse, "job-state", IPP_TAG_ENUM);
+    gint nState = pAttribute != NULL ? ippGetInteger (pAttribute, 0) : IPP_JOB_PENDING;
+    ippDelete (pResponse);
+    g_task_return_int (pTask, nState);
+}
+
+void printer_query_watch_job_async (IndicatorCupsConnection *pConnection, guint nJobId, const gchar * const *lEvents, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData)
+{
+    WatchData *pWatchData = g_new0 (WatchData, 1);
+    pWatchData->nJobId = nJobId;
+    pWatchData->lEvents = g_strdupv ((gchar**) lEvents);
+
+    GTask *pTask = g_task_new (pConnection, pCancellable, pCallback, pData);
+    g_task_set_source_tag (pTask, printer_query_watch_job_async);
+    g_task_set_task_data (pTask, pWatchData, freeWatchData);
+    g_task_set_check_cancellable (pTask, FALSE);
+    g_task_run_in_thread (pTask, onWatchJobInThread);
+    g_object_unref (pTask);
+}
+
+gint printer_query_watch_job_finish (GAsyncResult *pResult, guint *pJobId, GError **pError)
+{
+    g_return_val_if_fail (G_IS_TASK (pResult), -1);
+
+    if (pJobId != NULL)
+    {
+        WatchData *pWatchData = g_task_get_task_data (G_TASK (pResult));
+        *pJobId = pWatchData->nJobId;
+    }
+
+    if (dropIfCancelled (G_TASK (pResult), pError))
+    {
+        return -1;
+    }
+
+    return g_task_propagate_int (G_TASK (pResult), pError);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Robert Tari
+ *
+ * Authors: Robert Tari <robert@tari.in>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PRINTER_QUERY_H__
+#define __PRINTER_QUERY_H__
+
+#include <gio/gio.h>
+#include "indicator-cups-connection.h"
+#include "indicator-dest-cache.h"
+
+G_BEGIN_DECLS
+
+typedef struct _PrinterQueryItem PrinterQueryItem;
+typedef struct _PrinterQueryJob PrinterQueryJob;
+
+struct _PrinterQueryJob
+{
+    guint nId;
+    gint nState;
+    gboolean bMine;
+};
+
+struct _PrinterQueryItem
+{
+    gchar *sName;
+    gint nState;
+    gchar *sReasons;
+    GArray *lJobs;
+};
+
+// All of these run on a worker thread with a connection from pConnection
+
+// Runs the CUPS queries on a worker thread and hands a GPtrArray of PrinterQueryItem back to the calling thread's main context
+void printer_query_run_async (IndicatorCupsConnection *pConnection, IndicatorDestCache *pCache, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+GPtrArray *printer_query_run_finish (GAsyncResult *pResult, GError **pError);
+
+// Looks up whether a job belongs to the current user
+void printer_query_job_owner_async (IndicatorCupsConnection *pConnection, guint nJobId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+gboolean printer_query_job_owner_finish (GAsyncResult *pResult, guint *pJobId, GError **pError);
+
+// Returns a hash of the state and the job count of every queue, which only changes with them
+void printer_query_check_async (IndicatorCupsConnection *pConnection, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+guint printer_query_check_finish (GAsyncResult *pResult, GError **pError);
+
+// Looks up the total number of impressions of a job, 0 if cupsd does not know it
+void printer_query_job_impressions_async (IndicatorCupsConnection *pConnection, guint nJobId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+guint printer_query_job_impressions_finish (GAsyncResult *pResult, guint *pJobId, GError **pError);
+
+// Creates a printer subscription for all queues with D-Bus notifications, returns the subscription id
+void printer_query_subscribe_async (IndicatorCupsConnection *pConnection, const gchar * const *lEvents, gint nLeaseDuration, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+gint printer_query_subscribe_finish (GAsyncResult *pResult, GError **pError);
+
+// Extends the lease of a subscription created by printer_query_subscribe_async ()
+void printer_query_renew_async (IndicatorCupsConnection *pConnection, gint nSubscriptionId, gint nLeaseDuration, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+gboolean printer_query_renew_finish (GAsyncResult *pResult, GError **pError);
+
+// Cancels a subscription
+void printer_query_cancel_subscription_async (IndicatorCupsConnection *pConnection, gint nSubscriptionId, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+gboolean printer_query_cancel_subscription_finish (GAsyncResult *pResult, GError **pError);
+
+// Subscribes to the given events of a single job, returns the job state at the time the subscription exists
+void printer_query_watch_job_async (IndicatorCupsConnection *pConnection, guint nJobId, const gchar * const *lEvents, GCancellable *pCancellable, GAsyncReadyCallback pCallback, gpointer pData);
+gint printer_query_watch_job_finish (GAsyncResult *pResult, guint *pJobId, GError **pError);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,266 @@
+
+/* Compares the per-destination cupsGetJobs () loop with the batched
+ * printer_query_run_async () against a stub IPP server with many queues,
+ * and the batched query with the destinations taken from an
+ * IndicatorDestCache, as after a job signal that needs a resync. */
+
+#include <gio/gio.h>
+#include <cups/cups.h>
+#include "printer-query.h"
+#include "stub-ipp-server.h"
+
+#define N_RUNS 3
+
+typedef struct
+{
+    guint nQueues;
+    GMainLoop *pLoop;
+    IndicatorCupsConnection *pConnection;
+    IndicatorDestCache *pCache;
+} Bench;
+
+static gboolean isRequested (ipp_t *pRequest, const gchar *sAttribute)
+{
+    ipp_attribute_t *pRequested = ippFindAttribute (pRequest, "requested-attributes", IPP_TAG_KEYWORD);
+
+    return pRequested == NULL || ippContainsString (pRequested, "all") || ippContainsString (pRequested, sAttribute);
+}
+
+static void addPrinters (ipp_t *pRequest, ipp_t *pResponse, guint nQueues)
+{
+    for (guint i = 0; i < nQueues; i++)
+    {
+        gchar *sName = g_strdup_printf ("queue-%04u", i);
+        gchar *sUri = g_strdup_printf ("ipp://localhost/printers/%s", sName);
+
+        ippAddSeparator (pResponse);
+        ippAddString (pResponse, IPP_TAG_PRINTER, IPP_TAG_NAME, "printer-name", NULL, sName);
+        ippAddString (pResponse, IPP_TAG_PRINTER, IPP_TAG_URI, "printer-uri-supported", NULL, sUri);
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_ENUM, "printer-state", IPP_PRINTER_PROCESSING);
+        ippAddString (pResponse, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "printer-state-reasons", NULL, "none");
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_ENUM, "printer-type", 0);
+        ippAddBoolean (pResponse, IPP_TAG_PRINTER, "printer-is-accepting-jobs", 1);
+
+        g_free (sUri);
+        g_free (sName);
+    }
+}
+
+// Two active jobs per queue: one of the current user, one of somebody else
+static void addJobs (ipp_t *pRequest, ipp_t *pResponse, guint nQueues)
+{
+    ipp_attribute_t *pAttribute = ippFindAttribute (pRequest, "printer-uri", IPP_TAG_URI);
+    const gchar *sPrinter = pAttribute != NULL ? strstr (ippGetString (pAttribute, 0, NULL), "/printers/") : NULL;
+    pAttribute = ippFindAttribute (pRequest, "my-jobs", IPP_TAG_BOOLEAN);
+    gboolean bMyJobs = pAttribute != NULL && ippGetBoolean (pAttribute, 0);
+
+    for (guint i = 0; i < nQueues * 2; i++)
+    {
+        gchar *sName = g_strdup_printf ("queue-%04u", i / 2);
+        gboolean bMine = (i % 2 == 0);
+
+        if ((sPrinter == NULL || g_str_equal (sPrinter + strlen ("/printers/"), sName)) && (bMine || !bMyJobs))
+        {
+            gchar *sUri = g_strdup_printf ("ipp://localhost/printers/%s", sName);
+
+            ippAddSeparator (pResponse);
+
+            if (isRequested (pRequest, "job-id"))
+            {
+                ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-id", i + 1);
+            }
+
+            if (isRequested (pRequest, "job-printer-uri"))
+            {
+                ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL, sUri);
+            }
+
+            if (isRequested (pRequest, "job-state"))
+            {
+                ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_ENUM, "job-state", IPP_JOB_PENDING);
+            }
+
+            if (isRequested (pRequest, "job-originating-user-name"))
+            {
+                ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_NAME, "job-originating-user-name", NULL, bMine ? cupsUser () : "somebody-else");
+            }
+
+            if (isRequested (pRequest, "job-name"))
+            {
+                ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_NAME, "job-name", NULL, "A long document");
+            }
+
+            if (isRequested (pRequest, "document-format"))
+            {
+                ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_MIMETYPE, "document-format", NULL, "application/pdf");
+            }
+
+            if (isRequested (pRequest, "job-k-octets"))
+            {
+                ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-k-octets", 1024);
+            }
+
+            if (isRequested (pRequest, "job-priority"))
+            {
+                ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-priority", 50);
+            }
+
+            if (isRequested (pRequest, "time-at-creation"))
+            {
+                ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "time-at-creation", 1000000);
+            }
+
+            g_free (sUri);
+        }
+
+        g_free (sName);
+    }
+}
+
+static ipp_t *onRequest (ipp_t *pRequest, gpointer pData)
+{
+    Bench *pBench = pData;
+    ipp_t *pResponse = ippNewResponse (pRequest);
+
+    switch (ippGetOperation (pRequest))
+    {
+        case CUPS_GET_PRINTERS:
+        {
+            addPrinters (pRequest, pResponse, pBench->nQueues);
+
+            break;
+        }
+        case IPP_GET_JOBS:
+        {
+            addJobs (pRequest, pResponse, pBench->nQueues);
+
+            break;
+        }
+        case CUPS_GET_DEFAULT:
+        {
+            ippSetStatusCode (pResponse, IPP_NOT_FOUND);
+
+            break;
+        }
+        default:
+        {
+            ippDelete (pResponse);
+
+            return NULL;
+        }
+    }
+
+    return pResponse;
+}
+
+// What createPrintersSection () used to do
+static guint runLoop ()
+{
+    cups_dest_t *lDests;
+    guint nJobsTotal = 0;
+    gint nDests = cupsGetDests (&lDests);
+
+    for (gint i = 0; i < nDests; i++)
+    {
+        cups_job_t *lJobs;
+        gint nJobs = cupsGetJobs (&lJobs, lDests[i].name, 1, CUPS_WHICHJOBS_ACTIVE);
+
+        cupsFreeJobs (nJobs, lJobs);
+        nJobsTotal += MAX (nJobs, 0);
+    }
+
+    cupsFreeDests (nDests, lDests);
+
+    return nJobsTotal;
+}
+
+static void onQueried (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    Bench *pBench = pData;
+    GError *pError = NULL;
+    GPtrArray *lPrinters = printer_query_run_finish (pResult, &pError);
+
+    g_assert_no_error (pError);
+    g_assert_cmpuint (lPrinters->len, ==, pBench->nQueues);
+    g_ptr_array_unref (lPrinters);
+    g_main_loop_quit (pBench->pLoop);
+}
+
+static void runBatched (Bench *pBench, IndicatorDestCache *pCache)
+{
+    printer_query_run_async (pBench->pConnection, pCache, NULL, onQueried, pBench);
+    g_main_loop_run (pBench->pLoop);
+}
+
+int main (int argc, char **argv)
+{
+    static const guint lSizes[] = {10, 100, 200, 1000};
+    Bench cBench = {0, g_main_loop_new (NULL, FALSE), NULL, NULL};
+    StubIppServer *pServer = stub_ipp_server_new (onRequest, &cBench);
+
+    if (pServer == NULL)
+    {
+        return 1;
+    }
+
+    // The environment reaches the worker threads' libcups globals as well
+    gchar *sAddress = stub_ipp_server_get_address (pServer);
+    g_setenv ("CUPS_SERVER", sAddress, TRUE);
+    g_free (sAddress);
+    cBench.pConnection = indicator_cups_connection_new ();
+    cBench.pCache = indicator_dest_cache_new ();
+
+    g_print ("%8s %14s %12s %14s %12s %15s %12s\n", "queues", "loop requests", "loop ms", "batch requests", "batch ms", "cached requests", "cached ms");
+
+    for (guint i = 0; i < G_N_ELEMENTS (lSizes); i++)
+    {
+        stub_ipp_server_lock (pServer);
+        cBench.nQueues = lSizes[i];
+        stub_ipp_server_unlock (pServer);
+
+        gint64 nStart = g_get_monotonic_time ();
+        stub_ipp_server_reset_n_requests (pServer);
+
+        for (guint j = 0; j < N_RUNS; j++)
+        {
+            g_assert_cmpuint (runLoop (), ==, lSizes[i]);
+        }
+
+        gdouble fLoopMs = (g_get_monotonic_time () - nStart) / 1000.0 / N_RUNS;
+        guint nLoopRequests = stub_ipp_server_get_n_requests (pServer) / N_RUNS;
+
+        nStart = g_get_monotonic_time ();
+        stub_ipp_server_reset_n_requests (pServer);
+
+        for (guint j = 0; j < N_RUNS; j++)
+        {
+            runBatched (&cBench, NULL);
+        }
+
+        gdouble fBatchMs = (g_get_monotonic_time () - nStart) / 1000.0 / N_RUNS;
+        guint nBatchRequests = stub_ipp_server_get_n_requests (pServer) / N_RUNS;
+
+        // Fill the cache outside of the measurement, as the first resync after a change would
+        indicator_dest_cache_invalidate (cBench.pCache);
+        runBatched (&cBench, cBench.pCache);
+        nStart = g_get_monotonic_time ();
+        stub_ipp_server_reset_n_requests (pServer);
+
+        for (guint j = 0; j < N_RUNS; j++)
+        {
+            runBatched (&cBench, cBench.pCache);
+        }
+
+        gdouble fCachedMs = (g_get_monotonic_time () - nStart) / 1000.0 / N_RUNS;
+        guint nCachedRequests = stub_ipp_server_get_n_requests (pServer) / N_RUNS;
+
+        g_print ("%8u %14u %12.2f %14u %12.2f %15u %12.2f\n", lSizes[i], nLoopRequests, fLoopMs, nBatchRequests, fBatchMs, nCachedRequests, fCachedMs);
+    }
+
+    g_object_unref (cBench.pCache);
+    g_object_unref (cBench.pConnection);
+    stub_ipp_server_free (pServer);
+    g_main_loop_unref (cBench.pLoop);
+
+    return 0;
+}
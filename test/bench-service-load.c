@@ -0,0 +1,345 @@
+
+/* Runs ayatana-indicator-printers-service on a private dbus-daemon against a
+ * stub IPP server and replays mock-cups-notifier load streams at it. For every
+ * scenario, reports the latency from a menu-changing signal to the next menu
+ * update, the number of menu updates, and the service's CPU time and peak RSS. */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <cups/cups.h>
+#include "stub-ipp-server.h"
+
+#define SERVICE_NAME "org.ayatana.indicator.printers"
+#define MENU_PATH "/org/ayatana/indicator/printers/desktop"
+#define NOTIFIER_PATH "/org/cups/cupsd/Notifier"
+#define SETTLE_MS 2000
+
+typedef struct
+{
+    const gchar *sName;
+    const gchar *lArgs[16];
+} Scenario;
+
+static const Scenario lScenarios[] =
+{
+    {"10x5 steady", {"--printers", "10", "--jobs", "5", "--burst", "1", "--interval", "20", NULL}},
+    {"10x5 bursts", {"--printers", "10", "--jobs", "5", "--burst", "50", "--interval", "100", NULL}},
+    {"100x10 bursts", {"--printers", "100", "--jobs", "10", "--burst", "100", "--interval", "50", NULL}},
+    {"20x5 progress", {"--printers", "20", "--jobs", "5", "--burst", "10", "--interval", "50", "--progress-rate", "200", "--duration", "5", NULL}}
+};
+
+typedef struct
+{
+    GMainLoop *pLoop;
+    // Emission times of the signals that wait for a menu update
+    GArray *lPending;
+    GArray *lLatencies;
+    guint nMenuUpdates;
+    gint bSubscribed;
+} Bench;
+
+static ipp_t *onRequest (ipp_t *pRequest, gpointer pData)
+{
+    Bench *pBench = pData;
+    ipp_t *pResponse = ippNewResponse (pRequest);
+
+    switch (ippGetOperation (pRequest))
+    {
+        // No printers and no jobs until the notifier says so
+        case CUPS_GET_PRINTERS:
+        case IPP_GET_JOBS:
+        case IPP_RENEW_SUBSCRIPTION:
+        case IPP_CANCEL_SUBSCRIPTION:
+        {
+            break;
+        }
+        case CUPS_GET_DEFAULT:
+        {
+            ippSetStatusCode (pResponse, IPP_NOT_FOUND);
+
+            break;
+        }
+        case IPP_CREATE_PRINTER_SUBSCRIPTION:
+        case IPP_CREATE_JOB_SUBSCRIPTION:
+        {
+            ippAddInteger (pResponse, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-subscription-id", 1);
+            g_atomic_int_set (&pBench->bSubscribed, TRUE);
+
+            break;
+        }
+        // Every job of the load stream belongs to the user running the service
+        case IPP_GET_JOB_ATTRIBUTES:
+        {
+            ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_NAME, "job-originating-user-name", NULL, cupsUser ());
+            ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_ENUM, "job-state", IPP_JOB_PROCESSING);
+
+            break;
+        }
+        default:
+        {
+            ippDelete (pResponse);
+
+            return NULL;
+        }
+    }
+
+    return pResponse;
+}
+
+static void onNotifierSignal (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    Bench *pBench = pData;
+    const gchar *sText;
+
+    g_variant_get_child (pParameters, 0, "&s", &sText);
+
+    if (g_str_has_prefix (sText, "t="))
+    {
+        gint64 nEmitted = g_ascii_strtoll (sText + 2, NULL, 10);
+        g_array_append_val (pBench->lPending, nEmitted);
+    }
+}
+
+// A signal is attributed to the first menu update after it
+static void onMenuChanged (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    Bench *pBench = pData;
+    gint64 nNow = g_get_monotonic_time ();
+
+    pBench->nMenuUpdates++;
+
+    for (guint i = 0; i < pBench->lPending->len; i++)
+    {
+        gint64 nLatency = nNow - g_array_index (pBench->lPending, gint64, i);
+        g_array_append_val (pBench->lLatencies, nLatency);
+    }
+
+    g_array_set_size (pBench->lPending, 0);
+}
+
+static gboolean onTimeout (gpointer pData)
+{
+    g_main_loop_quit (pData);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void spin (GMainLoop *pLoop, guint nMs)
+{
+    g_timeout_add (nMs, onTimeout, pLoop);
+    g_main_loop_run (pLoop);
+}
+
+static void onStarted (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    GVariant *pReply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (pObject), pResult, NULL);
+
+    g_assert_nonnull (pReply);
+    g_variant_unref (pReply);
+    g_main_loop_quit (pData);
+}
+
+// Subscribes to the root menu and to the submenu holding the printers section, like a panel would
+static void startMenu (GDBusConnection *pConnection, GMainLoop *pLoop)
+{
+    for (guint nGroup = 0; nGroup < 2; nGroup++)
+    {
+        g_dbus_connection_call (pConnection, SERVICE_NAME, MENU_PATH, "org.gtk.Menus", "Start", g_variant_new_parsed ("([%u],)", nGroup), G_VARIANT_TYPE ("(a(uuaa{sv}))"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, onStarted, pLoop);
+        g_main_loop_run (pLoop);
+    }
+}
+
+static gint compareLatencies (gconstpointer pA, gconstpointer pB)
+{
+    gint64 nA = *(const gint64*) pA;
+    gint64 nB = *(const gint64*) pB;
+
+    return (nA > nB) - (nA < nB);
+}
+
+static gdouble getPercentile (GArray *lLatencies, guint nPercent)
+{
+    if (lLatencies->len == 0)
+    {
+        return 0;
+    }
+
+    return g_array_index (lLatencies, gint64, (lLatencies->len - 1) * nPercent / 100) / 1000.0;
+}
+
+// User plus system CPU time in ms and peak RSS in KiB, from /proc
+static void getUsage (const gchar *sPid, gdouble *fCpuMs, guint64 *nPeakRss)
+{
+    gchar *sPath = g_strdup_printf ("/proc/%s/stat", sPid);
+    gchar *sStat = NULL;
+
+    *fCpuMs = 0;
+    *nPeakRss = 0;
+
+    if (g_file_get_contents (sPath, &sStat, NULL, NULL))
+    {
+        // The fields after the command, which may contain spaces
+        gchar **lFields = g_strsplit (strrchr (sStat, ')') + 2, " ", -1);
+
+        if (g_strv_length (lFields) > 12)
+        {
+            guint64 nTicks = g_ascii_strtoull (lFields[11], NULL, 10) + g_ascii_strtoull (lFields[12], NULL, 10);
+            *fCpuMs = nTicks * 1000.0 / sysconf (_SC_CLK_TCK);
+        }
+
+        g_strfreev (lFields);
+        g_free (sStat);
+    }
+
+    g_free (sPath);
+    sPath = g_strdup_printf ("/proc/%s/status", sPid);
+
+    if (g_file_get_contents (sPath, &sStat, NULL, NULL))
+    {
+        const gchar *sPeak = strstr (sStat, "VmHWM:");
+
+        if (sPeak != NULL)
+        {
+            *nPeakRss = g_ascii_strtoull (sPeak + strlen ("VmHWM:"), NULL, 10);
+        }
+
+        g_free (sStat);
+    }
+
+    g_free (sPath);
+}
+
+static void onMockExited (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    g_subprocess_wait_finish (G_SUBPROCESS (pObject), pResult, NULL);
+    g_main_loop_quit (pData);
+}
+
+static void runScenario (Bench *pBench, GSubprocessLauncher *pLauncher, const Scenario *pScenario, const gchar *sPid, guint *nFirstJobId)
+{
+    GPtrArray *lArgs = g_ptr_array_new_with_free_func (g_free);
+    guint nPrinters = 0;
+    guint nJobs = 0;
+
+    g_ptr_array_add (lArgs, g_strdup (MOCK_CUPS_NOTIFIER));
+
+    for (guint i = 0; pScenario->lArgs[i] != NULL; i++)
+    {
+        g_ptr_array_add (lArgs, g_strdup (pScenario->lArgs[i]));
+
+        if (g_str_equal (pScenario->lArgs[i], "--printers"))
+        {
+            nPrinters = atoi (pScenario->lArgs[i + 1]);
+        }
+        else if (g_str_equal (pScenario->lArgs[i], "--jobs"))
+        {
+            nJobs = atoi (pScenario->lArgs[i + 1]);
+        }
+    }
+
+    g_ptr_array_add (lArgs, g_strdup ("--first-job-id"));
+    g_ptr_array_add (lArgs, g_strdup_printf ("%u", *nFirstJobId));
+    g_ptr_array_add (lArgs, NULL);
+    *nFirstJobId += nPrinters * nJobs;
+
+    gdouble fCpuBefore;
+    guint64 nPeakRss;
+    getUsage (sPid, &fCpuBefore, &nPeakRss);
+    g_array_set_size (pBench->lPending, 0);
+    g_array_set_size (pBench->lLatencies, 0);
+    pBench->nMenuUpdates = 0;
+
+    GError *pError = NULL;
+    GSubprocess *pMock = g_subprocess_launcher_spawnv (pLauncher, (const gchar * const *) lArgs->pdata, &pError);
+    g_assert_no_error (pError);
+    g_subprocess_wait_async (pMock, NULL, onMockExited, pBench->pLoop);
+    g_main_loop_run (pBench->pLoop);
+    g_object_unref (pMock);
+    g_ptr_array_unref (lArgs);
+
+    // Let the last rebuilds through
+    spin (pBench->pLoop, SETTLE_MS);
+
+    gdouble fCpuAfter;
+    getUsage (sPid, &fCpuAfter, &nPeakRss);
+    g_array_sort (pBench->lLatencies, compareLatencies);
+
+    g_print ("%-16s %8u %8u %8.1f %8.1f %8.1f %8.1f %10.1f %10" G_GUINT64_FORMAT "\n", pScenario->sName, pBench->lLatencies->len, pBench->nMenuUpdates, getPercentile (pBench->lLatencies, 50), getPercentile (pBench->lLatencies, 90), getPercentile (pBench->lLatencies, 99), getPercentile (pBench->lLatencies, 100), fCpuAfter - fCpuBefore, nPeakRss);
+}
+
+static void onNameAppeared (GDBusConnection *pConnection, const gchar *sName, const gchar *sOwner, gpointer pData)
+{
+    g_main_loop_quit (pData);
+}
+
+int main (int argc, char **argv)
+{
+    Bench cBench = {g_main_loop_new (NULL, FALSE), g_array_new (FALSE, FALSE, sizeof (gint64)), g_array_new (FALSE, FALSE, sizeof (gint64)), 0, FALSE};
+    StubIppServer *pServer = stub_ipp_server_new (onRequest, &cBench);
+
+    if (pServer == NULL)
+    {
+        return 1;
+    }
+
+    // One private bus serves as both the session and the system bus
+    GTestDBus *pBus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (pBus);
+    const gchar *sBusAddress = g_test_dbus_get_bus_address (pBus);
+    GDBusConnection *pConnection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert_nonnull (pConnection);
+
+    gchar *sCupsServer = stub_ipp_server_get_address (pServer);
+    GSubprocessLauncher *pLauncher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_setenv (pLauncher, "DBUS_SESSION_BUS_ADDRESS", sBusAddress, TRUE);
+    g_subprocess_launcher_setenv (pLauncher, "DBUS_SYSTEM_BUS_ADDRESS", sBusAddress, TRUE);
+    g_subprocess_launcher_setenv (pLauncher, "CUPS_SERVER", sCupsServer, TRUE);
+    g_subprocess_launcher_setenv (pLauncher, "GSETTINGS_BACKEND", "memory", TRUE);
+    g_free (sCupsServer);
+
+    GError *pError = NULL;
+    GSubprocess *pService = g_subprocess_launcher_spawn (pLauncher, &pError, SERVICE_BINARY, NULL);
+    g_assert_no_error (pError);
+    const gchar *sPid = g_subprocess_get_identifier (pService);
+
+    guint nWatch = g_bus_watch_name_on_connection (pConnection, SERVICE_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE, onNameAppeared, NULL, cBench.pLoop, NULL);
+    g_main_loop_run (cBench.pLoop);
+    g_bus_unwatch_name (nWatch);
+
+    // The service subscribes once its notifier proxy is ready
+    while (!g_atomic_int_get (&cBench.bSubscribed))
+    {
+        spin (cBench.pLoop, 10);
+    }
+
+    startMenu (pConnection, cBench.pLoop);
+    guint nNotifier = g_dbus_connection_signal_subscribe (pConnection, NULL, "org.cups.cupsd.Notifier", NULL, NOTIFIER_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onNotifierSignal, &cBench, NULL);
+    guint nMenu = g_dbus_connection_signal_subscribe (pConnection, SERVICE_NAME, "org.gtk.Menus", "Changed", MENU_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onMenuChanged, &cBench, NULL);
+    guint nFirstJobId = 1;
+
+    g_print ("%-16s %8s %8s %8s %8s %8s %8s %10s %10s\n", "scenario", "signals", "updates", "p50 ms", "p90 ms", "p99 ms", "max ms", "cpu ms", "peak KiB");
+
+    for (guint i = 0; i < G_N_ELEMENTS (lScenarios); i++)
+    {
+        runScenario (&cBench, pLauncher, &lScenarios[i], sPid, &nFirstJobId);
+    }
+
+    g_dbus_connection_signal_unsubscribe (pConnection, nMenu);
+    g_dbus_connection_signal_unsubscribe (pConnection, nNotifier);
+    g_subprocess_send_signal (pService, SIGTERM);
+    g_subprocess_wait (pService, NULL, NULL);
+    g_object_unref (pService);
+    g_object_unref (pLauncher);
+    g_object_unref (pConnection);
+    g_test_dbus_down (pBus);
+    g_object_unref (pBus);
+    stub_ipp_server_free (pServer);
+    g_array_unref (cBench.lLatencies);
+    g_array_unref (cBench.lPending);
+    g_main_loop_unref (cBench.pLoop);
+
+    return 0;
+}
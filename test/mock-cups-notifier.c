@@ -1,17 +1,195 @@
 
 #include <glib.h>
+#include <cups/cups.h>
 #include <cups-notifier.h>
 
+/*
+ * Without options, emits a single PrinterStateChanged and exits.
+ *
+ * With --printers, replays a load stream: every job is created, updated
+ * with progress signals for --duration seconds and completed. Signals that
+ * change the indicator's menu carry their emission time (monotonic clock)
+ * as "t=<usec>" in the text argument, which bench-service-load uses to
+ * measure the latency up to the menu update.
+ */
+
+static gint n_printers = 0;
+static gint n_jobs = 1;
+static gint burst = 1;
+static gint interval = 100;
+static gint progress_rate = 0;
+static gint duration = 0;
+static gint first_job_id = 1;
+
+static GOptionEntry entries[] =
+{
+    { "printers", 'p', 0, G_OPTION_ARG_INT, &n_printers, "Number of printers to replay signals for", "N" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs, "Number of jobs per printer", "M" },
+    { "burst", 'b', 0, G_OPTION_ARG_INT, &burst, "Number of signals emitted back to back", "K" },
+    { "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "Milliseconds between bursts", "MS" },
+    { "progress-rate", 'r', 0, G_OPTION_ARG_INT, &progress_rate, "JobProgress signals per second", "HZ" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds of progress signals", "S" },
+    { "first-job-id", 0, 0, G_OPTION_ARG_INT, &first_job_id, "Id of the first job", "ID" },
+    { NULL }
+};
+
+enum
+{
+    PHASE_CREATE,
+    PHASE_PROGRESS,
+    PHASE_COMPLETE
+};
+
+typedef struct
+{
+    CupsNotifier *notifier;
+    GMainLoop *loop;
+    gint phase;
+    gint next;
+    gint64 progress_end;
+    guint impressions;
+} Load;
+
+static gchar *
+printer_name (gint job)
+{
+    return g_strdup_printf ("printer-%03d", job % n_printers);
+}
+
+static gchar *
+timestamp (void)
+{
+    return g_strdup_printf ("t=%" G_GINT64_FORMAT, g_get_monotonic_time ());
+}
+
+static void
+emit_job (Load *load,
+          gint job,
+          guint job_state,
+          gboolean tracked)
+{
+    gchar *name = printer_name (job);
+    gchar *uri = g_strdup_printf ("ipp://localhost/printers/%s", name);
+    gchar *text = tracked ? timestamp () : g_strdup ("Job progress");
+
+    switch (load->phase)
+    {
+        case PHASE_CREATE:
+            cups_notifier_emit_job_created (load->notifier, text, uri, name, IPP_PRINTER_PROCESSING, "none", TRUE,
+                                            first_job_id + job, job_state, "none", "Load test", 0);
+            break;
+
+        case PHASE_PROGRESS:
+            cups_notifier_emit_job_progress (load->notifier, text, uri, name, IPP_PRINTER_PROCESSING, "none", TRUE,
+                                             first_job_id + job, job_state, "job-printing", "Load test", ++load->impressions);
+            break;
+
+        case PHASE_COMPLETE:
+            cups_notifier_emit_job_completed (load->notifier, text, uri, name, IPP_PRINTER_IDLE, "none", TRUE,
+                                              first_job_id + job, job_state, "job-completed-successfully", "Load test", load->impressions);
+            break;
+    }
+
+    g_free (text);
+    g_free (uri);
+    g_free (name);
+}
+
+static gboolean
+on_progress (gpointer user_data)
+{
+    Load *load = user_data;
+
+    if (g_get_monotonic_time () >= load->progress_end)
+    {
+        load->phase = PHASE_COMPLETE;
+        load->next = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    emit_job (load, g_random_int_range (0, n_printers * n_jobs), IPP_JOB_PROCESSING, FALSE);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_burst (gpointer user_data)
+{
+    Load *load = user_data;
+    gint total = n_printers * n_jobs;
+
+    if (load->phase == PHASE_PROGRESS)
+        return G_SOURCE_CONTINUE;
+
+    for (gint i = 0; i < burst && load->next < total; i++, load->next++)
+        emit_job (load, load->next, load->phase == PHASE_CREATE ? IPP_JOB_PENDING : IPP_JOB_COMPLETED, TRUE);
+
+    if (load->next < total)
+        return G_SOURCE_CONTINUE;
+
+    if (load->phase == PHASE_CREATE)
+    {
+        if (progress_rate > 0 && duration > 0)
+        {
+            load->phase = PHASE_PROGRESS;
+            load->progress_end = g_get_monotonic_time () + duration * G_USEC_PER_SEC;
+            g_timeout_add (MAX (1000 / progress_rate, 1), on_progress, load);
+        }
+        else
+        {
+            load->phase = PHASE_COMPLETE;
+        }
+
+        load->next = 0;
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_main_loop_quit (load->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+replay (CupsNotifier *notifier,
+        GDBusConnection *con)
+{
+    Load load = { notifier, g_main_loop_new (NULL, FALSE), PHASE_CREATE, 0, 0, 0 };
+
+    for (gint i = 0; i < n_printers; i++)
+    {
+        gchar *name = printer_name (i);
+        gchar *uri = g_strdup_printf ("ipp://localhost/printers/%s", name);
+
+        cups_notifier_emit_printer_state_changed (notifier, "Printer state changed!", uri, name,
+                                                  IPP_PRINTER_PROCESSING, "none", TRUE);
+        g_free (uri);
+        g_free (name);
+    }
+
+    g_timeout_add (MAX (interval, 1), on_burst, &load);
+    g_main_loop_run (load.loop);
+    g_dbus_connection_flush_sync (con, NULL, NULL);
+    g_main_loop_unref (load.loop);
+}
 
 int main (int argc, char **argv)
 {
     GMainLoop *loop;
     CupsNotifier *notifier = NULL;
-    GDBusConnection *con;
+    GDBusConnection *con = NULL;
+    GOptionContext *context;
     GError *error = NULL;
 
     loop = g_main_loop_new (NULL, FALSE);
 
+    context = g_option_context_new ("- emit CUPS notifier signals");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        goto out;
+    }
+    g_option_context_free (context);
+
     con = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
     if (error) {
         g_printerr ("Error getting system bus: %s\n", error->message);
@@ -31,6 +209,11 @@ int main (int argc, char **argv)
         goto out;
     }
 
+    if (n_printers > 0) {
+        replay (notifier, con);
+        goto out;
+    }
+
     cups_notifier_emit_printer_state_changed (notifier,
                                               "Printer state changed!",
                                               "file:///tmp/print",
@@ -47,4 +230,3 @@ out:
     g_main_loop_unref (loop);
     return 0;
 }
-
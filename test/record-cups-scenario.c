@@ -0,0 +1,280 @@
+
+/* Records a scenario for test-replay from the local cupsd: the queues and the active
+ * jobs as state lines, followed by every Notifier signal until interrupted. Each job
+ * signal is preceded by the state line of its job, with its owner and total looked up
+ * once, so the stub IPP server of the replay answers the service's requests like cupsd
+ * did. The gaps between the signals become wait lines of at most MAX_WAIT_MS.
+ *
+ *   record-cups-scenario [FILE]
+ *
+ * The recorder creates a dbus:// subscription of its own, so cupsd emits the signals
+ * whether the indicator runs or not. The golden file of a new scenario is written by
+ * running test-replay --update on it. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <cups/cups.h>
+
+#define NOTIFIER_PATH "/org/cups/cupsd/Notifier"
+#define NOTIFIER_INTERFACE "org.cups.cupsd.Notifier"
+#define LEASE_DURATION (24 * 60 * 60)
+#define MAX_WAIT_MS 2000
+
+typedef struct
+{
+    gchar *sUser;
+    guint nTotal;
+} RecordedJob;
+
+typedef struct
+{
+    FILE *pFile;
+    GMainLoop *pLoop;
+    gint64 nLast;
+    // Job id -> RecordedJob
+    GHashTable *pJobs;
+} Recorder;
+
+static void freeJob (gpointer pData)
+{
+    RecordedJob *pJob = pData;
+
+    g_free (pJob->sUser);
+    g_free (pJob);
+}
+
+// The owner as written to the scenario, "-" for the current user, and the job-impressions
+static RecordedJob *lookupJob (Recorder *pRecorder, guint nJobId)
+{
+    RecordedJob *pJob = g_hash_table_lookup (pRecorder->pJobs, GUINT_TO_POINTER (nJobId));
+
+    if (pJob != NULL)
+    {
+        return pJob;
+    }
+
+    static const char * const lAttributes[] = {"job-originating-user-name", "job-impressions"};
+    gchar *sUri = g_strdup_printf ("ipp://localhost/jobs/%u", nJobId);
+    ipp_t *pRequest = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, sUri);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddStrings (pRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", G_N_ELEMENTS (lAttributes), NULL, lAttributes);
+    g_free (sUri);
+    ipp_t *pResponse = cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/");
+    ipp_attribute_t *pUser = pResponse != NULL ? ippFindAttribute (pResponse, "job-originating-user-name", IPP_TAG_NAME) : NULL;
+    ipp_attribute_t *pTotal = pResponse != NULL ? ippFindAttribute (pResponse, "job-impressions", IPP_TAG_INTEGER) : NULL;
+    const gchar *sUser = pUser != NULL ? ippGetString (pUser, 0, NULL) : NULL;
+
+    pJob = g_new0 (RecordedJob, 1);
+    // A job cupsd does not tell about is taken for somebody else's
+    pJob->sUser = g_strdup (sUser == NULL ? "unknown" : g_str_equal (sUser, cupsUser ()) ? "-" : sUser);
+    pJob->nTotal = pTotal != NULL ? MAX (ippGetInteger (pTotal, 0), 0) : 0;
+    g_hash_table_insert (pRecorder->pJobs, GUINT_TO_POINTER (nJobId), pJob);
+    ippDelete (pResponse);
+
+    return pJob;
+}
+
+static const gchar *getReasons (const gchar *sReasons)
+{
+    return sReasons != NULL && *sReasons != '\0' ? sReasons : "none";
+}
+
+static void writeJob (Recorder *pRecorder, guint nJobId, const gchar *sPrinter, guint nState)
+{
+    RecordedJob *pJob = lookupJob (pRecorder, nJobId);
+
+    fprintf (pRecorder->pFile, "job %u %s %u %s", nJobId, sPrinter, nState, pJob->sUser);
+
+    if (pJob->nTotal > 0)
+    {
+        fprintf (pRecorder->pFile, " %u", pJob->nTotal);
+    }
+
+    fputc ('\n', pRecorder->pFile);
+}
+
+static void writeSnapshot (Recorder *pRecorder)
+{
+    cups_dest_t *lDests;
+    gint nDests = cupsGetDests (&lDests);
+
+    fprintf (pRecorder->pFile, "# Recorded from %s\n", cupsServer ());
+
+    for (gint i = 0; i < nDests; i++)
+    {
+        // Instances share the queue
+        if (lDests[i].instance != NULL)
+        {
+            continue;
+        }
+
+        const gchar *sState = cupsGetOption ("printer-state", lDests[i].num_options, lDests[i].options);
+        const gchar *sReasons = cupsGetOption ("printer-state-reasons", lDests[i].num_options, lDests[i].options);
+        fprintf (pRecorder->pFile, "printer %s %s %s\n", lDests[i].name, sState != NULL ? sState : "3", getReasons (sReasons));
+    }
+
+    cupsFreeDests (nDests, lDests);
+
+    cups_job_t *lJobs;
+    gint nJobs = cupsGetJobs (&lJobs, NULL, 0, CUPS_WHICHJOBS_ACTIVE);
+
+    for (gint i = 0; i < nJobs; i++)
+    {
+        writeJob (pRecorder, lJobs[i].id, lJobs[i].dest, lJobs[i].state);
+    }
+
+    cupsFreeJobs (nJobs, lJobs);
+
+    // The menu the service starts with
+    fprintf (pRecorder->pFile, "dump\n");
+    fflush (pRecorder->pFile);
+    pRecorder->nLast = g_get_monotonic_time ();
+}
+
+static void onSignal (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    Recorder *pRecorder = pData;
+    gint64 nNow = g_get_monotonic_time ();
+    gint64 nWait = MIN ((nNow - pRecorder->nLast) / 1000, MAX_WAIT_MS);
+    pRecorder->nLast = nNow;
+
+    if (nWait > 0)
+    {
+        fprintf (pRecorder->pFile, "wait %" G_GINT64_FORMAT "\n", nWait);
+    }
+
+    // The printer and job signals all start with (text, uri, name, state, reasons, accepting)
+    if (g_variant_n_children (pParameters) >= 6)
+    {
+        const gchar *sPrinter;
+        guint nState;
+        const gchar *sReasons;
+        g_variant_get_child (pParameters, 2, "&s", &sPrinter);
+        g_variant_get_child (pParameters, 3, "u", &nState);
+        g_variant_get_child (pParameters, 4, "&s", &sReasons);
+
+        if (g_str_equal (sSignal, "PrinterDeleted"))
+        {
+            fprintf (pRecorder->pFile, "delete-printer %s\n", sPrinter);
+        }
+        else
+        {
+            fprintf (pRecorder->pFile, "printer %s %u %s\n", sPrinter, nState, getReasons (sReasons));
+        }
+
+        if (g_str_has_prefix (sSignal, "Job") && g_variant_n_children (pParameters) >= 8)
+        {
+            guint nJobId;
+            guint nJobState;
+            g_variant_get_child (pParameters, 6, "u", &nJobId);
+            g_variant_get_child (pParameters, 7, "u", &nJobState);
+            writeJob (pRecorder, nJobId, sPrinter, nJobState);
+        }
+    }
+
+    gchar *sArguments = g_variant_print (pParameters, FALSE);
+    fprintf (pRecorder->pFile, "signal %s %s\n", sSignal, sArguments);
+    fflush (pRecorder->pFile);
+    g_free (sArguments);
+}
+
+static gint subscribe ()
+{
+    ipp_t *pRequest = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/");
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI, "notify-recipient-uri", NULL, "dbus://");
+    ippAddString (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-events", NULL, "all");
+    ippAddInteger (pRequest, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration", LEASE_DURATION);
+    ipp_t *pResponse = cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/");
+    ipp_attribute_t *pAttribute = pResponse != NULL ? ippFindAttribute (pResponse, "notify-subscription-id", IPP_TAG_INTEGER) : NULL;
+    gint nId = pAttribute != NULL ? ippGetInteger (pAttribute, 0) : 0;
+
+    ippDelete (pResponse);
+
+    return nId;
+}
+
+static void cancelSubscription (gint nId)
+{
+    ipp_t *pRequest = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/");
+    ippAddInteger (pRequest, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id", nId);
+    ippAddString (pRequest, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser ());
+    ippDelete (cupsDoRequest (CUPS_HTTP_DEFAULT, pRequest, "/"));
+}
+
+static gboolean onInterrupt (gpointer pData)
+{
+    g_main_loop_quit (pData);
+
+    return G_SOURCE_REMOVE;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        g_printerr ("Usage: %s [FILE]\n", argv[0]);
+
+        return 1;
+    }
+
+    GError *pError = NULL;
+    GDBusConnection *pConnection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &pError);
+
+    if (pConnection == NULL)
+    {
+        g_printerr ("Could not connect to the system bus: %s\n", pError->message);
+        g_error_free (pError);
+
+        return 1;
+    }
+
+    gint nSubscription = subscribe ();
+
+    if (nSubscription <= 0)
+    {
+        g_printerr ("Could not subscribe to the CUPS notifier: %s\n", cupsLastErrorString ());
+        g_object_unref (pConnection);
+
+        return 1;
+    }
+
+    Recorder cRecorder = {argc == 2 ? fopen (argv[1], "w") : stdout, g_main_loop_new (NULL, FALSE), 0, g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, freeJob)};
+
+    if (cRecorder.pFile == NULL)
+    {
+        g_printerr ("Could not open %s\n", argv[1]);
+        cancelSubscription (nSubscription);
+
+        return 1;
+    }
+
+    // Signals that arrive during the snapshot are delivered once the loop runs
+    guint nSignals = g_dbus_connection_signal_subscribe (pConnection, NULL, NOTIFIER_INTERFACE, NULL, NOTIFIER_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onSignal, &cRecorder, NULL);
+    writeSnapshot (&cRecorder);
+    g_unix_signal_add (SIGINT, onInterrupt, cRecorder.pLoop);
+    g_unix_signal_add (SIGTERM, onInterrupt, cRecorder.pLoop);
+    g_printerr ("Recording, interrupt to stop\n");
+    g_main_loop_run (cRecorder.pLoop);
+
+    fprintf (cRecorder.pFile, "dump\n");
+    g_dbus_connection_signal_unsubscribe (pConnection, nSignals);
+    cancelSubscription (nSubscription);
+
+    if (cRecorder.pFile != stdout)
+    {
+        fclose (cRecorder.pFile);
+    }
+
+    g_hash_table_unref (cRecorder.pJobs);
+    g_main_loop_unref (cRecorder.pLoop);
+    g_object_unref (pConnection);
+
+    return 0;
+}
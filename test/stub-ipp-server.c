@@ -0,0 +1,227 @@
+
+/* A minimal IPP-over-HTTP responder standing in for cupsd, so that tests and
+ * benchmarks run offline. Point libcups at it with the CUPS_SERVER
+ * environment variable before the first request. */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "stub-ipp-server.h"
+
+struct _StubIppServer
+{
+    gint nRefs;
+    int nSocket;
+    guint nPort;
+    GThread *pThread;
+    GMutex cMutex;
+    StubIppHandler pHandler;
+    gpointer pData;
+    gint nRequests;
+    gint bStopping;
+};
+
+typedef struct
+{
+    StubIppServer *pServer;
+    http_t *pHttp;
+} Connection;
+
+static void unrefServer (StubIppServer *self)
+{
+    if (g_atomic_int_dec_and_test (&self->nRefs))
+    {
+        g_mutex_clear (&self->cMutex);
+        g_free (self);
+    }
+}
+
+static gboolean handleRequest (StubIppServer *self, http_t *pHttp)
+{
+    gchar sUri[1024];
+    http_state_t nState = httpReadRequest (pHttp, sUri, sizeof (sUri));
+
+    if (nState == HTTP_STATE_WAITING)
+    {
+        return TRUE;
+    }
+
+    if (nState != HTTP_STATE_POST)
+    {
+        return FALSE;
+    }
+
+    http_status_t nStatus;
+
+    while ((nStatus = httpUpdate (pHttp)) == HTTP_STATUS_CONTINUE);
+
+    if (nStatus != HTTP_STATUS_OK)
+    {
+        return FALSE;
+    }
+
+    ipp_t *pRequest = ippNew ();
+    ipp_state_t nIppState;
+
+    while ((nIppState = ippRead (pHttp, pRequest)) != IPP_STATE_DATA)
+    {
+        if (nIppState == IPP_STATE_ERROR)
+        {
+            ippDelete (pRequest);
+
+            return FALSE;
+        }
+    }
+
+    g_atomic_int_inc (&self->nRequests);
+    g_mutex_lock (&self->cMutex);
+    ipp_t *pResponse = self->pHandler (pRequest, self->pData);
+    g_mutex_unlock (&self->cMutex);
+
+    if (pResponse == NULL)
+    {
+        pResponse = ippNewResponse (pRequest);
+        ippSetStatusCode (pResponse, IPP_OPERATION_NOT_SUPPORTED);
+    }
+
+    ippDelete (pRequest);
+    httpClearFields (pHttp);
+    httpSetField (pHttp, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+    httpSetLength (pHttp, ippLength (pResponse));
+    gboolean bOk = httpWriteResponse (pHttp, HTTP_STATUS_OK) == 0;
+    ippSetState (pResponse, IPP_STATE_IDLE);
+
+    while (bOk && (nIppState = ippWrite (pHttp, pResponse)) != IPP_STATE_DATA)
+    {
+        bOk = (nIppState != IPP_STATE_ERROR);
+    }
+
+    httpFlushWrite (pHttp);
+    ippDelete (pResponse);
+
+    return bOk;
+}
+
+static gpointer onConnection (gpointer pData)
+{
+    Connection *pConnection = pData;
+
+    /* keep-alive: serve requests until the client goes away */
+    while (!g_atomic_int_get (&pConnection->pServer->bStopping) && httpWait (pConnection->pHttp, 30000))
+    {
+        if (!handleRequest (pConnection->pServer, pConnection->pHttp))
+        {
+            break;
+        }
+    }
+
+    httpClose (pConnection->pHttp);
+    unrefServer (pConnection->pServer);
+    g_free (pConnection);
+
+    return NULL;
+}
+
+static gpointer onAccept (gpointer pData)
+{
+    StubIppServer *self = pData;
+
+    while (!g_atomic_int_get (&self->bStopping))
+    {
+        http_t *pHttp = httpAcceptConnection (self->nSocket, 1);
+
+        if (pHttp == NULL)
+        {
+            continue;
+        }
+
+        Connection *pConnection = g_new0 (Connection, 1);
+        pConnection->pServer = self;
+        pConnection->pHttp = pHttp;
+        g_atomic_int_inc (&self->nRefs);
+        g_thread_unref (g_thread_new ("stub-ipp-connection", onConnection, pConnection));
+    }
+
+    return NULL;
+}
+
+StubIppServer *stub_ipp_server_new (StubIppHandler pHandler, gpointer pData)
+{
+    struct sockaddr_in cAddress;
+    socklen_t nLength = sizeof (cAddress);
+    StubIppServer *self = g_new0 (StubIppServer, 1);
+
+    self->nRefs = 1;
+    self->pHandler = pHandler;
+    self->pData = pData;
+    g_mutex_init (&self->cMutex);
+
+    memset (&cAddress, 0, sizeof (cAddress));
+    cAddress.sin_family = AF_INET;
+    cAddress.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    cAddress.sin_port = 0;
+    self->nSocket = socket (AF_INET, SOCK_STREAM, 0);
+
+    if (self->nSocket < 0 || bind (self->nSocket, (struct sockaddr *) &cAddress, sizeof (cAddress)) < 0 || listen (self->nSocket, 64) < 0 || getsockname (self->nSocket, (struct sockaddr *) &cAddress, &nLength) < 0)
+    {
+        g_printerr ("Error creating stub IPP server socket\n");
+
+        if (self->nSocket >= 0)
+        {
+            close (self->nSocket);
+        }
+
+        unrefServer (self);
+
+        return NULL;
+    }
+
+    self->nPort = ntohs (cAddress.sin_port);
+    self->pThread = g_thread_new ("stub-ipp-server", onAccept, self);
+
+    return self;
+}
+
+void stub_ipp_server_free (StubIppServer *self)
+{
+    g_atomic_int_set (&self->bStopping, TRUE);
+
+    /* wakes up the blocking accept () */
+    shutdown (self->nSocket, SHUT_RDWR);
+    g_thread_join (self->pThread);
+    close (self->nSocket);
+    unrefServer (self);
+}
+
+gchar *stub_ipp_server_get_address (StubIppServer *self)
+{
+    return g_strdup_printf ("127.0.0.1:%u", self->nPort);
+}
+
+guint stub_ipp_server_get_n_requests (StubIppServer *self)
+{
+    return g_atomic_int_get (&self->nRequests);
+}
+
+void stub_ipp_server_reset_n_requests (StubIppServer *self)
+{
+    g_atomic_int_set (&self->nRequests, 0);
+}
+
+/* serialises changes to the handler data with the running handlers */
+void stub_ipp_server_lock (StubIppServer *self)
+{
+    g_mutex_lock (&self->cMutex);
+}
+
+void stub_ipp_server_unlock (StubIppServer *self)
+{
+    g_mutex_unlock (&self->cMutex);
+}
+
+/* lets a handler wait for pCond, the handler data can be changed meanwhile */
+void stub_ipp_server_wait (StubIppServer *self, GCond *pCond)
+{
+    g_cond_wait (pCond, &self->cMutex);
+}
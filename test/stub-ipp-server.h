@@ -0,0 +1,27 @@
+
+#ifndef STUB_IPP_SERVER_H
+#define STUB_IPP_SERVER_H
+
+#include <glib.h>
+#include <cups/cups.h>
+
+G_BEGIN_DECLS
+
+typedef struct _StubIppServer StubIppServer;
+
+/* returns the response to pRequest, or NULL for an unsupported operation;
+ * calls are serialised, but come from the server's connection threads */
+typedef ipp_t *(*StubIppHandler) (ipp_t *pRequest, gpointer pData);
+
+StubIppServer *stub_ipp_server_new (StubIppHandler pHandler, gpointer pData);
+void stub_ipp_server_free (StubIppServer *self);
+gchar *stub_ipp_server_get_address (StubIppServer *self);
+guint stub_ipp_server_get_n_requests (StubIppServer *self);
+void stub_ipp_server_reset_n_requests (StubIppServer *self);
+void stub_ipp_server_lock (StubIppServer *self);
+void stub_ipp_server_unlock (StubIppServer *self);
+void stub_ipp_server_wait (StubIppServer *self, GCond *pCond);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,350 @@
+
+#include <gio/gio.h>
+#include <cups/cups.h>
+#include "indicator-printer-model.h"
+#include "indicator-printers-section.h"
+#include "printer-query.h"
+
+#define MENU_PATH "/org/ayatana/indicator/printers/test"
+
+typedef struct
+{
+    GMainLoop *pLoop;
+    guint nSignals;
+    guint nChanges;
+    guint nRemoved;
+    guint nAdded;
+} Counters;
+
+static void addJob (IndicatorPrinterModel *pModel, const gchar *sPrinter, guint nJobId)
+{
+    indicator_printer_model_update_printer (pModel, sPrinter, IPP_PRINTER_PROCESSING, "none");
+    indicator_printer_model_update_job (pModel, sPrinter, nJobId, IPP_JOB_PENDING, TRUE);
+    indicator_printer_model_set_job_owner (pModel, nJobId, TRUE);
+}
+
+static void onChanged (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    Counters *pCounters = pData;
+    GVariantIter *pIter;
+    guint nRemoved;
+    GVariantIter *pAdded;
+
+    pCounters->nSignals++;
+    g_variant_get (pParameters, "(a(uuuuaa{sv}))", &pIter);
+
+    while (g_variant_iter_loop (pIter, "(uuuuaa{sv})", NULL, NULL, NULL, &nRemoved, &pAdded))
+    {
+        pCounters->nChanges++;
+        pCounters->nRemoved += nRemoved;
+        pCounters->nAdded += g_variant_iter_n_children (pAdded);
+    }
+
+    g_variant_iter_free (pIter);
+}
+
+static void onStarted (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    Counters *pCounters = pData;
+    GVariant *pReply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (pObject), pResult, NULL);
+
+    g_assert_nonnull (pReply);
+    g_variant_unref (pReply);
+    g_main_loop_quit (pCounters->pLoop);
+}
+
+static gboolean onTimeout (gpointer pData)
+{
+    g_main_loop_quit (pData);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void spin (GMainLoop *pLoop)
+{
+    g_timeout_add (200, onTimeout, pLoop);
+    g_main_loop_run (pLoop);
+}
+
+static void testSingleJobCountChange ()
+{
+    GTestDBus *pBus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (pBus);
+
+    GDBusConnection *pServer = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    GDBusConnection *pClient = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (pBus), G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, NULL, NULL);
+    g_assert_nonnull (pServer);
+    g_assert_nonnull (pClient);
+
+    IndicatorPrinterModel *pModel = indicator_printer_model_new ();
+    addJob (pModel, "printer-a", 1);
+    addJob (pModel, "printer-b", 2);
+    addJob (pModel, "printer-c", 3);
+
+    IndicatorPrintersSection *pSection = indicator_printers_section_new ();
+    GMenu *pMenu = g_menu_new ();
+    g_menu_append_section (pMenu, NULL, G_MENU_MODEL (pSection));
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 3);
+
+    guint nExportId = g_dbus_connection_export_menu_model (pServer, MENU_PATH, G_MENU_MODEL (pMenu), NULL);
+    g_assert_cmpuint (nExportId, !=, 0);
+
+    // Subscribe to the menu group like a panel would
+    Counters cCounters = {g_main_loop_new (NULL, FALSE), 0, 0, 0, 0};
+    g_dbus_connection_call (pClient, g_dbus_connection_get_unique_name (pServer), MENU_PATH, "org.gtk.Menus", "Start", g_variant_new_parsed ("([uint32 0],)"), G_VARIANT_TYPE ("(a(uuaa{sv}))"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, onStarted, &cCounters);
+    g_main_loop_run (cCounters.pLoop);
+    guint nSubscription = g_dbus_connection_signal_subscribe (pClient, NULL, "org.gtk.Menus", "Changed", MENU_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onChanged, &cCounters, NULL);
+
+    // An unchanged model must not produce any change
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    spin (cCounters.pLoop);
+    g_assert_cmpuint (cCounters.nSignals, ==, 0);
+
+    // One more job on the middle printer updates that single item in place
+    addJob (pModel, "printer-b", 4);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    spin (cCounters.pLoop);
+    g_assert_cmpuint (cCounters.nSignals, ==, 1);
+    g_assert_cmpuint (cCounters.nRemoved, ==, 1);
+    g_assert_cmpuint (cCounters.nAdded, ==, 1);
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 3);
+
+    gint nCount = 0;
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 1, "x-ayatana-secondary-count", "i", &nCount));
+    g_assert_cmpint (nCount, ==, 2);
+
+    g_dbus_connection_signal_unsubscribe (pClient, nSubscription);
+    g_dbus_connection_unexport_menu_model (pServer, nExportId);
+    g_main_loop_unref (cCounters.pLoop);
+    g_object_unref (pMenu);
+    g_object_unref (pSection);
+    g_object_unref (pModel);
+    g_object_unref (pClient);
+    g_object_unref (pServer);
+    g_test_dbus_down (pBus);
+    g_object_unref (pBus);
+}
+
+static void testSharedBetweenMenus ()
+{
+    GTestDBus *pBus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (pBus);
+
+    GDBusConnection *pServer = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    GDBusConnection *pClient = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (pBus), G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, NULL, NULL);
+    g_assert_nonnull (pServer);
+    g_assert_nonnull (pClient);
+
+    IndicatorPrinterModel *pModel = indicator_printer_model_new ();
+    addJob (pModel, "printer-a", 1);
+
+    // Like the phone and desktop profiles
+    IndicatorPrintersSection *pSection = indicator_printers_section_new ();
+    const gchar *lPaths[] = {MENU_PATH "/phone", MENU_PATH "/desktop"};
+    GMenu *lMenus[G_N_ELEMENTS (lPaths)];
+    guint lExportIds[G_N_ELEMENTS (lPaths)];
+    Counters cCounters = {g_main_loop_new (NULL, FALSE), 0, 0, 0, 0};
+
+    for (guint i = 0; i < G_N_ELEMENTS (lPaths); i++)
+    {
+        lMenus[i] = g_menu_new ();
+        g_menu_append_section (lMenus[i], NULL, G_MENU_MODEL (pSection));
+        lExportIds[i] = g_dbus_connection_export_menu_model (pServer, lPaths[i], G_MENU_MODEL (lMenus[i]), NULL);
+        g_assert_cmpuint (lExportIds[i], !=, 0);
+        g_dbus_connection_call (pClient, g_dbus_connection_get_unique_name (pServer), lPaths[i], "org.gtk.Menus", "Start", g_variant_new_parsed ("([uint32 0],)"), G_VARIANT_TYPE ("(a(uuaa{sv}))"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, onStarted, &cCounters);
+        g_main_loop_run (cCounters.pLoop);
+    }
+
+    guint nSubscription = g_dbus_connection_signal_subscribe (pClient, NULL, "org.gtk.Menus", "Changed", NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onChanged, &cCounters, NULL);
+
+    // A single update reaches every menu
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    spin (cCounters.pLoop);
+    g_assert_cmpuint (cCounters.nSignals, ==, G_N_ELEMENTS (lPaths));
+    g_assert_cmpuint (cCounters.nAdded, ==, G_N_ELEMENTS (lPaths));
+
+    g_dbus_connection_signal_unsubscribe (pClient, nSubscription);
+
+    for (guint i = 0; i < G_N_ELEMENTS (lPaths); i++)
+    {
+        g_dbus_connection_unexport_menu_model (pServer, lExportIds[i]);
+        g_object_unref (lMenus[i]);
+    }
+
+    g_main_loop_unref (cCounters.pLoop);
+    g_object_unref (pSection);
+    g_object_unref (pModel);
+    g_object_unref (pClient);
+    g_object_unref (pServer);
+    g_test_dbus_down (pBus);
+    g_object_unref (pBus);
+}
+
+static void testJobProgress ()
+{
+    IndicatorPrinterModel *pModel = indicator_printer_model_new ();
+    addJob (pModel, "printer-a", 1);
+    addJob (pModel, "printer-a", 2);
+
+    // No connection, so the totals stay unknown
+    IndicatorJobProgress *pProgress = indicator_job_progress_new (NULL);
+    IndicatorPrintersSection *pSection = indicator_printers_section_new ();
+    guint nPublished = 0;
+
+    // The first update is published right away
+    indicator_job_progress_update (pProgress, "printer-a", 1, "Report", 3);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, pProgress));
+
+    guint nCompleted = 0;
+    gchar *sName = NULL;
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, "x-ayatana-impressions-completed", "u", &nCompleted));
+    g_assert_cmpuint (nCompleted, ==, 3);
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, "x-ayatana-job-name", "s", &sName));
+    g_assert_cmpstr (sName, ==, "Report");
+    g_assert_false (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, "x-ayatana-progress", "i", NULL));
+    g_free (sName);
+
+    // Later ones within the interval are held back and folded into one
+    for (guint i = 4; i < 100; i++)
+    {
+        indicator_job_progress_update (pProgress, "printer-a", 1, "Report", i);
+    }
+
+    g_object_get (pProgress, "published", &nPublished, NULL);
+    g_assert_cmpuint (nPublished, ==, 1);
+    g_assert_cmpuint (indicator_job_progress_lookup (pProgress, 1)->nCompleted, ==, 3);
+
+    GMainLoop *pLoop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add (1200, onTimeout, pLoop);
+    g_main_loop_run (pLoop);
+    g_object_get (pProgress, "published", &nPublished, NULL);
+    g_assert_cmpuint (nPublished, ==, 2);
+    g_assert_cmpuint (indicator_job_progress_lookup (pProgress, 1)->nCompleted, ==, 99);
+
+    indicator_job_progress_remove (pProgress, 1);
+    g_assert_null (indicator_job_progress_lookup (pProgress, 1));
+
+    g_main_loop_unref (pLoop);
+    g_object_unref (pSection);
+    g_object_unref (pProgress);
+    g_object_unref (pModel);
+}
+
+static void testLimit ()
+{
+    IndicatorPrinterModel *pModel = indicator_printer_model_new ();
+    IndicatorPrintersSection *pSection = indicator_printers_section_new ();
+    guint nJobId = 1;
+
+    // printer-NN has NN + 1 jobs
+    for (guint i = 0; i < 30; i++)
+    {
+        gchar *sPrinter = g_strdup_printf ("printer-%02u", i);
+
+        for (guint j = 0; j <= i; j++)
+        {
+            addJob (pModel, sPrinter, nJobId++);
+        }
+
+        g_free (sPrinter);
+    }
+
+    indicator_printers_section_set_limit (pSection, 10);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 11);
+
+    // The busiest ones, by name
+    gchar *sLabel = NULL;
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, G_MENU_ATTRIBUTE_LABEL, "s", &sLabel));
+    g_assert_cmpstr (sLabel, ==, "printer-20");
+    g_free (sLabel);
+
+    gchar *sAction = NULL;
+    gint nHidden = 0;
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 10, G_MENU_ATTRIBUTE_ACTION, "s", &sAction));
+    g_assert_cmpstr (sAction, ==, "indicator.more-printers");
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 10, "x-ayatana-secondary-count", "i", &nHidden));
+    g_assert_cmpint (nHidden, ==, 20);
+    g_free (sAction);
+
+    // The next page
+    indicator_printers_section_set_limit (pSection, 20);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 21);
+
+    // All of them, without the "More printers" item
+    indicator_printers_section_set_limit (pSection, 0);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 30);
+
+    // A deleted queue leaves the busy printers, idle ones never count
+    g_assert_true (indicator_printer_model_remove_printer (pModel, "printer-29"));
+    indicator_printer_model_update_printer (pModel, "idle", IPP_PRINTER_IDLE, "none");
+    indicator_printers_section_set_limit (pSection, 10);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 11);
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, G_MENU_ATTRIBUTE_LABEL, "s", &sLabel));
+    g_assert_cmpstr (sLabel, ==, "printer-19");
+    g_free (sLabel);
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 10, "x-ayatana-secondary-count", "i", &nHidden));
+    g_assert_cmpint (nHidden, ==, 19);
+
+    g_object_unref (pSection);
+    g_object_unref (pModel);
+}
+
+static void testRemoteServer ()
+{
+    IndicatorPrinterModel *pModel = indicator_printer_model_new ();
+    IndicatorPrintersSection *pSection = indicator_printers_section_new ();
+    addJob (pModel, "printer-a", 1);
+
+    // A polled queue with a job of the user and one of somebody else, whose id is also used locally
+    PrinterQueryItem cItem = {"queue", IPP_PRINTER_PROCESSING, "none", g_array_new (FALSE, FALSE, sizeof (PrinterQueryJob))};
+    PrinterQueryJob lJobs[] = {{1, IPP_JOB_PROCESSING, TRUE}, {2, IPP_JOB_PENDING, FALSE}};
+    g_array_append_vals (cItem.lJobs, lJobs, G_N_ELEMENTS (lJobs));
+    GPtrArray *lPrinters = g_ptr_array_new ();
+    g_ptr_array_add (lPrinters, &cItem);
+
+    indicator_printer_model_reset_server (pModel, "print.example.com", lPrinters);
+    g_assert_cmpuint (indicator_printer_model_get_n_jobs (pModel, "queue@print.example.com"), ==, 1);
+    g_assert_cmpuint (indicator_printer_model_get_n_jobs (pModel, NULL), ==, 2);
+    g_assert_true (indicator_printers_section_update (pSection, pModel, NULL));
+    g_assert_cmpint (g_menu_model_get_n_items (G_MENU_MODEL (pSection)), ==, 2);
+
+    // Only the local queue opens the job viewer
+    gchar *sAction = NULL;
+    g_assert_true (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 0, G_MENU_ATTRIBUTE_ACTION, "s", &sAction));
+    g_assert_cmpstr (sAction, ==, "indicator.printer");
+    g_free (sAction);
+    g_assert_false (g_menu_model_get_item_attribute (G_MENU_MODEL (pSection), 1, G_MENU_ATTRIBUTE_ACTION, "s", NULL));
+
+    // A resync of the default server leaves the polled printers alone
+    GPtrArray *lEmpty = g_ptr_array_new ();
+    indicator_printer_model_reset (pModel, lEmpty);
+    g_assert_cmpuint (indicator_printer_model_get_n_jobs (pModel, NULL), ==, 1);
+
+    // An unreachable server drops its printers
+    indicator_printer_model_reset_server (pModel, "print.example.com", NULL);
+    g_assert_cmpuint (indicator_printer_model_get_n_jobs (pModel, NULL), ==, 0);
+    g_assert_false (indicator_printers_section_update (pSection, pModel, NULL));
+
+    g_ptr_array_unref (lEmpty);
+    g_ptr_array_unref (lPrinters);
+    g_array_unref (cItem.lJobs);
+    g_object_unref (pSection);
+    g_object_unref (pModel);
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/printers-section/single-job-count-change", testSingleJobCountChange);
+    g_test_add_func ("/printers-section/shared-between-menus", testSharedBetweenMenus);
+    g_test_add_func ("/printers-section/job-progress", testJobProgress);
+    g_test_add_func ("/printers-section/limit", testLimit);
+    g_test_add_func ("/printers-section/remote-server", testRemoteServer);
+
+    return g_test_run ();
+}
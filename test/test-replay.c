@@ -0,0 +1,1008 @@
+
+/* Replays a recorded scenario against the service library: the CUPS state of the
+ * scenario is served by a stub IPP server, its Notifier signals are emitted on a
+ * private bus that stands in for both the session and the system bus, and the
+ * notifications are caught by a fake notification server. At every "dump" line,
+ * the exported menu, the header state and the alerts since the last dump are
+ * written out, and the whole output is compared to the scenario's .golden file.
+ * The IPP requests the service issued are reported per operation, and checked
+ * against the scenario's "requests" budget.
+ *
+ * Scenario lines, see record-cups-scenario for how they are captured:
+ *
+ *   printer NAME STATE REASONS         add or update a queue, REASONS is comma-separated
+ *   delete-printer NAME                remove a queue and its jobs
+ *   job ID PRINTER STATE USER [TOTAL]  add or update a job, USER "-" is the current user,
+ *                                      TOTAL the job-impressions answered for it
+ *   signal MEMBER ARGS                 emit a Notifier signal, ARGS in GVariant text format
+ *   wait MS                            let the service run for MS milliseconds
+ *   dump                               settle, then write out the menu and the alerts
+ *   stats                              settle, then write out the IPP requests and the menu
+ *                                      rebuilds since the last dump or stats line
+ *   requests MAX                       fail if more than MAX IPP requests are issued
+ *   hold                               answer the next Get-Jobs requests, but only send the
+ *                                      answers at the next "release" line
+ *   release                            send the held answers
+ *
+ * The state lines before the first signal, wait, dump or stats are what cupsd knows
+ * when the service starts. Run with --update to rewrite the golden file. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <cups/cups.h>
+#include "indicator-printers-service.h"
+#include "dbus-names.h"
+#include "cups-notifier.h"
+#include "stub-ipp-server.h"
+
+#define MENU_PATH INDICATOR_PRINTERS_DBUS_OBJECT_PATH "/desktop"
+#define NOTIFICATIONS_NAME "org.freedesktop.Notifications"
+#define NOTIFICATIONS_PATH "/org/freedesktop/Notifications"
+// The service is considered settled after this long without requests, signals or menu updates
+#define QUIET_MS 2000
+#define SETTLE_MAX_MS 20000
+
+static const gchar m_sNotificationsXml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.Notifications'>"
+    "    <method name='Notify'>"
+    "      <arg type='s' direction='in'/>"
+    "      <arg type='u' direction='in'/>"
+    "      <arg type='s' direction='in'/>"
+    "      <arg type='s' direction='in'/>"
+    "      <arg type='s' direction='in'/>"
+    "      <arg type='as' direction='in'/>"
+    "      <arg type='a{sv}' direction='in'/>"
+    "      <arg type='i' direction='in'/>"
+    "      <arg type='u' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+typedef struct
+{
+    gchar *sName;
+    guint nState;
+    gchar *sReasons;
+} ReplayPrinter;
+
+typedef struct
+{
+    guint nId;
+    gchar *sPrinter;
+    guint nState;
+    gchar *sUser;
+    guint nImpressions;
+} ReplayJob;
+
+typedef struct
+{
+    GMainLoop *pLoop;
+    StubIppServer *pServer;
+    GDBusConnection *pConnection;
+    IndicatorPrintersService *pService;
+    // Guarded by the stub server's lock: the state, the request counts and the last activity
+    GHashTable *pPrinters;
+    GHashTable *pJobs;
+    GHashTable *pRequests;
+    gint nSubscriptions;
+    gint64 nLastActivity;
+    // Get-Jobs answers wait for cReleased while set
+    gboolean bHold;
+    GCond cReleased;
+    // Menu groups started for the current dump, "group:menu" -> items
+    GHashTable *pMenus;
+    GArray *lGroups;
+    GPtrArray *lAlerts;
+    guint nNotifications;
+    guint nDumps;
+    guint nMaxRequests;
+    // The counts at the last dump or stats line
+    guint nCheckedRequests;
+    guint nCheckedRebuilds;
+    GString *sOutput;
+} Replay;
+
+static void freePrinter (gpointer pData)
+{
+    ReplayPrinter *pPrinter = pData;
+
+    g_free (pPrinter->sName);
+    g_free (pPrinter->sReasons);
+    g_free (pPrinter);
+}
+
+static void freeJob (gpointer pData)
+{
+    ReplayJob *pJob = pData;
+
+    g_free (pJob->sPrinter);
+    g_free (pJob->sUser);
+    g_free (pJob);
+}
+
+static void touch (Replay *pReplay)
+{
+    stub_ipp_server_lock (pReplay->pServer);
+    pReplay->nLastActivity = g_get_monotonic_time ();
+    stub_ipp_server_unlock (pReplay->pServer);
+}
+
+static const gchar *getUser (ReplayJob *pJob)
+{
+    return g_str_equal (pJob->sUser, "-") ? cupsUser () : pJob->sUser;
+}
+
+static gint comparePrinters (gconstpointer pA, gconstpointer pB)
+{
+    return g_strcmp0 ((*(ReplayPrinter**) pA)->sName, (*(ReplayPrinter**) pB)->sName);
+}
+
+static gint compareJobs (gconstpointer pA, gconstpointer pB)
+{
+    guint nA = (*(ReplayJob**) pA)->nId;
+    guint nB = (*(ReplayJob**) pB)->nId;
+
+    return (nA > nB) - (nA < nB);
+}
+
+// The values of a hash table, sorted like cupsd sorts its answers
+static GPtrArray *getSorted (GHashTable *pTable, GCompareFunc pCompare)
+{
+    GPtrArray *lValues = g_ptr_array_new ();
+    GHashTableIter cIter;
+    gpointer pValue;
+    g_hash_table_iter_init (&cIter, pTable);
+
+    while (g_hash_table_iter_next (&cIter, NULL, &pValue))
+    {
+        g_ptr_array_add (lValues, pValue);
+    }
+
+    g_ptr_array_sort (lValues, pCompare);
+
+    return lValues;
+}
+
+static void addPrinters (Replay *pReplay, ipp_t *pResponse)
+{
+    GPtrArray *lPrinters = getSorted (pReplay->pPrinters, comparePrinters);
+
+    for (guint i = 0; i < lPrinters->len; i++)
+    {
+        ReplayPrinter *pPrinter = g_ptr_array_index (lPrinters, i);
+        gchar *sUri = g_strdup_printf ("ipp://localhost/printers/%s", pPrinter->sName);
+        gchar **lReasons = g_strsplit (pPrinter->sReasons, ",", -1);
+        guint nJobs = 0;
+        GHashTableIter cIter;
+        gpointer pJob;
+        g_hash_table_iter_init (&cIter, pReplay->pJobs);
+
+        while (g_hash_table_iter_next (&cIter, NULL, &pJob))
+        {
+            if (g_str_equal (((ReplayJob*) pJob)->sPrinter, pPrinter->sName) && ((ReplayJob*) pJob)->nState <= IPP_JOB_STOPPED)
+            {
+                nJobs++;
+            }
+        }
+
+        ippAddSeparator (pResponse);
+        ippAddString (pResponse, IPP_TAG_PRINTER, IPP_TAG_NAME, "printer-name", NULL, pPrinter->sName);
+        ippAddString (pResponse, IPP_TAG_PRINTER, IPP_TAG_URI, "printer-uri-supported", NULL, sUri);
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_ENUM, "printer-state", pPrinter->nState);
+        ippAddStrings (pResponse, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "printer-state-reasons", g_strv_length (lReasons), NULL, (const char * const *) lReasons);
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "printer-state-change-time", 0);
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_ENUM, "printer-type", 0);
+        ippAddBoolean (pResponse, IPP_TAG_PRINTER, "printer-is-accepting-jobs", 1);
+        ippAddInteger (pResponse, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "queued-job-count", nJobs);
+
+        g_strfreev (lReasons);
+        g_free (sUri);
+    }
+
+    g_ptr_array_unref (lPrinters);
+}
+
+static void addJob (ipp_t *pResponse, ReplayJob *pJob)
+{
+    gchar *sUri = g_strdup_printf ("ipp://localhost/printers/%s", pJob->sPrinter);
+
+    ippAddSeparator (pResponse);
+    ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-id", pJob->nId);
+    ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL, sUri);
+    ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_ENUM, "job-state", pJob->nState);
+    ippAddString (pResponse, IPP_TAG_JOB, IPP_TAG_NAME, "job-originating-user-name", NULL, getUser (pJob));
+
+    if (pJob->nImpressions > 0)
+    {
+        ippAddInteger (pResponse, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-impressions", pJob->nImpressions);
+    }
+
+    g_free (sUri);
+}
+
+static void addJobs (Replay *pReplay, ipp_t *pRequest, ipp_t *pResponse)
+{
+    ipp_attribute_t *pAttribute = ippFindAttribute (pRequest, "printer-uri", IPP_TAG_URI);
+    const gchar *sPrinter = pAttribute != NULL ? strstr (ippGetString (pAttribute, 0, NULL), "/printers/") : NULL;
+    pAttribute = ippFindAttribute (pRequest, "which-jobs", IPP_TAG_KEYWORD);
+    const gchar *sWhich = pAttribute != NULL ? ippGetString (pAttribute, 0, NULL) : "not-completed";
+    pAttribute = ippFindAttribute (pRequest, "my-jobs", IPP_TAG_BOOLEAN);
+    gboolean bMyJobs = pAttribute != NULL && ippGetBoolean (pAttribute, 0);
+    GPtrArray *lJobs = getSorted (pReplay->pJobs, compareJobs);
+
+    for (guint i = 0; i < lJobs->len; i++)
+    {
+        ReplayJob *pJob = g_ptr_array_index (lJobs, i);
+        gboolean bCompleted = pJob->nState >= IPP_JOB_CANCELED;
+
+        if (sPrinter != NULL && !g_str_equal (sPrinter + strlen ("/printers/"), pJob->sPrinter))
+        {
+            continue;
+        }
+
+        if ((g_str_equal (sWhich, "completed") && !bCompleted) || (g_str_equal (sWhich, "not-completed") && bCompleted))
+        {
+            continue;
+        }
+
+        if (bMyJobs && !g_str_equal (pJob->sUser, "-"))
+        {
+            continue;
+        }
+
+        addJob (pResponse, pJob);
+    }
+
+    g_ptr_array_unref (lJobs);
+}
+
+static ipp_t *onRequest (ipp_t *pRequest, gpointer pData)
+{
+    Replay *pReplay = pData;
+    ipp_op_t nOperation = ippGetOperation (pRequest);
+    guint nCount = GPOINTER_TO_UINT (g_hash_table_lookup (pReplay->pRequests, GINT_TO_POINTER (nOperation)));
+    ipp_t *pResponse = ippNewResponse (pRequest);
+
+    g_hash_table_insert (pReplay->pRequests, GINT_TO_POINTER (nOperation), GUINT_TO_POINTER (nCount + 1));
+    pReplay->nLastActivity = g_get_monotonic_time ();
+
+    switch (nOperation)
+    {
+        case CUPS_GET_PRINTERS:
+        {
+            addPrinters (pReplay, pResponse);
+
+            break;
+        }
+        case CUPS_GET_DEFAULT:
+        {
+            ippSetStatusCode (pResponse, IPP_NOT_FOUND);
+
+            break;
+        }
+        case IPP_GET_JOBS:
+        {
+            addJobs (pReplay, pRequest, pResponse);
+
+            // The answer has the state of now, whatever changes until it is released
+            while (pReplay->bHold)
+            {
+                stub_ipp_server_wait (pReplay->pServer, &pReplay->cReleased);
+            }
+
+            break;
+        }
+        // ipp://localhost/jobs/ID
+        case IPP_GET_JOB_ATTRIBUTES:
+        {
+            ipp_attribute_t *pAttribute = ippFindAttribute (pRequest, "job-uri", IPP_TAG_URI);
+            const gchar *sUri = pAttribute != NULL ? strrchr (ippGetString (pAttribute, 0, NULL), '/') : NULL;
+            ReplayJob *pJob = sUri != NULL ? g_hash_table_lookup (pReplay->pJobs, GUINT_TO_POINTER (atoi (sUri + 1))) : NULL;
+
+            if (pJob == NULL)
+            {
+                ippSetStatusCode (pResponse, IPP_NOT_FOUND);
+            }
+            else
+            {
+                addJob (pResponse, pJob);
+            }
+
+            break;
+        }
+        case IPP_CREATE_PRINTER_SUBSCRIPTION:
+        case IPP_CREATE_JOB_SUBSCRIPTION:
+        {
+            ippAddInteger (pResponse, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-subscription-id", ++pReplay->nSubscriptions);
+
+            break;
+        }
+        case IPP_RENEW_SUBSCRIPTION:
+        case IPP_CANCEL_SUBSCRIPTION:
+        {
+            break;
+        }
+        default:
+        {
+            ippDelete (pResponse);
+
+            return NULL;
+        }
+    }
+
+    return pResponse;
+}
+
+static void onNotify (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sMethod, GVariant *pParameters, GDBusMethodInvocation *pInvocation, gpointer pData)
+{
+    Replay *pReplay = pData;
+    const gchar *sSummary;
+    const gchar *sBody;
+
+    g_variant_get (pParameters, "(&su&s&s&s@as@a{sv}i)", NULL, NULL, NULL, &sSummary, &sBody, NULL, NULL, NULL);
+
+    // One line per alert
+    gchar **lLines = g_strsplit (sBody, "\n", -1);
+    gchar *sLine = g_strjoinv ("\\n", lLines);
+    g_ptr_array_add (pReplay->lAlerts, g_strdup_printf ("alert %s: %s", sSummary, sLine));
+    g_free (sLine);
+    g_strfreev (lLines);
+
+    touch (pReplay);
+    g_dbus_method_invocation_return_value (pInvocation, g_variant_new ("(u)", ++pReplay->nNotifications));
+}
+
+static const GDBusInterfaceVTable m_cNotificationsVTable = {onNotify, NULL, NULL};
+
+// Any menu or action update of the service
+static void onServiceSignal (GDBusConnection *pConnection, const gchar *sSender, const gchar *sPath, const gchar *sInterface, const gchar *sSignal, GVariant *pParameters, gpointer pData)
+{
+    touch (pData);
+}
+
+static gboolean onTimeout (gpointer pData)
+{
+    g_main_loop_quit (pData);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void spin (GMainLoop *pLoop, guint nMs)
+{
+    g_timeout_add (nMs, onTimeout, pLoop);
+    g_main_loop_run (pLoop);
+}
+
+// Runs until nothing happened for QUIET_MS
+static void settle (Replay *pReplay)
+{
+    gint64 nDeadline = g_get_monotonic_time () + SETTLE_MAX_MS * 1000;
+
+    while (TRUE)
+    {
+        spin (pReplay->pLoop, 100);
+        gint64 nNow = g_get_monotonic_time ();
+        stub_ipp_server_lock (pReplay->pServer);
+        gint64 nLastActivity = pReplay->nLastActivity;
+        stub_ipp_server_unlock (pReplay->pServer);
+
+        if (nNow - nLastActivity >= QUIET_MS * 1000 || nNow >= nDeadline)
+        {
+            break;
+        }
+    }
+}
+
+typedef struct
+{
+    GMainLoop *pLoop;
+    GVariant *pReply;
+} Call;
+
+static void onCalled (GObject *pObject, GAsyncResult *pResult, gpointer pData)
+{
+    Call *pCall = pData;
+    GError *pError = NULL;
+
+    pCall->pReply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (pObject), pResult, &pError);
+    g_assert_no_error (pError);
+    g_main_loop_quit (pCall->pLoop);
+}
+
+// The service runs on this thread's main loop, so a synchronous call would never be answered
+static GVariant *callService (Replay *pReplay, const gchar *sPath, const gchar *sInterface, const gchar *sMethod, GVariant *pParameters, const GVariantType *pReplyType)
+{
+    Call cCall = {pReplay->pLoop, NULL};
+
+    g_dbus_connection_call (pReplay->pConnection, INDICATOR_PRINTERS_DBUS_NAME, sPath, sInterface, sMethod, pParameters, pReplyType, G_DBUS_CALL_FLAGS_NONE, -1, NULL, onCalled, &cCall);
+    g_main_loop_run (pReplay->pLoop);
+
+    return cCall.pReply;
+}
+
+static gint compareKeys (gconstpointer pA, gconstpointer pB)
+{
+    return g_strcmp0 (*(const gchar**) pA, *(const gchar**) pB);
+}
+
+// The attributes sorted by name, icons only by their presence, links are written by the caller
+static void appendAttributes (GString *sOutput, guint nIndent, const gchar *sTitle, GVariant *pAttributes)
+{
+    GPtrArray *lKeys = g_ptr_array_new ();
+    GVariantIter cIter;
+    const gchar *sKey;
+    g_variant_iter_init (&cIter, pAttributes);
+
+    while (g_variant_iter_next (&cIter, "{&sv}", &sKey, NULL))
+    {
+        if (sKey[0] != ':')
+        {
+            g_ptr_array_add (lKeys, (gpointer) sKey);
+        }
+    }
+
+    g_ptr_array_sort (lKeys, compareKeys);
+    g_string_append_printf (sOutput, "%*s%s", nIndent, "", sTitle);
+
+    for (guint i = 0; i < lKeys->len; i++)
+    {
+        sKey = g_ptr_array_index (lKeys, i);
+
+        if (g_str_equal (sKey, "icon"))
+        {
+            g_string_append (sOutput, " icon");
+        }
+        else
+        {
+            GVariant *pValue = g_variant_lookup_value (pAttributes, sKey, NULL);
+            gchar *sValue = g_variant_print (pValue, FALSE);
+            g_string_append_printf (sOutput, " %s=%s", sKey, sValue);
+            g_free (sValue);
+            g_variant_unref (pValue);
+        }
+    }
+
+    g_string_append_c (sOutput, '\n');
+    g_ptr_array_unref (lKeys);
+}
+
+static void startGroup (Replay *pReplay, guint nGroup)
+{
+    for (guint i = 0; i < pReplay->lGroups->len; i++)
+    {
+        if (g_array_index (pReplay->lGroups, guint, i) == nGroup)
+        {
+            return;
+        }
+    }
+
+    g_array_append_val (pReplay->lGroups, nGroup);
+    GVariant *pReply = callService (pReplay, MENU_PATH, "org.gtk.Menus", "Start", g_variant_new_parsed ("([%u],)", nGroup), G_VARIANT_TYPE ("(a(uuaa{sv}))"));
+    GVariantIter *pIter;
+    guint nReplyGroup;
+    guint nMenu;
+    GVariant *pItems;
+    g_variant_get (pReply, "(a(uuaa{sv}))", &pIter);
+
+    while (g_variant_iter_next (pIter, "(uu@aa{sv})", &nReplyGroup, &nMenu, &pItems))
+    {
+        g_hash_table_insert (pReplay->pMenus, g_strdup_printf ("%u:%u", nReplyGroup, nMenu), pItems);
+    }
+
+    g_variant_iter_free (pIter);
+    g_variant_unref (pReply);
+}
+
+static void appendMenu (Replay *pReplay, GString *sOutput, guint nGroup, guint nMenu, guint nIndent)
+{
+    startGroup (pReplay, nGroup);
+    gchar *sKey = g_strdup_printf ("%u:%u", nGroup, nMenu);
+    GVariant *pItems = g_hash_table_lookup (pReplay->pMenus, sKey);
+    g_free (sKey);
+
+    if (pItems == NULL)
+    {
+        return;
+    }
+
+    for (gsize i = 0; i < g_variant_n_children (pItems); i++)
+    {
+        GVariant *pItem = g_variant_get_child_value (pItems, i);
+        guint nLinkGroup;
+        guint nLinkMenu;
+
+        appendAttributes (sOutput, nIndent, "item", pItem);
+
+        if (g_variant_lookup (pItem, ":section", "(uu)", &nLinkGroup, &nLinkMenu))
+        {
+            g_string_append_printf (sOutput, "%*ssection\n", nIndent + 2, "");
+            appendMenu (pReplay, sOutput, nLinkGroup, nLinkMenu, nIndent + 4);
+        }
+
+        if (g_variant_lookup (pItem, ":submenu", "(uu)", &nLinkGroup, &nLinkMenu))
+        {
+            g_string_append_printf (sOutput, "%*ssubmenu\n", nIndent + 2, "");
+            appendMenu (pReplay, sOutput, nLinkGroup, nLinkMenu, nIndent + 4);
+        }
+
+        g_variant_unref (pItem);
+    }
+}
+
+// Ends the groups started for the last dump, bKeep leaves them to the service like an open menu
+static void releaseGroups (Replay *pReplay, gboolean bKeep)
+{
+    if (!bKeep && pReplay->lGroups->len > 0)
+    {
+        GVariantBuilder cGroups;
+        g_variant_builder_init (&cGroups, G_VARIANT_TYPE ("au"));
+
+        for (guint i = 0; i < pReplay->lGroups->len; i++)
+        {
+            g_variant_builder_add (&cGroups, "u", g_array_index (pReplay->lGroups, guint, i));
+        }
+
+        GVariant *pReply = callService (pReplay, MENU_PATH, "org.gtk.Menus", "End", g_variant_new ("(au)", &cGroups), NULL);
+        g_variant_unref (pReply);
+    }
+
+    g_array_set_size (pReplay->lGroups, 0);
+    g_hash_table_remove_all (pReplay->pMenus);
+}
+
+static guint getRequests (Replay *pReplay)
+{
+    guint nTotal = 0;
+    GHashTableIter cIter;
+    gpointer pCount;
+
+    stub_ipp_server_lock (pReplay->pServer);
+    g_hash_table_iter_init (&cIter, pReplay->pRequests);
+
+    while (g_hash_table_iter_next (&cIter, NULL, &pCount))
+    {
+        nTotal += GPOINTER_TO_UINT (pCount);
+    }
+
+    stub_ipp_server_unlock (pReplay->pServer);
+
+    return nTotal;
+}
+
+// The rebuilds of the printers section, whether anybody watched it or not
+static guint getRebuilds (Replay *pReplay)
+{
+    GVariant *pReply = callService (pReplay, INDICATOR_PRINTERS_DBUS_OBJECT_PATH, "org.ayatana.indicator.printers.Stats", "GetStats", NULL, G_VARIANT_TYPE ("(a{sv})"));
+    GVariant *pStats = g_variant_get_child_value (pReply, 0);
+    guint nRun = 0;
+    guint nSkipped = 0;
+
+    g_variant_lookup (pStats, "rebuilds-run", "u", &nRun);
+    g_variant_lookup (pStats, "rebuilds-skipped", "u", &nSkipped);
+    g_variant_unref (pStats);
+    g_variant_unref (pReply);
+
+    return nRun + nSkipped;
+}
+
+static void checkpoint (Replay *pReplay)
+{
+    pReplay->nCheckedRequests = getRequests (pReplay);
+    pReplay->nCheckedRebuilds = getRebuilds (pReplay);
+}
+
+static void writeStats (Replay *pReplay)
+{
+    settle (pReplay);
+
+    guint nRequests = getRequests (pReplay);
+    guint nRebuilds = getRebuilds (pReplay);
+    g_string_append_printf (pReplay->sOutput, "stats requests=%u rebuilds=%u\n", nRequests - pReplay->nCheckedRequests, nRebuilds - pReplay->nCheckedRebuilds);
+    checkpoint (pReplay);
+}
+
+static void dump (Replay *pReplay)
+{
+    settle (pReplay);
+    g_string_append_printf (pReplay->sOutput, "# dump %u\n", ++pReplay->nDumps);
+
+    GVariant *pReply = callService (pReplay, INDICATOR_PRINTERS_DBUS_OBJECT_PATH, "org.gtk.Actions", "Describe", g_variant_new ("(s)", "_header"), G_VARIANT_TYPE ("((bgav))"));
+    GVariantIter *pState;
+    GVariant *pHeader;
+    g_variant_get (pReply, "((bgav))", NULL, NULL, &pState);
+
+    if (g_variant_iter_next (pState, "v", &pHeader))
+    {
+        appendAttributes (pReplay->sOutput, 0, "header", pHeader);
+        g_variant_unref (pHeader);
+    }
+
+    g_variant_iter_free (pState);
+    g_variant_unref (pReply);
+
+    appendMenu (pReplay, pReplay->sOutput, 0, 0, 0);
+    releaseGroups (pReplay, FALSE);
+
+    for (guint i = 0; i < pReplay->lAlerts->len; i++)
+    {
+        g_string_append_printf (pReplay->sOutput, "%s\n", (gchar*) g_ptr_array_index (pReplay->lAlerts, i));
+    }
+
+    g_ptr_array_set_size (pReplay->lAlerts, 0);
+
+    // After the groups were ended, reading the menu does not count
+    checkpoint (pReplay);
+}
+
+static void onNameAppeared (GDBusConnection *pConnection, const gchar *sName, const gchar *sOwner, gpointer pData)
+{
+    g_main_loop_quit (pData);
+}
+
+// Starts the service on the state read so far, and opens its menu like a panel would
+static void startService (Replay *pReplay)
+{
+    pReplay->pService = indicator_printers_service_new ();
+
+    guint nWatch = g_bus_watch_name_on_connection (pReplay->pConnection, INDICATOR_PRINTERS_DBUS_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE, onNameAppeared, NULL, pReplay->pLoop, NULL);
+    g_main_loop_run (pReplay->pLoop);
+    g_bus_unwatch_name (nWatch);
+
+    // Signals are only handled once the service subscribed
+    while (TRUE)
+    {
+        stub_ipp_server_lock (pReplay->pServer);
+        gboolean bSubscribed = pReplay->nSubscriptions > 0;
+        stub_ipp_server_unlock (pReplay->pServer);
+
+        if (bSubscribed)
+        {
+            break;
+        }
+
+        spin (pReplay->pLoop, 10);
+    }
+
+    GString *sIgnored = g_string_new (NULL);
+    appendMenu (pReplay, sIgnored, 0, 0, 0);
+    releaseGroups (pReplay, TRUE);
+    g_string_free (sIgnored, TRUE);
+    settle (pReplay);
+}
+
+static void emitSignal (Replay *pReplay, const gchar *sMember, const gchar *sArguments)
+{
+    GDBusSignalInfo *pInfo = g_dbus_interface_info_lookup_signal (cups_notifier_interface_info (), sMember);
+
+    if (pInfo == NULL)
+    {
+        g_error ("Unknown Notifier signal %s", sMember);
+    }
+
+    GString *sType = g_string_new ("(");
+
+    for (guint i = 0; pInfo->args != NULL && pInfo->args[i] != NULL; i++)
+    {
+        g_string_append (sType, pInfo->args[i]->signature);
+    }
+
+    g_string_append_c (sType, ')');
+
+    GError *pError = NULL;
+    GVariant *pParameters = g_variant_parse (G_VARIANT_TYPE (sType->str), sArguments, NULL, NULL, &pError);
+    g_assert_no_error (pError);
+    g_string_free (sType, TRUE);
+
+    touch (pReplay);
+    g_dbus_connection_emit_signal (pReplay->pConnection, NULL, CUPS_DBUS_PATH, CUPS_DBUS_INTERFACE, sMember, pParameters, &pError);
+    g_assert_no_error (pError);
+}
+
+static void runLine (Replay *pReplay, gchar **lWords, const gchar *sRest)
+{
+    const gchar *sCommand = lWords[0];
+    guint nWords = g_strv_length (lWords);
+
+    if (g_str_equal (sCommand, "printer") && nWords == 4)
+    {
+        ReplayPrinter *pPrinter = g_new0 (ReplayPrinter, 1);
+        pPrinter->sName = g_strdup (lWords[1]);
+        pPrinter->nState = atoi (lWords[2]);
+        pPrinter->sReasons = g_strdup (lWords[3]);
+        stub_ipp_server_lock (pReplay->pServer);
+        g_hash_table_replace (pReplay->pPrinters, pPrinter->sName, pPrinter);
+        stub_ipp_server_unlock (pReplay->pServer);
+    }
+    else if (g_str_equal (sCommand, "delete-printer") && nWords == 2)
+    {
+        stub_ipp_server_lock (pReplay->pServer);
+        g_hash_table_remove (pReplay->pPrinters, lWords[1]);
+        GHashTableIter cIter;
+        gpointer pJob;
+        g_hash_table_iter_init (&cIter, pReplay->pJobs);
+
+        while (g_hash_table_iter_next (&cIter, NULL, &pJob))
+        {
+            if (g_str_equal (((ReplayJob*) pJob)->sPrinter, lWords[1]))
+            {
+                g_hash_table_iter_remove (&cIter);
+            }
+        }
+
+        stub_ipp_server_unlock (pReplay->pServer);
+    }
+    else if (g_str_equal (sCommand, "job") && (nWords == 5 || nWords == 6))
+    {
+        ReplayJob *pJob = g_new0 (ReplayJob, 1);
+        pJob->nId = atoi (lWords[1]);
+        pJob->sPrinter = g_strdup (lWords[2]);
+        pJob->nState = atoi (lWords[3]);
+        pJob->sUser = g_strdup (lWords[4]);
+        pJob->nImpressions = nWords == 6 ? atoi (lWords[5]) : 0;
+        stub_ipp_server_lock (pReplay->pServer);
+        g_hash_table_replace (pReplay->pJobs, GUINT_TO_POINTER (pJob->nId), pJob);
+        stub_ipp_server_unlock (pReplay->pServer);
+    }
+    else if (g_str_equal (sCommand, "requests") && nWords == 2)
+    {
+        pReplay->nMaxRequests = atoi (lWords[1]);
+    }
+    else if (g_str_equal (sCommand, "signal") && nWords > 2)
+    {
+        emitSignal (pReplay, lWords[1], sRest + strlen (lWords[1]) + 1);
+    }
+    else if (g_str_equal (sCommand, "hold") && nWords == 1)
+    {
+        stub_ipp_server_lock (pReplay->pServer);
+        pReplay->bHold = TRUE;
+        stub_ipp_server_unlock (pReplay->pServer);
+    }
+    else if (g_str_equal (sCommand, "release") && nWords == 1)
+    {
+        stub_ipp_server_lock (pReplay->pServer);
+        pReplay->bHold = FALSE;
+        g_cond_broadcast (&pReplay->cReleased);
+        stub_ipp_server_unlock (pReplay->pServer);
+        touch (pReplay);
+    }
+    else if (g_str_equal (sCommand, "wait") && nWords == 2)
+    {
+        spin (pReplay->pLoop, atoi (lWords[1]));
+    }
+    else if (g_str_equal (sCommand, "dump") && nWords == 1)
+    {
+        dump (pReplay);
+    }
+    else if (g_str_equal (sCommand, "stats") && nWords == 1)
+    {
+        writeStats (pReplay);
+    }
+    else
+    {
+        g_error ("Malformed scenario line: %s %s", sCommand, sRest);
+    }
+}
+
+static gint compareOperations (gconstpointer pA, gconstpointer pB)
+{
+    gint nA = GPOINTER_TO_INT (*(gpointer*) pA);
+    gint nB = GPOINTER_TO_INT (*(gpointer*) pB);
+
+    return (nA > nB) - (nA < nB);
+}
+
+// Prints the requests per operation and returns their total
+static guint reportRequests (Replay *pReplay, const gchar *sScenario)
+{
+    GPtrArray *lOperations = g_ptr_array_new ();
+    guint nTotal = 0;
+    gchar *sName = g_path_get_basename (sScenario);
+
+    stub_ipp_server_lock (pReplay->pServer);
+    GHashTableIter cIter;
+    gpointer pOperation;
+    g_hash_table_iter_init (&cIter, pReplay->pRequests);
+
+    while (g_hash_table_iter_next (&cIter, &pOperation, NULL))
+    {
+        g_ptr_array_add (lOperations, pOperation);
+    }
+
+    g_ptr_array_sort (lOperations, compareOperations);
+    g_print ("%s: IPP requests", sName);
+
+    for (guint i = 0; i < lOperations->len; i++)
+    {
+        pOperation = g_ptr_array_index (lOperations, i);
+        guint nCount = GPOINTER_TO_UINT (g_hash_table_lookup (pReplay->pRequests, pOperation));
+        g_print (" %s=%u", ippOpString (GPOINTER_TO_INT (pOperation)), nCount);
+        nTotal += nCount;
+    }
+
+    stub_ipp_server_unlock (pReplay->pServer);
+    g_print (", %u in total\n", nTotal);
+    g_ptr_array_unref (lOperations);
+    g_free (sName);
+
+    return nTotal;
+}
+
+int main (int argc, char **argv)
+{
+    gboolean bUpdate = FALSE;
+    GOptionEntry lEntries[] =
+    {
+        {"update", 'u', 0, G_OPTION_ARG_NONE, &bUpdate, "Write the output to the golden file instead of comparing it", NULL},
+        {NULL}
+    };
+    GOptionContext *pContext = g_option_context_new ("SCENARIO - replay a recorded CUPS scenario");
+    g_option_context_add_main_entries (pContext, lEntries, NULL);
+    GError *pError = NULL;
+
+    if (!g_option_context_parse (pContext, &argc, &argv, &pError) || argc != 2)
+    {
+        g_printerr ("%s\n", pError != NULL ? pError->message : "A single scenario file is needed");
+        g_clear_error (&pError);
+        g_option_context_free (pContext);
+
+        return 1;
+    }
+
+    g_option_context_free (pContext);
+
+    gchar *sScenario = NULL;
+    g_file_get_contents (argv[1], &sScenario, NULL, &pError);
+    g_assert_no_error (pError);
+
+    Replay cReplay = {0};
+    cReplay.pLoop = g_main_loop_new (NULL, FALSE);
+    cReplay.pPrinters = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, freePrinter);
+    cReplay.pJobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, freeJob);
+    cReplay.pRequests = g_hash_table_new (g_direct_hash, g_direct_equal);
+    cReplay.pMenus = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+    cReplay.lGroups = g_array_new (FALSE, FALSE, sizeof (guint));
+    cReplay.lAlerts = g_ptr_array_new_with_free_func (g_free);
+    g_cond_init (&cReplay.cReleased);
+    cReplay.sOutput = g_string_new (NULL);
+    cReplay.pServer = stub_ipp_server_new (onRequest, &cReplay);
+
+    if (cReplay.pServer == NULL)
+    {
+        return 1;
+    }
+
+    // The environment reaches the worker threads' libcups globals as well
+    gchar *sCupsServer = stub_ipp_server_get_address (cReplay.pServer);
+    g_setenv ("CUPS_SERVER", sCupsServer, TRUE);
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    g_free (sCupsServer);
+
+    // One private bus serves as both the session and the system bus
+    GTestDBus *pBus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (pBus);
+    const gchar *sBusAddress = g_test_dbus_get_bus_address (pBus);
+    g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", sBusAddress, TRUE);
+
+    /* The service uses the bus singletons, which must not take the process down with
+     * them when the bus goes away at the end */
+    GDBusConnection *pSession = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &pError);
+    g_assert_no_error (pError);
+    GDBusConnection *pSystem = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &pError);
+    g_assert_no_error (pError);
+    g_dbus_connection_set_exit_on_close (pSession, FALSE);
+    g_dbus_connection_set_exit_on_close (pSystem, FALSE);
+
+    // The test's own connection
+    cReplay.pConnection = g_dbus_connection_new_for_address_sync (sBusAddress, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, NULL, &pError);
+    g_assert_no_error (pError);
+    GDBusNodeInfo *pNode = g_dbus_node_info_new_for_xml (m_sNotificationsXml, &pError);
+    g_assert_no_error (pError);
+    guint nObject = g_dbus_connection_register_object (cReplay.pConnection, NOTIFICATIONS_PATH, pNode->interfaces[0], &m_cNotificationsVTable, &cReplay, NULL, &pError);
+    g_assert_no_error (pError);
+    GVariant *pReply = g_dbus_connection_call_sync (cReplay.pConnection, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "RequestName", g_variant_new ("(su)", NOTIFICATIONS_NAME, 0), G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &pError);
+    g_assert_no_error (pError);
+    g_variant_unref (pReply);
+    guint nSignals = g_dbus_connection_signal_subscribe (cReplay.pConnection, INDICATOR_PRINTERS_DBUS_NAME, NULL, NULL, NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE, onServiceSignal, &cReplay, NULL);
+
+    gchar **lLines = g_strsplit (sScenario, "\n", -1);
+
+    for (guint i = 0; lLines[i] != NULL; i++)
+    {
+        gchar *sLine = g_strstrip (lLines[i]);
+
+        if (*sLine == '\0' || *sLine == '#')
+        {
+            continue;
+        }
+
+        gchar **lWords = g_strsplit_set (sLine, " \t", -1);
+        const gchar *sRest = sLine + strlen (lWords[0]);
+
+        while (*sRest == ' ' || *sRest == '\t')
+        {
+            sRest++;
+        }
+
+        // The state lines up to here are what cupsd knows when the service starts
+        if (cReplay.pService == NULL && (g_str_equal (lWords[0], "signal") || g_str_equal (lWords[0], "wait") || g_str_equal (lWords[0], "dump") || g_str_equal (lWords[0], "stats")))
+        {
+            startService (&cReplay);
+        }
+
+        runLine (&cReplay, lWords, sRest);
+        g_strfreev (lWords);
+    }
+
+    g_strfreev (lLines);
+    g_free (sScenario);
+
+    guint nRequests = reportRequests (&cReplay, argv[1]);
+    gchar *sGolden = g_strdup (argv[1]);
+    gint nResult = 0;
+
+    // foo.scenario -> foo.golden
+    if (g_str_has_suffix (sGolden, ".scenario"))
+    {
+        sGolden[strlen (sGolden) - strlen (".scenario")] = '\0';
+    }
+
+    gchar *sGoldenPath = g_strconcat (sGolden, ".golden", NULL);
+    g_free (sGolden);
+
+    if (bUpdate)
+    {
+        g_file_set_contents (sGoldenPath, cReplay.sOutput->str, cReplay.sOutput->len, &pError);
+        g_assert_no_error (pError);
+        g_print ("Wrote %s\n", sGoldenPath);
+    }
+    else
+    {
+        gchar *sExpected = NULL;
+        g_file_get_contents (sGoldenPath, &sExpected, NULL, &pError);
+        g_assert_no_error (pError);
+
+        if (!g_str_equal (sExpected, cReplay.sOutput->str))
+        {
+            g_printerr ("Output differs from %s\n--- expected\n%s--- actual\n%s", sGoldenPath, sExpected, cReplay.sOutput->str);
+            nResult = 1;
+        }
+
+        g_free (sExpected);
+    }
+
+    if (cReplay.nMaxRequests > 0 && nRequests > cReplay.nMaxRequests)
+    {
+        g_printerr ("%u IPP requests issued, the scenario allows %u\n", nRequests, cReplay.nMaxRequests);
+        nResult = 1;
+    }
+
+    g_free (sGoldenPath);
+    g_clear_object (&cReplay.pService);
+
+    // Let the cancelled requests of the service run out
+    spin (cReplay.pLoop, 200);
+    g_dbus_connection_signal_unsubscribe (cReplay.pConnection, nSignals);
+    g_dbus_connection_unregister_object (cReplay.pConnection, nObject);
+    g_dbus_node_info_unref (pNode);
+    g_object_unref (cReplay.pConnection);
+
+    // The service's bus singletons may outlive it, so the bus is not torn down with g_test_dbus_down ()
+    g_test_dbus_stop (pBus);
+    g_object_unref (pSystem);
+    g_object_unref (pSession);
+    g_object_unref (pBus);
+    stub_ipp_server_free (cReplay.pServer);
+    g_string_free (cReplay.sOutput, TRUE);
+    g_ptr_array_unref (cReplay.lAlerts);
+    g_cond_clear (&cReplay.cReleased);
+    g_array_unref (cReplay.lGroups);
+    g_hash_table_unref (cReplay.pMenus);
+    g_hash_table_unref (cReplay.pRequests);
+    g_hash_table_unref (cReplay.pJobs);
+    g_hash_table_unref (cReplay.pPrinters);
+    g_main_loop_unref (cReplay.pLoop);
+
+    return nResult;
+}